@@ -19,6 +19,7 @@ SOURCES += \
     alignmentgui.cpp \
     analyser.cpp \
     analysergui.cpp \
+    batch.cpp \
     chord.cpp \
     chorddata.cpp \
     functions.cpp \
@@ -30,10 +31,12 @@ SOURCES += \
     omissiongui.cpp \
     overallscalegui.cpp \
     pedalnotesgui.cpp \
+    preset.cpp \
     savesettingsgui.cpp \
     subsettingsgui.cpp
 
 HEADERS += \
+    batch.h \
     chord.h \
     chorddata.h \
     functions.h \
@@ -283,6 +283,7 @@ void Interface::import_alignment()
 	if(dialog -> exec())
 	{
 		alignment_list.clear();
+		alignment_keys.clear();
 		QStringList temp = dialog -> selectedFiles();
 		QFileInfo fileinfo(temp[0]);
 		strcpy(align_db_filename, fileinfo.fileName().toLocal8Bit().data());
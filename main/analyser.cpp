@@ -3,9 +3,11 @@
 // analyser.cpp
 
 #include <cmath>
+#include <cstdio>
 #include <cstring>
 #include <ctime>
 #include <fstream>
+#include <mutex>
 #include <vector>
 
 #include "chord.h"
@@ -22,13 +24,35 @@ void Chord::analyse()
 }
 
 void Chord::substitute()
+// A BothChords search may be split into shards, each testing a range of the pairs ('sub_library') and
+// writing the pairs found to a partial file; the merge then goes on like a search resumed at the end.
 {
 	begin_sub = clock();
+	if(shard_mode != NoShard && object != BothChords)
+	{
+		if(language == English)
+			throw "ERROR - only the substitution of both chords can be sharded.";
+		else  throw "错误：只有同时替代两个和弦时可以分片运行。";
+	}
 	set_param_center();
 	set_param_range();
+	int cursor = 0;
+	vector<int> accepted; // positions (in 'sub_library') of the pairs found in a BothChords search
+	if(object == BothChords && shard_mode == MergeShards)
+		read_sub_shards(cursor, accepted);
+	else if(object == BothChords && resume_sub && shard_mode == NoShard)
+	{
+		if( !load_checkpoint_sub(cursor, accepted) )
+		{
+			cursor = 0;
+			accepted.clear();
+		}
+	}
 	set_sub_library();
 	record_ante.clear();
 	record_post.clear();
+	top_sub.clear();
+	sub_canceled = false;
 
 	char name1[200], name2[200];
 	strcpy(name1, output_path);
@@ -37,20 +61,25 @@ void Chord::substitute()
 	strcat(name2, ((QString)output_name_sub).toLocal8Bit().data());
 	strcat(name1, ".txt");
 	strcat(name2, ".mid");
-	if(output_mode_sub != MidiOnly)
+	if(output_mode_sub != MidiOnly && shard_mode != WriteShard)
 		fout.open(name1, ios::trunc);
-	if(output_mode_sub != TextOnly)
+	if(output_mode_sub != TextOnly && shard_mode != WriteShard)
 		m_fout.open(name2, ios::trunc | ios::binary);
 
 	Chord antechord(reduced_ante_notes, 0);
 	Chord postchord(reduced_post_notes, 0);
+	vector<int> candidates, _notes;
+	if(object != BothChords)
+		query_sub_index(candidates);
 	if(object == Postchord)
 	{
-		for(int i = 0; i < (1 << 12) - 1; ++i)
+		for(int k = 0; k < (int)candidates.size(); ++k)
 		{
-			if(sub_library[i] == reduced_post_notes)
+			const int i = candidates[k] - 1;
+			if(sub_id(i) == notes_to_id(reduced_post_notes))
 				continue;
-			Chord new_postchord(sub_library[i], antechord.chroma_old);
+			id_to_notes(sub_id(i), _notes);
+			Chord new_postchord(_notes, antechord.chroma_old);
 			postchord.find_vec(new_postchord, false, true);
 			new_postchord.sim_orig = set_similarity(postchord, new_postchord, true);
 			if( valid_sub(new_postchord, antechord) )
@@ -61,11 +90,13 @@ void Chord::substitute()
 	}
 	else if(object == Antechord)
 	{
-		for(int i = 0; i < (1 << 12) - 1; ++i)
+		for(int k = 0; k < (int)candidates.size(); ++k)
 		{
-			if(sub_library[i] == reduced_ante_notes)
+			const int i = candidates[k] - 1;
+			if(sub_id(i) == notes_to_id(reduced_ante_notes))
 				continue;
-			Chord new_antechord(sub_library[i], postchord.chroma_old);
+			id_to_notes(sub_id(i), _notes);
+			Chord new_antechord(_notes, postchord.chroma_old);
 			antechord.find_vec(new_antechord, false, true);
 			new_antechord.sim_orig = set_similarity(antechord, new_antechord, true);
 			if( valid_sub(new_antechord, postchord) )
@@ -76,74 +107,350 @@ void Chord::substitute()
 	}
 	else if(object == BothChords)
 	{
-		const int size = (test_all ? 16769025 : sample_size);
-		// 16769025 = ( (1 << 12) - 1 ) ^ 2
-		prgdialog_sub -> setMaximum(size - 1);
-		begin_loop_sub = clock();
-		int count = 0;
-
-		for(int i = 0; i < size; ++i)
+		const int size = sub_pair_count();
+		int last = size;
+		if(shard_mode == WriteShard)
 		{
-			if(sub_library[2 * i] == reduced_ante_notes &&
-				sub_library[2 * i + 1] == reduced_post_notes)
-				continue;
-			Chord chord1(sub_library[2 * i], 0);
-			Chord chord2(sub_library[2 * i + 1], chord1.chroma_old);
-			antechord.find_vec(chord1, false, true);
-			postchord.find_vec(chord2, false, true);
-			chord1.sim_orig = set_similarity(antechord, chord1, true);
-			chord2.sim_orig = set_similarity(postchord, chord2, true);
-			if( valid_sub(chord2, chord1) && valid_single_chord(chord1) )
+			cursor = (long long)size * (shard_index - 1) / shard_count;
+			last = (long long)size * shard_index / shard_count;
+		}
+		const int first = cursor;
+
+		vector<bool> ante_passed, post_passed;
+		const int orig_ante_id = notes_to_id(reduced_ante_notes), orig_post_id = notes_to_id(reduced_post_notes);
+		set_sub_passed(antechord, postchord, ante_passed, post_passed);
+		for(int k = 0; k < (int)accepted.size(); ++k)
+			test_sub_pair(accepted[k], antechord, postchord);
+		// When resuming, the pairs found before the checkpoint are rebuilt first, so that
+		// the results come out in the same order as in an uninterrupted search.
+		begin_progress(size - 1);
+		bool top_changed = true;
+		double last_checkpoint = now_seconds();
+
+		for(int i = cursor; i < last; ++i)
+		{
+			const int ante_id = sub_id(2 * i), post_id = sub_id(2 * i + 1);
+			if( !(ante_id == orig_ante_id && post_id == orig_post_id)
+			 && ante_passed[ante_id] && post_passed[post_id]
+			 && test_sub_pair(i, antechord, postchord) )
 			{
-				chord2.orig_pos = (count++);
-				record_ante.push_back( static_cast<ChordData>(chord1) );
-				record_post.push_back( static_cast<ChordData>(chord2) );
+				accepted.push_back(i);
+				top_changed = true;
 			}
 
 			if(i % 500 == 0)
 			{
-				labeltext_sub.clear();
-				set_est_time(i, true);
-				prgdialog_sub -> setLabelText(labeltext_sub);
-				if(prgdialog_sub -> wasCanceled())  abort(true);
-				prgdialog_sub -> setValue(i);
+				if(top_changed && !top_sub.empty())
+				{
+					QStringList str = {"\n\nBest so far:", "\n\n当前最佳："};
+					QString detail = str[language];
+					for(int j = 0; j < (int)top_sub.size(); ++j)
+						detail += ((QString)"\n(%1) -> (%2)").arg(record_ante[top_sub[j].orig_pos].get_name()).arg(top_sub[j].get_name());
+					set_progress_text("", detail);
+					top_changed = false;
+				}
+				set_progress(i, i);
+				if(canceled() && shard_mode == WriteShard)  abort();
+				if(canceled())
+				{
+					sub_canceled = true;
+					save_checkpoint_sub(i + 1, accepted);
+					break;
+				}
+				// Cancelling only ends the search; what has been found is still sorted and written,
+				// and the search can be resumed from the checkpoint later.
+				if(shard_mode == NoShard && now_seconds() - last_checkpoint > CHECKPOINT_INTERVAL)
+				{
+					save_checkpoint_sub(i + 1, accepted);
+					last_checkpoint = now_seconds();
+				}
 			}
 		}
+		if(shard_mode == WriteShard)
+		{
+			write_sub_shard(first, last, accepted);
+			sub_size = accepted.size();
+			return;
+		}
+		if(!sub_canceled)
+		{
+			char name[200];
+			set_checkpoint_name(name);
+			remove(name);
+		}
 		sort_results(record_post, true);
 		sub_size = record_post.size();
 	}
 
 	if(object == BothChords)
 	{
+		if(!sub_canceled && canceled())  abort();
 		QStringList str = {"(Writing to file(s)...)", "（正在写入文件…）"};
-		prgdialog_sub -> setLabelText(str[language]);
-		if(prgdialog_sub -> wasCanceled())  abort(true);
-		set_est_time(prgdialog_sub -> maximum(), true);
-		prgdialog_sub -> setValue(prgdialog_sub -> maximum());
+		end_progress(str[language]);
 	}
 	if(output_mode_sub != MidiOnly)  print_sub();
 	if(output_mode_sub != TextOnly)  to_midi_sub();
-	if(object == BothChords)
-		prgdialog_sub -> close();
+}
+
+void Chord::substitute_sequence()
+// Finds the best substitute of the whole progression 'seq_notes'.
+// Each pair of adjacent chords must satisfy the conditions of a BothChords substitution of the
+// corresponding original pair, and sequences are compared by the sum of the sort keys
+// ('sort_order_sub') over all pairs, with earlier keys taking precedence.
+// Since comparing these sums is compatible with addition, the best sequence is found by dynamic
+// programming over the positions (Viterbi algorithm), testing only pairs of candidates of adjacent positions.
+{
+	begin_sub = clock();
+	const int len = seq_notes.size();
+	if(len < 2)
+	{
+		if(language == English)
+			throw "Please enter a progression of at least two chords.";
+		else  throw "请输入至少含两个和弦的进行。";
+	}
+
+	char name1[200], name2[200];
+	strcpy(name1, output_path);
+	strcpy(name2, output_path);
+	strcat(name1, ((QString)output_name_sub).toLocal8Bit().data());
+	strcat(name2, ((QString)output_name_sub).toLocal8Bit().data());
+	strcat(name1, ".txt");
+	strcat(name2, ".mid");
+
+	vector<vector<int>> cand(len);           // ids of the candidate sets at each position
+	vector<vector<vector<double>>> score(len); // best score of a sequence ending with each candidate
+	vector<vector<int>> back(len);           // previous candidate on the best sequence; -1 if unreachable
+	vector<bool> ante_passed, post_passed;
+	vector<int> _notes;
+	begin_progress(len - 1);
+
+	for(int pos = 0; pos < len - 1; ++pos)
+	{
+		set_progress(pos);
+		if(canceled())  abort();
+
+		ante_notes = seq_notes[pos];
+		post_notes = seq_notes[pos + 1];
+		set_param_center();
+		set_param_range();
+		Chord antechord(reduced_ante_notes, 0);
+		Chord postchord(reduced_post_notes, 0);
+		set_sub_passed(antechord, postchord, ante_passed, post_passed);
+
+		if(pos == 0)
+		{
+			for(int id = 1; id < (1 << 12); ++id)
+			{
+				if(!ante_passed[id])  continue;
+				cand[0].push_back(id);
+				score[0].push_back(vector<double>());
+				back[0].push_back(0);
+			}
+		}
+		for(int id = 1; id < (1 << 12); ++id)
+		{
+			if(post_passed[id])
+			{
+				cand[pos + 1].push_back(id);
+				back[pos + 1].push_back(-1);
+			}
+		}
+		score[pos + 1].resize(cand[pos + 1].size());
+
+		for(int i = 0; i < (int)cand[pos].size(); ++i)
+		{
+			if(back[pos][i] == -1 || !ante_passed[cand[pos][i]])
+				continue;
+			id_to_notes(cand[pos][i], _notes);
+			Chord chord1(_notes, 0);
+			antechord.find_vec(chord1, false, true);
+			chord1.sim_orig = set_similarity(antechord, chord1, true);
+
+			for(int j = 0; j < (int)cand[pos + 1].size(); ++j)
+			{
+				if(cand[pos][i] == notes_to_id(reduced_ante_notes) && cand[pos + 1][j] == notes_to_id(reduced_post_notes))
+					continue;
+				id_to_notes(cand[pos + 1][j], _notes);
+				Chord chord2(_notes, chord1.chroma_old);
+				postchord.find_vec(chord2, false, true);
+				chord2.sim_orig = set_similarity(postchord, chord2, true);
+				if( !valid_sub(chord2, chord1) )
+					continue;
+
+				vector<double> new_score;
+				add_sub_score(score[pos][i], chord2, new_score);
+				if(back[pos + 1][j] == -1 || larger_score(new_score, score[pos + 1][j]))
+				{
+					score[pos + 1][j] = new_score;
+					back[pos + 1][j] = i;
+				}
+			}
+		}
+	}
+
+	int best = -1;
+	for(int j = 0; j < (int)cand[len - 1].size(); ++j)
+	{
+		if(back[len - 1][j] != -1 && (best == -1 || larger_score(score[len - 1][j], score[len - 1][best])))
+			best = j;
+	}
+
+	vector<int> best_ids(len);
+	if(best != -1)
+	{
+		for(int pos = len - 1, i = best; pos >= 0; --pos)
+		{
+			best_ids[pos] = cand[pos][i];
+			i = back[pos][i];
+		}
+	}
+
+	QStringList str = {"(Writing to file(s)...)", "（正在写入文件…）"};
+	end_progress(str[language]);
+	if(output_mode_sub != MidiOnly)
+	{
+		fout.open(name1, ios::trunc);
+		print_sub_sequence(best_ids, best != -1);
+	}
+	if(output_mode_sub != TextOnly)
+	{
+		m_fout.open(name2, ios::trunc | ios::binary);
+		vector<vector<int>> chords(len);
+		for(int pos = 0; pos < len; ++pos)
+			reduce_notes(seq_notes[pos], chords[pos]);
+		if(best != -1)
+		{
+			for(int pos = 0; pos < len; ++pos)
+			{
+				id_to_notes(best_ids[pos], _notes);
+				chords.push_back(_notes);
+			}
+		}
+		midi_head();
+		for(int i = 0; i < (int)chords.size(); ++i)
+			chord_to_midi(chords[i]);
+		midi_flush();
+	}
+}
+
+void Chord::print_sub_sequence(const vector<int>& best_ids, bool found)
+{
+	const int len = seq_notes.size();
+	vector<int> _notes;
+	fout << ((language == English) ? "Original: " : "原进行：");
+	for(int pos = 0; pos < len; ++pos)
+	{
+		reduce_notes(seq_notes[pos], _notes);
+		Chord chord(_notes, 0);
+		fout << (pos == 0 ? "(" : " -> (") << chord.name << ")";
+	}
+	fout << ((language == English) ? "\nSubstitute: Sequence\n" : "\n替代：序列\n");
+	print_sub_conditions();
+
+	fout << ((language == English) ? "\n\nBest substitute sequence:\n" : "\n\n最佳替代序列：\n");
+	if(!found)
+		fout << ((language == English) ? "No substitutions found in this condition.\n" : "在该条件下未找到结果。\n");
+	else
+	{
+		vector<int> notes1, notes2;
+		for(int pos = 0; pos < len - 1; ++pos)
+		{
+			ante_notes = seq_notes[pos];
+			post_notes = seq_notes[pos + 1];
+			set_param_center();
+			set_param_range();
+			Chord antechord(reduced_ante_notes, 0);
+			Chord postchord(reduced_post_notes, 0);
+			id_to_notes(best_ids[pos], notes1);
+			id_to_notes(best_ids[pos + 1], notes2);
+			Chord chord1(notes1, 0);
+			Chord chord2(notes2, chord1.chroma_old);
+			antechord.find_vec(chord1, false, true);
+			postchord.find_vec(chord2, false, true);
+			chord1.sim_orig = set_similarity(antechord, chord1, true);
+			chord2.sim_orig = set_similarity(postchord, chord2, true);
+			valid_sub(chord2, chord1);
+			// This sets the parameters of the progression in 'chord2'.
+			print_substitution(sort_order_sub, true, true, chord1, chord2, language);
+		}
+		tflush();
+	}
+
+	end_sub = clock();
+	double dur = (double) (end_sub - begin_sub) / CLOCKS_PER_SEC;
+	if(language == English)
+		fout << "\nFinished in " << fixed << setprecision(2) << dur << " seconds.";
+	else  fout << "\n耗时 " << fixed << setprecision(2) << dur << " 秒。";
+	fout.close();
+}
+
+void Chord::add_sub_score(const vector<double>& score, ChordData& chord, vector<double>& result)
+// 'result' = 'score' + the sort keys of 'chord', each signed so that a larger value is better.
+{
+	result.clear();
+	for(int pos = 0, k = 0; sort_order_sub[pos] != '\0'; ++pos, ++k)
+	{
+		char ch = sort_order_sub[pos];
+		bool ascending = (sort_order_sub[pos + 1] == '+');
+		if(ascending)  ++pos;
+		double key = 0.0;
+		switch(ch)
+		{
+			case 'P': key = chord.get_sim_orig();     break;
+			case 'N': key = chord.get_s_size();       break;
+			case 'T': key = chord.get_tension();      break;
+			case 'K': key = chord.get_chroma();       break;
+			case 'C': key = chord.get_common_note();  break;
+			case 'a': key = chord.get_span();         break;
+			case 'A': key = chord.get_sspan();        break;
+			case 'S': key = chord.get_sv();           break;
+			case 'Q': key = chord.get_Q_indicator();  break;
+			case 'X': key = chord.get_similarity();   break;
+			case 'k': key = chord.get_chroma_old();   break;
+			case 'R': key = chord.get_root();         break;
+			case 'V': key = -rm_priority[chord.get_root_movement()];  break;
+			// A smaller 'rm_priority' comes first.
+		}
+		if(ascending)  key = -key;
+		result.push_back( ((int)score.size() > k ? score[k] : 0.0) + key );
+	}
+}
+
+bool Chord::larger_score(const vector<double>& score1, const vector<double>& score2)
+{
+	for(int i = 0; i < (int)score1.size(); ++i)
+	{
+		if(score1[i] != score2[i])
+			return score1[i] > score2[i];
+	}
+	return false;
+}
+
+void Chord::set_sub_passed(Chord& antechord, Chord& postchord, vector<bool>& ante_passed, vector<bool>& post_passed)
+// The conditions on a single chord depend only on its set, so they are checked once for each set
+// instead of once for each pair; only pairs passing both are built and compared.
+{
+	vector<int> _notes;
+	ante_passed.assign(1 << 12, false);
+	post_passed.assign(1 << 12, false);
+	for(int id = 1; id < (1 << 12); ++id)
+	{
+		id_to_notes(id, _notes);
+		Chord chord1(_notes, 0);
+		Chord chord2(_notes, 0);
+		antechord.find_vec(chord1, false, true);
+		postchord.find_vec(chord2, false, true);
+		chord1.sim_orig = set_similarity(antechord, chord1, true);
+		chord2.sim_orig = set_similarity(postchord, chord2, true);
+		ante_passed[id] = valid_single_chord(chord1);
+		post_passed[id] = valid_sub_single(chord2);
+	}
 }
 
 void Chord::set_param_center()
 {
-	reduced_ante_notes = ante_notes;
-	for(int i = 0; i < (int)reduced_ante_notes.size(); ++i)
-		reduced_ante_notes[i] %= 12;
-	bubble_sort(reduced_ante_notes);
-	remove_duplicate(reduced_ante_notes);
-	for(int i = 0; i < (int)reduced_ante_notes.size(); ++i)
-		reduced_ante_notes[i] += 72;
-
-	reduced_post_notes = post_notes;
-	for(int i = 0; i < (int)reduced_post_notes.size(); ++i)
-		reduced_post_notes[i] %= 12;
-	bubble_sort(reduced_post_notes);
-	remove_duplicate(reduced_post_notes);
-	for(int i = 0; i < (int)reduced_post_notes.size(); ++i)
-		reduced_post_notes[i] += 72;
+	reduce_notes(ante_notes, reduced_ante_notes);
+	reduce_notes(post_notes, reduced_post_notes);
 
 	Chord antechord(reduced_ante_notes, 0);
 	Chord postchord(reduced_post_notes, antechord.get_chroma_old());
@@ -275,71 +582,119 @@ void Chord::set_param_range()
 }
 
 void Chord::set_sub_library()
+// Only a sample is stored: the library of all pairs (or of all single sets) follows from the positions.
 {
 	sub_library.clear();
-	vector<int> _notes;
-	if(object == BothChords)
+	if(object == BothChords && !test_all)
 	{
 		QStringList str = {"(Please wait...)", "（请稍候…）"};
-		prgdialog_sub -> setLabelText(str[language]);
-		prgdialog_sub -> setMaximum(4095);
-
-		if(test_all)
+		begin_progress(4095, false);
+		set_progress_text(str[language]);
+
+		vector<int> rec_id;
+		if(sample_size > 4095 * 4095)
+			sample_size = 4095 * 4095;
+		int quo = sample_size / ((1 << 12) - 1);
+		int rem = sample_size % ((1 << 12) - 1);
+		RandomEngine engine;
+		seed_random(engine, sub_seed);
+
+		for(int j = 1; j < (1 << 12); ++j)
 		{
-			for(int i = 1; i < (1 << 12); ++i)
+			if(canceled())  abort();
+			set_progress(j);
+
+			int size = (j <= rem) ? (quo + 1) : quo;
+			RandomEngine row_engine = split_random(engine, j);
+			// Each row has its own stream, so the sample does not depend on the order of rows.
+			sample_ids(row_engine, size, (1 << 12) - 1, rec_id);
+			for(int i = 0; i < size; ++i)
 			{
-				if(prgdialog_sub -> wasCanceled())  abort(true);
-				prgdialog_sub -> setValue(i);
-
-				for(int j = 1; j < (1 << 12); ++j)
-				{
-					id_to_notes(i, _notes);
-					sub_library.push_back(_notes);
-					id_to_notes(j, _notes);
-					sub_library.push_back(_notes);
-				}
+				sub_library.push_back(j);
+				sub_library.push_back(rec_id[i]);
 			}
 		}
-		else
-		{
-			vector<int> rec_id;
-			if(sample_size > 4095 * 4095)
-				sample_size = 4095 * 4095;
-			int quo = sample_size / ((1 << 12) - 1);
-			int rem = sample_size % ((1 << 12) - 1);
+	}
+}
 
-			for(int j = 1; j < (1 << 12); ++j)
-			{
-				if(prgdialog_sub -> wasCanceled())  abort(true);
-				prgdialog_sub -> setValue(j);
+int Chord::sub_id(const int& pos)
+// the id of set #'pos' of the library: in a BothChords search, sets #(2 * i) and #(2 * i + 1) are pair #i;
+// all pairs are in the order of the antechord, then the postchord.
+{
+	if(object != BothChords)  return pos + 1;
+	if(!test_all)  return sub_library[pos];
+	return (pos % 2 == 0) ? (pos / 2 / 4095 + 1) : (pos / 2 % 4095 + 1);
+}
 
-				int size = (j <= rem) ? (quo + 1) : quo;
-				rec_id.clear();
-				while((int)rec_id.size() < size)
-				{
-					int id = rand(1, (1 << 12) - 1);
-					int pos = find(rec_id, id);
-					if(pos != -1)
-						rec_id.insert( rec_id.begin() + pos, id );
-				}
-				for(int i = 0; i < size; ++i)
-				{
-					id_to_notes(j, _notes);
-					sub_library.push_back(_notes);
-					id_to_notes(rec_id[i], _notes);
-					sub_library.push_back(_notes);
-				}
-			}
-		}
-	}
-	else
+int Chord::sub_pair_count()
+// the number of pairs in a BothChords search; 'set_sub_library' takes a sample of this size
+{
+	if(test_all)  return 16769025;  // ( (1 << 12) - 1 ) ^ 2
+	if(sample_size > 4095 * 4095)  return 4095 * 4095;
+	return (sample_size > 0) ? sample_size : 0;
+}
+
+vector<subIndexEntry> Chord::sub_index[13];
+
+void Chord::set_sub_index()
+// The index only depends on the sets, so it is built once and shared by all jobs.
+{
+	static once_flag filled;
+	call_once(filled, []()
 	{
+		vector<int> _notes;
 		for(int id = 1; id < (1 << 12); ++id)
 		{
 			id_to_notes(id, _notes);
-			sub_library.push_back(_notes);
+			Chord chord(_notes, 0);
+			subIndexEntry entry = {chord.tension, chord.root, id};
+			vector<subIndexEntry>& group = sub_index[chord.s_size];
+			int pos = group.size();
+			while(pos > 0 && group[pos - 1].tension > entry.tension)
+				--pos;
+			group.insert(group.begin() + pos, entry);
+		}
+	});
+}
+
+void Chord::query_sub_index(vector<int>& result)
+// Returns (in ascending order) the ids of the sets passing the N, T and R conditions,
+// which are the conditions 'valid_sub' checks before 'find_vec'.
+{
+	set_sub_index();
+	const bool n_enabled = (strchr(sort_order_sub, var[1])  != nullptr);
+	const bool t_enabled = (strchr(sort_order_sub, var[2])  != nullptr);
+	const bool r_enabled = (strchr(sort_order_sub, var[14]) != nullptr);
+
+	result.clear();
+	for(int n = 1; n <= 12; ++n)
+	{
+		if(n_enabled && (n < n_min_sub || n > n_max_sub))
+			continue;
+		const vector<subIndexEntry>& group = sub_index[n];
+		int begin = 0, end = group.size();
+		if(t_enabled)
+		{
+			while(begin < end)
+			{
+				const int middle = (begin + end) / 2;
+				if(group[middle].tension < t_min_sub)
+					begin = middle + 1;
+				else  end = middle;
+			}
+			end = group.size();
+		}
+		for(int i = begin; i < end; ++i)
+		{
+			if(t_enabled && group[i].tension > t_max_sub)
+				break;
+			if(r_enabled && (group[i].root < r_min_sub || group[i].root > r_max_sub))
+				continue;
+			result.push_back(group[i].id);
 		}
 	}
+	merge_sort(result.begin(), result.end(), smaller);
+	// Results are kept in the order of 'sub_library', so that ties are sorted as before.
 }
 
 bool Chord::valid_sub(Chord& chord1, Chord& chord2)
@@ -347,20 +702,7 @@ bool Chord::valid_sub(Chord& chord1, Chord& chord2)
 // const char var[VAR_TOTAL] = {'P', 'N', 'T', 'K', 'C', 'a', 'A', 'm', 'h', 'g', 'S', 'Q', 'X', 'k', 'R', 'V'};
 // name of parameters (a = S, A = SS, S = sv, k = KK)
 {
-	if( (strchr(sort_order_sub, var[0]) != nullptr) &&
-		 (chord1.sim_orig < p_min_sub || chord1.sim_orig > p_max_sub) )
-	return false;
-
-	if( (strchr(sort_order_sub, var[1]) != nullptr) &&
-		 (chord1.s_size < n_min_sub || chord1.s_size > n_max_sub) )
-	return false;
-
-	if( (strchr(sort_order_sub, var[2]) != nullptr) &&
-		 (chord1.tension < t_min_sub || chord1.tension > t_max_sub) )
-	return false;
-
-	if( (strchr(sort_order_sub, var[14]) != nullptr) &&
-		 (chord1.root < r_min_sub || chord1.root > r_max_sub) )
+	if( !valid_sub_single(chord1) )
 	return false;
 
 	chord2.find_vec(chord1, false, true);
@@ -407,6 +749,28 @@ bool Chord::valid_sub(Chord& chord1, Chord& chord2)
 	return true;
 }
 
+bool Chord::valid_sub_single(Chord& chord)
+// the conditions of 'valid_sub' on 'chord' alone, i.e. those checked before 'find_vec'
+{
+	if( (strchr(sort_order_sub, var[0]) != nullptr) &&
+		 (chord.sim_orig < p_min_sub || chord.sim_orig > p_max_sub) )
+	return false;
+
+	if( (strchr(sort_order_sub, var[1]) != nullptr) &&
+		 (chord.s_size < n_min_sub || chord.s_size > n_max_sub) )
+	return false;
+
+	if( (strchr(sort_order_sub, var[2]) != nullptr) &&
+		 (chord.tension < t_min_sub || chord.tension > t_max_sub) )
+	return false;
+
+	if( (strchr(sort_order_sub, var[14]) != nullptr) &&
+		 (chord.root < r_min_sub || chord.root > r_max_sub) )
+	return false;
+
+	return true;
+}
+
 bool Chord::valid_single_chord(Chord& chord)
 {
 	if( (strchr(sort_order_sub, var[0]) != nullptr) &&
@@ -432,6 +796,242 @@ bool Chord::valid_single_chord(Chord& chord)
 	return true;
 }
 
+bool Chord::test_sub_pair(const int& i, Chord& antechord, Chord& postchord)
+// Tests the 'i'th pair of 'sub_library' in a BothChords search; if it is valid, it is added to the results.
+{
+	vector<int> _notes;
+	id_to_notes(sub_id(2 * i), _notes);
+	Chord chord1(_notes, 0);
+	id_to_notes(sub_id(2 * i + 1), _notes);
+	Chord chord2(_notes, chord1.chroma_old);
+	antechord.find_vec(chord1, false, true);
+	postchord.find_vec(chord2, false, true);
+	chord1.sim_orig = set_similarity(antechord, chord1, true);
+	chord2.sim_orig = set_similarity(postchord, chord2, true);
+	if( !(valid_sub(chord2, chord1) && valid_single_chord(chord1)) )
+		return false;
+
+	chord2.orig_pos = record_post.size();
+	record_ante.push_back( static_cast<ChordData>(chord1) );
+	record_post.push_back( static_cast<ChordData>(chord2) );
+	update_top_sub(record_post.back());
+	return true;
+}
+
+void Chord::set_checkpoint_name(char* name)
+{
+	strcpy(name, output_path);
+	strcat(name, ((QString)output_name_sub).toLocal8Bit().data());
+	strcat(name, ".chk");
+}
+
+void Chord::set_sub_fingerprint(vector<double>& fp)
+// Everything that a BothChords search depends on, except 'sub_seed' which is saved on its own.
+// A checkpoint is only resumed if its fingerprint is the same as the current one.
+{
+	double *bound_ptr[24] = {&p_min_sub,  &p_max_sub,  &n_min_sub,  &n_max_sub,  &t_min_sub,  &t_max_sub,
+									 &k_min_sub,  &k_max_sub,  &c_min_sub,  &c_max_sub,  &s_min_sub,  &s_max_sub,
+									 &ss_min_sub, &ss_max_sub, &sv_min_sub, &sv_max_sub, &q_min_sub,  &q_max_sub,
+									 &x_min_sub,  &x_max_sub,  &kk_min_sub, &kk_max_sub, &r_min_sub,  &r_max_sub};
+	fp.clear();
+	fp.push_back(notes_to_id(reduced_ante_notes));
+	fp.push_back(notes_to_id(reduced_post_notes));
+	fp.push_back(test_all);
+	fp.push_back(sample_size);
+	for(int i = 0; sort_order_sub[i] != '\0'; ++i)
+		fp.push_back(sort_order_sub[i]);
+	for(int i = 0; i < 24; ++i)
+		fp.push_back(*bound_ptr[i]);
+	fp.push_back(enable_rm);
+	for(int i = 0; i < (int)rm_priority.size(); ++i)
+		fp.push_back(rm_priority[i]);
+}
+
+void Chord::save_checkpoint_sub(const int& cursor, const vector<int>& accepted)
+// The checkpoint is written to a temporary file first and replaces the previous one in one step,
+// so that a crash while writing does not destroy it. Throws if the checkpoint cannot be written.
+{
+	char name[200], temp_name[200];
+	set_checkpoint_name(name);
+	strcpy(temp_name, name);
+	strcat(temp_name, ".tmp");
+
+	vector<double> fp;
+	set_sub_fingerprint(fp);
+	const int fp_size = fp.size();
+	const int acc_size = accepted.size();
+	ofstream file(temp_name, ios::trunc | ios::binary);
+	file.write(CHECKPOINT_MAGIC, 4);
+	file.write((char*)&fp_size, sizeof(int));
+	file.write((char*)fp.data(), fp_size * sizeof(double));
+	file.write((char*)&sub_seed, sizeof(sub_seed));
+	file.write((char*)&cursor, sizeof(int));
+	file.write((char*)&acc_size, sizeof(int));
+	if(acc_size > 0)
+		file.write((char*)accepted.data(), acc_size * sizeof(int));
+	file.close();
+	if(!file || !replace_file(temp_name, name))
+	{
+		remove(temp_name);
+		if(language == English)
+			throw "ERROR - failed to write to the output folder. Please check the output path.";
+		else  throw "错误：无法写入输出文件夹。请检查输出路径。";
+	}
+}
+
+bool Chord::load_checkpoint_sub(int& cursor, vector<int>& accepted)
+// Returns false if there is no checkpoint, or it belongs to a search with different settings,
+// or its positions are not those of pairs tested before its cursor (e.g. a damaged file).
+// Otherwise 'sub_seed', 'cursor' and 'accepted' are restored.
+{
+	char name[200];
+	set_checkpoint_name(name);
+	ifstream file(name, ios::binary);
+	if(!file.is_open())  return false;
+
+	char magic[4];
+	int fp_size, acc_size;
+	vector<double> fp, cur_fp;
+	set_sub_fingerprint(cur_fp);
+	file.read(magic, 4);
+	file.read((char*)&fp_size, sizeof(int));
+	if(!file || strncmp(magic, CHECKPOINT_MAGIC, 4) != 0 || fp_size != (int)cur_fp.size())
+		return false;
+	fp.resize(fp_size);
+	file.read((char*)fp.data(), fp_size * sizeof(double));
+	if(!file || fp != cur_fp)
+		return false;
+
+	unsigned long long seed;
+	file.read((char*)&seed, sizeof(seed));
+	file.read((char*)&cursor, sizeof(int));
+	file.read((char*)&acc_size, sizeof(int));
+	if(!file || cursor < 0 || cursor > sub_pair_count() || acc_size < 0 || acc_size > cursor)
+		return false;
+	accepted.resize(acc_size);
+	if(acc_size > 0)
+		file.read((char*)accepted.data(), acc_size * sizeof(int));
+	if(!file)
+		return false;
+	for(int i = 0; i < acc_size; ++i)
+		if(accepted[i] < 0 || accepted[i] >= cursor)
+			return false;
+	sub_seed = seed;
+	return true;
+}
+
+void Chord::write_sub_shard(const int& first, const int& last, const vector<int>& accepted)
+// The partial file of a shard holds its range of pairs and the positions of the pairs found,
+// like a checkpoint (see 'save_checkpoint_sub'). It is renamed from a temporary file once complete,
+// so that a merge never reads a part still being written.
+{
+	char name[300], temp_name[310];
+	string buffer;
+	vector<double> fp;
+	set_sub_fingerprint(fp);
+	write_shard_head(buffer, fp, shard_index);
+	const int acc_size = accepted.size();
+	buffer.append((const char*)&sub_seed, sizeof(sub_seed));
+	buffer.append((const char*)&first, sizeof(int));
+	buffer.append((const char*)&last, sizeof(int));
+	buffer.append((const char*)&acc_size, sizeof(int));
+	buffer.append((const char*)accepted.data(), acc_size * sizeof(int));
+
+	set_shard_name(name, output_name_sub, shard_index);
+	snprintf(temp_name, sizeof(temp_name), "%s.tmp", name);
+	ofstream file(temp_name, ios::trunc | ios::binary);
+	file.write(buffer.data(), buffer.size());
+	file.close();
+	if(!file || !replace_file(temp_name, name))
+	{
+		remove(temp_name);
+		if(language == English)
+			throw "ERROR - failed to write to the output folder. Please check the output path.";
+		else  throw "错误：无法写入输出文件夹。请检查输出路径。";
+	}
+}
+
+void Chord::read_sub_shards(int& cursor, vector<int>& accepted)
+// Collects the pairs found by all shards. The ranges of the shards must follow each other from the
+// first pair on, within the pairs of the search, and hold the positions they found; 'cursor' is set
+// to the end of the last one.
+{
+	char name[300];
+	MappedFile file;
+	vector<double> fp;
+	set_sub_fingerprint(fp);
+	cursor = 0;
+	accepted.clear();
+	for(int index = 1; index <= shard_count; ++index)
+	{
+		const char* pos;
+		unsigned long long seed;
+		int first, last, acc_size;
+		set_shard_name(name, output_name_sub, index);
+		bool valid = map_file(name, file) && read_shard_head(pos, file, fp, index)
+					 && file.data + file.size - pos >= (long long)(sizeof(seed) + 3 * sizeof(int));
+		if(valid)
+		{
+			memcpy(&seed, pos, sizeof(seed));
+			memcpy(&first, pos + sizeof(seed), sizeof(int));
+			memcpy(&last, pos + sizeof(seed) + sizeof(int), sizeof(int));
+			memcpy(&acc_size, pos + sizeof(seed) + 2 * sizeof(int), sizeof(int));
+			pos += sizeof(seed) + 3 * sizeof(int);
+			valid = (seed == sub_seed && first == cursor && last >= first && last <= sub_pair_count()
+						&& acc_size >= 0 && file.data + file.size - pos == (long long)acc_size * (long long)sizeof(int));
+		}
+		const int old_size = accepted.size();
+		if(valid)
+		{
+			accepted.resize(old_size + acc_size);
+			memcpy(accepted.data() + old_size, pos, acc_size * sizeof(int));
+			for(int i = old_size; i < (int)accepted.size() && valid; ++i)
+				valid = (accepted[i] >= first && accepted[i] < last);
+		}
+		if(!valid)
+		{
+			unmap_file(file);
+			shard_error();
+		}
+		cursor = last;
+		unmap_file(file);
+	}
+}
+
+bool Chord::better_sub(const ChordData& chord1, const ChordData& chord2)
+// Returns true if 'chord1' comes before 'chord2' in the order of 'sort_order_sub',
+// i.e. the order 'sort_results' gives; ties return false so that earlier results stay first.
+{
+	for(int pos = 0; sort_order_sub[pos] != '\0'; ++pos)
+	{
+		char ch = sort_order_sub[pos];
+		bool ascending = (sort_order_sub[pos + 1] == '+');
+		if(ascending)  ++pos;
+		for(int i = 0; i < VAR_TOTAL; ++i)
+		{
+			if(ch == var[i])
+			{
+				// The compare functions are non-strict ('>=' or '<='), as the stable 'merge_sort' requires.
+				if( !compare[i][ascending](chord2, chord1) )  return true;
+				if( !compare[i][ascending](chord1, chord2) )  return false;
+			}
+		}
+	}
+	return false;
+}
+
+void Chord::update_top_sub(const ChordData& chord)
+// Inserts 'chord' into 'top_sub' if it is among the best 'TOP_SUB_SIZE' results so far.
+{
+	int pos = top_sub.size();
+	while(pos > 0 && better_sub(chord, top_sub[pos - 1]))
+		--pos;
+	if(pos >= TOP_SUB_SIZE)  return;
+	top_sub.insert(top_sub.begin() + pos, chord);
+	if((int)top_sub.size() > TOP_SUB_SIZE)
+		top_sub.pop_back();
+}
+
 void Chord::print_sub()
 {
 	Chord antechord(reduced_ante_notes, 0);
@@ -439,6 +1039,7 @@ void Chord::print_sub()
 	antechord.find_vec(postchord, false, true);
 	fout << ((language == English) ? "Original: " : "原进行：");
 	print_substitution(sort_order_sub, true, true, antechord, postchord, language);
+	tflush();
 
 	fout << ((language == English) ? "Substitute: " : "替代：");
 	switch(object)
@@ -446,40 +1047,15 @@ void Chord::print_sub()
 		case Postchord:  fout << ((language == English) ? "Postchord\n"  : "后和弦\n");  break;
 		case Antechord:  fout << ((language == English) ? "Antechord\n"  : "前和弦\n");  break;
 		case BothChords: fout << ((language == English) ? "BothChords\n" : "两者\n");    break;
+		case Sequence:   fout << ((language == English) ? "Sequence\n"   : "序列\n");    break;
 	}
 
-	int *pReset[VAR_TOTAL]  = {&p_reset_value, &n_reset_value,  &t_reset_value,  &k_reset_value,
-										&c_reset_value, &s_reset_value,  &ss_reset_value,  nullptr,
-										 nullptr,        nullptr,        &sv_reset_value, &q_reset_value,
-										&x_reset_value, &kk_reset_value, &r_reset_value,   nullptr};
-	int *pRadius[VAR_TOTAL] = {&p_radius, &n_radius,  &t_radius,  &k_radius,
-										&c_radius, &s_radius,  &ss_radius, nullptr,
-										nullptr,   nullptr,   &sv_radius,  &q_radius,
-										&x_radius, &kk_radius, &r_radius,  nullptr};
-	const char _var[VAR_TOTAL][3] = {"P", "N", "T", "K", "C", "S", "SS", "M", "H", "G", "sv", "Q", "X", "KK", "R", "V"};
-	int count = 0;
-
-	fout << ((language == English) ? "Conditions: " : "条件：");
-	for(int i = 0; i < VAR_TOTAL; ++i)
-	{
-		if(strchr(sort_order_sub, var[i]) != nullptr)
-		{
-			if(count != 0)  fout << ",  ";
-			fout << _var[i];
-			if(i != 15)  // V
-			{
-				if(strchr(reset_list, var[i]) != nullptr)
-					fout << " = " << *pReset[i];
-				else  fout << " = val";
-				fout << "±" << *pRadius[i];
-				if(strchr(percentage_list, var[i]) != nullptr)
-					fout << "%";
-			}
-			++count;
-		}
-	}
+	print_sub_conditions();
 
 	fout << ((language == English) ? "\n\nSubstitutions:\n" : "\n\n替代结果：\n");
+	if(sub_canceled)
+		fout << ((language == English) ? "(The search was stopped early. Only the results found so far are listed.)\n"
+												 : "（搜索已提前停止，仅列出已找到的结果。）\n");
 	if(sub_size == 0)
 		fout << ((language == English) ? "\n\nNo substitutions found in this condition.\n" : "在该条件下未找到结果。\n");
 	if(object == Postchord)
@@ -500,6 +1076,7 @@ void Chord::print_sub()
 			print_substitution(sort_order_sub, true, true, record_ante[j], record_post[i], language);
 		}
 	}
+	tflush();
 
 	if(language == Chinese)
 	{
@@ -520,6 +1097,40 @@ void Chord::print_sub()
 	fout.close();
 }
 
+void Chord::print_sub_conditions()
+{
+	int *pReset[VAR_TOTAL]  = {&p_reset_value, &n_reset_value,  &t_reset_value,  &k_reset_value,
+										&c_reset_value, &s_reset_value,  &ss_reset_value,  nullptr,
+										 nullptr,        nullptr,        &sv_reset_value, &q_reset_value,
+										&x_reset_value, &kk_reset_value, &r_reset_value,   nullptr};
+	int *pRadius[VAR_TOTAL] = {&p_radius, &n_radius,  &t_radius,  &k_radius,
+										&c_radius, &s_radius,  &ss_radius, nullptr,
+										nullptr,   nullptr,   &sv_radius,  &q_radius,
+										&x_radius, &kk_radius, &r_radius,  nullptr};
+	const char _var[VAR_TOTAL][3] = {"P", "N", "T", "K", "C", "S", "SS", "M", "H", "G", "sv", "Q", "X", "KK", "R", "V"};
+	int count = 0;
+
+	fout << ((language == English) ? "Conditions: " : "条件：");
+	for(int i = 0; i < VAR_TOTAL; ++i)
+	{
+		if(strchr(sort_order_sub, var[i]) != nullptr)
+		{
+			if(count != 0)  fout << ",  ";
+			fout << _var[i];
+			if(i != 15)  // V
+			{
+				if(strchr(reset_list, var[i]) != nullptr)
+					fout << " = " << *pReset[i];
+				else  fout << " = val";
+				fout << "±" << *pRadius[i];
+				if(strchr(percentage_list, var[i]) != nullptr)
+					fout << "%";
+			}
+			++count;
+		}
+	}
+}
+
 void Chord::print_stats_sub()
 {
 	if(sub_size == 0)
@@ -560,7 +1171,8 @@ void Chord::print_stats_sub()
 		{
 			case Postchord:  ptr_ = &antechord;  break;
 			case Antechord:  ptr_ = &postchord;  break;
-			case BothChords: ptr_ = &(record_post[i]);  break;
+			case BothChords:
+			case Sequence:   ptr_ = &(record_post[i]);  break;
 		}
 		if( (*ptr)[i].get_s_size() != ptr_ -> get_s_size())
 			++cardinal_change;
@@ -625,7 +1237,8 @@ void Chord::print_stats_sub()
 		{
 			case Postchord:  ptr_ = &antechord;  break;
 			case Antechord:  ptr_ = &postchord;  break;
-			case BothChords: ptr_ = &(record_post[i]);  break;
+			case BothChords:
+			case Sequence:   ptr_ = &(record_post[i]);  break;
 		}
 
 		temp2 = abs((*ptr)[i].get_chroma());
@@ -837,18 +1450,7 @@ void Chord::to_midi_sub()
 {
 	Chord antechord(reduced_ante_notes, 0);
 	Chord postchord(reduced_post_notes, antechord.get_chroma_old());
-	int note_count = reduced_ante_notes.size() + reduced_post_notes.size();
-	for(int i = 0; i < sub_size; ++i)
-	{
-		switch(object)
-		{
-			case Postchord:  note_count += (antechord.s_size + record_post[i].get_s_size());  break;
-			case Antechord:  note_count += (record_ante[i].get_s_size() + postchord.s_size);  break;
-			case BothChords: note_count += (record_ante[i].get_s_size() + record_post[i].get_s_size());  break;
-		}
-	}
-
-	midi_head(2 * sub_size + 2, note_count);
+	midi_head();
 	chord_to_midi(antechord.notes);
 	chord_to_midi(postchord.notes);
 	for(int i = 0; i < sub_size; ++i)
@@ -858,6 +1460,7 @@ void Chord::to_midi_sub()
 			case Postchord:  chord_to_midi(antechord.notes);  chord_to_midi(record_post[i].get_notes());  break;
 			case Antechord:  chord_to_midi(record_ante[i].get_notes());  chord_to_midi(postchord.notes);  break;
 			case BothChords:
+			case Sequence:
 			{
 				int j = record_post[i].orig_pos;
 				chord_to_midi(record_ante[j].get_notes());
@@ -866,6 +1469,5 @@ void Chord::to_midi_sub()
 			}
 		}
 	}
-	m_fout.write("\x00\xFF\x2F\x00", 4);
-	m_fout.close();
+	midi_flush();
 }
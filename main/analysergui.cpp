@@ -12,8 +12,8 @@ void Interface::analyserGui()
 	analyser_window -> setWindowFlag(Qt::Window, true);
 	analyser_window -> setWindowFlag(Qt::WindowMinMaxButtonsHint, false);
 	if(language == Chinese)
-		analyser_window -> setFixedSize(385 * hscale, 550 * vscale);
-	else  analyser_window -> setFixedSize(440 * hscale, 585 * vscale);
+		analyser_window -> setFixedSize(385 * hscale, 585 * vscale);
+	else  analyser_window -> setFixedSize(440 * hscale, 620 * vscale);
 	QStringList str1 = {"Chord analysis/substitution", "和弦进行速查/替代"};
 	analyser_window -> setWindowTitle(str1[language]);
 	analyser_window -> setFont(font);
@@ -54,6 +54,15 @@ void Interface::analyserGui()
 	btn2 -> setFixedHeight(50 * vscale);
 	connect(btn2, &QPushButton::clicked, this, &Interface::swap_chords);
 	grid1 -> addWidget(btn2, 1, 2, 2, 1);
+
+	QStringList str26 = {"Progression: ", "和弦序列："};
+	QLabel* label10 = new QLabel(str26[language], analyser_window);
+	grid1 -> addWidget(label10, 3, 0);
+	edit_seq = new QLineEdit(analyser_window);
+	QStringList str27 = {"for sequence substitution; separate chords with '/'", "用于序列替代；和弦之间以“/”分隔"};
+	edit_seq -> setPlaceholderText(str27[language]);
+	connect(edit_seq, &QLineEdit::editingFinished, this, &Interface::set_sequence);
+	grid1 -> addWidget(edit_seq, 3, 1, 1, 2);
 	vbox -> addLayout(grid1);
 
 	QHBoxLayout* hbox1 = new QHBoxLayout();
@@ -96,22 +105,27 @@ void Interface::analyserGui()
 	QStringList str11 = {"Postchord", "后和弦"};
 	QStringList str12 = {"Antechord", "前和弦"};
 	QStringList str13 = {"Both", "两者"};
+	QStringList str28 = {"Sequence", "序列"};
 	btn_post = new QRadioButton(str11[language], analyser_window);
 	btn_ante = new QRadioButton(str12[language], analyser_window);
 	btn_both = new QRadioButton(str13[language], analyser_window);
+	btn_seq  = new QRadioButton(str28[language], analyser_window);
 
 	QButtonGroup* btns1 = new QButtonGroup(analyser_window);
 	btns1 -> addButton(btn_post);
 	btns1 -> addButton(btn_ante);
 	btns1 -> addButton(btn_both);
+	btns1 -> addButton(btn_seq);
 	connect(btn_post, SIGNAL(toggled(bool)), this, SLOT(set_substitute_obj(bool)));
 	connect(btn_ante, SIGNAL(toggled(bool)), this, SLOT(set_substitute_obj(bool)));
 	connect(btn_both, SIGNAL(toggled(bool)), this, SLOT(set_substitute_obj(bool)));
+	connect(btn_seq,  SIGNAL(toggled(bool)), this, SLOT(set_substitute_obj(bool)));
 
 	QHBoxLayout* hbox2 = new QHBoxLayout();
 	hbox2 -> addWidget(btn_post);
 	hbox2 -> addWidget(btn_ante, 1, Qt::AlignCenter);
-	hbox2 -> addWidget(btn_both, 0, Qt::AlignRight);
+	hbox2 -> addWidget(btn_both, 1, Qt::AlignCenter);
+	hbox2 -> addWidget(btn_seq,  0, Qt::AlignRight);
 	grid2 -> addLayout(hbox2, 0, 1, 1, 2);
 
 	QStringList str0 = {"Performance option: ", "性能时间选项："};
@@ -243,8 +257,10 @@ void Interface::initAnalyser()
 	QString str;
 	edit_ante -> setText(str_ante_notes);
 	edit_post -> setText(str_post_notes);
+	edit_seq  -> setText(str_seq_notes);
 	set_antechord();
 	set_postchord();
+	set_sequence();
 	if(hide_octave)
 		cb_hide_octave -> setChecked(true);
 
@@ -253,6 +269,7 @@ void Interface::initAnalyser()
 		case Postchord:  btn_post -> setChecked(true);  break;
 		case Antechord:  btn_ante -> setChecked(true);  break;
 		case BothChords: btn_both -> setChecked(true);	break;
+		case Sequence:   btn_seq  -> setChecked(true);  break;
 	}
 	set_substitute_obj(0);
 	if(test_all)
@@ -331,6 +348,16 @@ void Interface::set_postchord()
 	set_notes(post_notes, edit_post);
 }
 
+void Interface::set_sequence()
+{
+	strcpy(str_seq_notes, edit_seq -> text().left(299).toLatin1().data());
+	if(!parse_sequence(str_seq_notes))
+	{
+		edit_seq -> clear();
+		strcpy(str_seq_notes, "");
+	}
+}
+
 void Interface::swap_chords()
 {
 	QString temp = edit_ante -> text();
@@ -379,6 +406,14 @@ void Interface::set_substitute_obj(bool b)
 		btn_test_part -> setDisabled(true);
 		label_sample_size -> setDisabled(true);
 	}
+	else if(btn_seq -> isChecked())
+	{
+		object = Sequence;
+		edit_sample_size -> setDisabled(true);
+		btn_test_all -> setDisabled(true);
+		btn_test_part -> setDisabled(true);
+		label_sample_size -> setDisabled(true);
+	}
 	else
 	{
 		object = BothChords;
@@ -467,13 +502,31 @@ void Interface::run_sub()
 {
 	QStringList str1 = {"Warning", "警告"};
 	QStringList str2 = {"Please calculate stats first.", "请先测和弦指标。"};
-	if(edit_stats -> toPlainText().isEmpty())
+	if(object != Sequence && edit_stats -> toPlainText().isEmpty())
 	{
 		QMessageBox::warning(this, str1[language], str2[language], QMessageBox::Close);
 		return;
 	}
 
+	resume_sub = false;
 	if(object == BothChords)
+	{
+		char name[200];
+		set_checkpoint_name(name);
+		ifstream checkpoint(name, ios::binary);
+		if(checkpoint.is_open())
+		{
+			checkpoint.close();
+			QStringList str_msg1 = {"Message", "消息"};
+			QStringList str_msg2 = {"An unfinished search with this output name was found. Resume it?\n"
+									  "(It is only resumed if the settings have not been changed.)",
+									  "找到使用该输出文件名的未完成搜索。是否继续？\n（仅当设置未更改时才会继续。）"};
+			if(QMessageBox::question(this, str_msg1[language], str_msg2[language]) == QMessageBox::Yes)
+				resume_sub = true;
+		}
+	}
+
+	if(object == BothChords || object == Sequence)
 	{
 		QStringList str3 = {"Generating...", "生成中…"};
 		QStringList str4 = {"Abort", "中止"};
@@ -483,12 +536,13 @@ void Interface::run_sub()
 		prgdialog_sub -> setWindowFlag(Qt::WindowMinMaxButtonsHint, false);
 		prgdialog_sub -> setWindowFlag(Qt::WindowCloseButtonHint, false);
 		prgdialog_sub -> setWindowFlag(Qt::WindowContextHelpButtonHint, false);
-		prgdialog_sub -> setWindowModality(Qt::WindowModal);
+		prgdialog_sub -> setWindowModality(Qt::ApplicationModal);
 		prgdialog_sub -> setAutoClose(false);
 		prgdialog_sub -> setAutoReset(false);
 		prgdialog_sub -> setMinimumDuration(0);
 	}
 
+	sub_seed = next_random(job_random);
 	vector<int> temp(rm_priority);
 	rm_priority.assign(7, -1);
 	for(int i = 0; i < (int)temp.size(); ++i)
@@ -497,33 +551,44 @@ void Interface::run_sub()
 	// The value of 'rm_priority[i]', if not equal to -1, is the order of interval i,
 	// otherwise the interval is not allowed.
 
-	try{ substitute(); }
+	const bool show_dialog = (object == BothChords || object == Sequence);
+	try
+	{
+		run_job(show_dialog ? prgdialog_sub : nullptr, [this]
+		{
+			if(object == Sequence)
+				substitute_sequence();
+			else  substitute();
+		});
+	}
 	catch(const char* msg)
 	{
-		if(object == BothChords)
+		if(show_dialog)
 			prgdialog_sub -> close();
 		QMessageBox::warning(this, str1[language], msg, QMessageBox::Close);
-		if(fout.is_open())  fout.close();
-		if(m_fout.is_open())  m_fout.close();
 		return;
 	}
 	catch(...)
 	{
-		if(object == BothChords)
+		if(show_dialog)
 			prgdialog_sub -> close();
 		QStringList str5 = {"Critical error", "严重错误"};
 		QStringList str6 = {"Unknown error", "未知错误"};
 		QMessageBox::critical(this, str5[language], str6[language], QMessageBox::Close);
-		if(fout.is_open())  fout.close();
-		if(m_fout.is_open())  m_fout.close();
 		return;
 	}
+	if(show_dialog)
+		prgdialog_sub -> close();
 
 	QStringList str7  = {"Message", "消息"};
 	QStringList str8  = {"Generation completed. Open generated file(s)?", "生成完毕。打开生成的文件？"};
 	QStringList str9  = {"Yes", "是"};
 	QStringList str10 = {"No",  "否"};
-	QMessageBox* completed = new QMessageBox(QMessageBox::Information, str7[language], str8[language]);
+	QStringList str11 = {"The search was stopped. The results found so far have been written, "
+								"and the search can be resumed next time. Open generated file(s)?",
+								"搜索已停止。已写入目前找到的结果，下次可继续搜索。打开生成的文件？"};
+	QMessageBox* completed = new QMessageBox(QMessageBox::Information, str7[language],
+														  (object == BothChords && sub_canceled) ? str11[language] : str8[language]);
 	QPushButton* open = (completed -> addButton(str9[language], QMessageBox::AcceptRole));
 	completed -> addButton(str10[language], QMessageBox::RejectRole);
 	completed -> exec();
@@ -0,0 +1,704 @@
+// ChordNova v3.0 [Build: 2021.1.14]
+// (c) 2020 Wenge Chen, Ji-woon Sim.
+// batch.cpp
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "batch.h"
+#include "chord.h"
+#include "functions.h"
+using namespace std;
+
+struct SharedAlignment
+{
+	vector<vector<int>> list;
+	VoicingSet keys;
+};
+
+// Databases parsed by earlier jobs of the batch. A job copies them into its own (thread-local) state.
+// Loading is serialized, as jobs may write the same compiled database (see 'write_compiled_db').
+static mutex cache_lock;
+static map<string, vector<int>> library_cache;  // by database file and omissions
+static map<string, SharedAlignment> alignment_cache;
+
+// The output path and name together, so that the name of every output file (e.g. '<name>.chk.tmp')
+// fits into the 200 characters of 'Chord::Main' and of the substitution.
+const int MAX_OUTPUT_FILENAME = 190;
+
+static string trim(const string& str)
+{
+	int pos1 = 0, pos2 = str.size();
+	while(pos1 < pos2 && (str[pos1] == ' ' || str[pos1] == '\t'))
+		++pos1;
+	while(pos2 > pos1 && (str[pos2 - 1] == ' ' || str[pos2 - 1] == '\t' || str[pos2 - 1] == '\r'))
+		--pos2;
+	return str.substr(pos1, pos2 - pos1);
+}
+
+static void load_library(const string& filename)
+// Loads a chord database into 'chord_library', parsing it only once for each omission setting.
+{
+	string key = filename;
+	for(int i = 3; i <= 7; ++i)
+	{
+		key += '|';
+		for(int j = 0; j < (int)omission[i].size(); ++j)
+			key += to_string(omission[i][j]) + ' ';
+	}
+	lock_guard<mutex> guard(cache_lock);
+	map<string, vector<int>>::iterator it = library_cache.find(key);
+	if(it == library_cache.end())
+	{
+		dbentry(filename.c_str());
+		library_cache[key] = chord_library;
+	}
+	else  chord_library = it -> second;
+}
+
+static void load_alignment(const string& filename)
+{
+	lock_guard<mutex> guard(cache_lock);
+	map<string, SharedAlignment>::iterator it = alignment_cache.find(filename);
+	if(it == alignment_cache.end())
+	{
+		read_alignment(filename.c_str());
+		SharedAlignment& entry = alignment_cache[filename];
+		entry.list = alignment_list;
+		entry.keys = alignment_keys;
+	}
+	else
+	{
+		alignment_list = it -> second.list;
+		alignment_keys = it -> second.keys;
+	}
+}
+
+static const char path_error[] = "ERROR - failed to write to the output folder. Please check the output path.";
+
+static bool writable(const string& path)
+// The engine does not report output files that cannot be opened, so the output folder is tested first.
+{
+	string name = path + "chordnova-batch.tmp";
+	ofstream test(name, ios::trunc);
+	if(!test.is_open())  return false;
+	test.close();
+	remove(name.c_str());
+	return true;
+}
+
+class BatchRunner: public Chord
+{
+public:
+#ifdef QT_CORE_LIB
+	JobProgress job_progress;  // not shown; the engine only needs somewhere to report to
+	BatchRunner()  { progress = &job_progress; }
+#endif
+	void run(const BatchSettings&, BatchJob&, const int& number);
+	void check(const BatchJob&);
+	void preload(const BatchSettings&, const string& preset);
+#ifdef QT_CORE_LIB
+	using Chord::set_sub_index;
+#endif
+
+private:
+	string error;  // composed messages are thrown from here
+	void copy_field(char* field, const int& size, const string& value, const char* name);
+	void check_preset();
+	void read_job(const BatchJob&);
+	void run_generation(const BatchSettings&, BatchJob&, const int& number);
+	void run_substitution(BatchJob&, const int& number);
+	void run_analysis(BatchJob&);
+};
+
+void BatchRunner::run(const BatchSettings& settings, BatchJob& job, const int& number)
+// Runs a job on this thread, as 'Interface::run' and 'Interface::run_sub' do in the main program.
+// Unless the job has an output name, 'number' (if not 0) is appended to the one of the preset,
+// except for the parts of a sharded run, which must have the same name to be merged.
+{
+	double begin_time = now_seconds();
+	language = English;
+	quiet = true;
+	reset_metrics();
+	if(!job.analysis.empty())
+	{
+		try
+		{
+			run_analysis(job);
+			job.done = true;
+		}
+		catch(const char* msg)  { job.message = msg; }
+		job.seconds = now_seconds() - begin_time;
+		return;
+	}
+	try
+	{
+		read_job(job);
+		copy_field(output_path, sizeof(output_path), settings.output_path, "output path");
+		export_format = NoExport;
+		if(job.memory_budget < 0 || job.memory_budget > MAX_MEMORY_BUDGET)
+			throw "ERROR - the memory budget is not valid.";
+		memory_budget = (job.memory_budget > 0) ? job.memory_budget : DEFAULT_MEMORY_BUDGET;
+		metrics_file = job.metrics;
+		seed_random(job_random, job.seed);
+		if(job.shards > 1)
+		{
+			if(!job.merge && (job.shard < 1 || job.shard > job.shards))
+			{
+				if(language == English)
+					throw "ERROR - the shard is not valid.";
+				else  throw "错误：分片无效。";
+			}
+			shard_mode = job.merge ? MergeShards : WriteShard;
+			shard_index = job.shard;
+			shard_count = job.shards;
+		}
+
+		vector<int> temp(rm_priority);
+		rm_priority.assign(7, -1);
+		for(int i = 0; i < (int)temp.size(); ++i)
+			rm_priority[temp[i]] = i;
+		try
+		{
+			if(job.substitution)
+				run_substitution(job, number);
+			else  run_generation(settings, job, number);
+		}
+		catch(...)
+		{
+			rm_priority.assign(temp.begin(), temp.end());
+			throw;
+		}
+		rm_priority.assign(temp.begin(), temp.end());
+		job.done = true;
+	}
+	catch(const char* msg)  { job.message = msg; }
+	catch(int num)
+	{
+		if(language == English)
+			job.message = "Generation stopped at progression #" + to_string(num) + ".";
+		else  job.message = "生成停止于进行#" + to_string(num) + "。";
+	}
+	catch(...)  { job.message = (language == English) ? "Unknown error" : "未知错误"; }
+	close_files();
+	job.candidates = stage_stats[StageEnumeration].in;
+	job.seconds = now_seconds() - begin_time;
+}
+
+void BatchRunner::check(const BatchJob& job)
+// Reads the job as 'run' does, without running it, so that a job that cannot run is refused early.
+{
+	language = English;
+	quiet = true;
+	read_job(job);
+}
+
+void BatchRunner::read_job(const BatchJob& job)
+// Reads the chords of an analysis, or the preset of any other job with the settings it replaces,
+// and checks them (see 'check_preset').
+{
+	if(!job.analysis.empty())
+	{
+		const size_t slash = job.analysis.find('/');
+		if(slash != string::npos)
+		{
+			copy_field(str_ante_notes, sizeof(str_ante_notes), trim(job.analysis.substr(0, slash)), "antechord");
+			copy_field(str_post_notes, sizeof(str_post_notes), trim(job.analysis.substr(slash + 1)), "postchord");
+		}
+		if(slash == string::npos || !parse_chord(str_ante_notes, ante_notes) || !parse_chord(str_post_notes, post_notes)
+			|| ante_notes.empty() || post_notes.empty())
+			throw "ERROR - the antechord or the postchord is not valid.";
+		return;
+	}
+	ifstream fin(job.preset);
+	if(!fin.is_open())
+		throw "ERROR - failed to open the preset.";
+	stringstream text;
+	text << fin.rdbuf();
+	fin.close();
+	string preset = text.str();
+	for(int i = 0; i < (int)job.overrides.size(); ++i)
+		if(!override_preset(preset, job.overrides[i].first, job.overrides[i].second))
+		{
+			error = "ERROR - the preset has no setting '" + job.overrides[i].first + "'.";
+			throw error.c_str();
+		}
+
+	char title[2][100];
+	bool scale_set;
+	stringstream preset_stream(preset);
+	read_preset(preset_stream, title, scale_set);
+	if(!enable_rm)  rm_priority.clear();  // as on a new thread, whatever the jobs before
+	check_preset();
+}
+
+void BatchRunner::copy_field(char* field, const int& size, const string& value, const char* name)
+// copies a value of the job or the settings into a field of 'Chord' holding 'size' - 1 characters,
+// or fails the job if the value is longer
+{
+	if((int)value.size() >= size)
+	{
+		error = string("ERROR - the ") + name + " is too long (at most " + to_string(size - 1) + " characters).";
+		throw error.c_str();
+	}
+	strcpy(field, value.c_str());
+}
+
+static bool in_range(const vector<int>& v, const int& min, const int& max, const bool& odd = false)
+{
+	for(int i = 0; i < (int)v.size(); ++i)
+		if(v[i] < min || v[i] > max || (odd && v[i] % 2 == 0))
+			return false;
+	return true;
+}
+
+void BatchRunner::check_preset()
+// Fails the job if a setting of the preset (which '--set' may have replaced) has values the main program
+// would not let the user choose. Root movements and pedal notes are used as indexes by the engine,
+// the sizes of chords as sizes and the period as a divisor.
+{
+	string name;
+	if(continual && (loop_count < 1 || loop_count > 1000))  name = "number of progressions";
+	if(lowest < 0 || highest > 127 || lowest > highest)  name = "range of notes";
+	if(m_min < 1 || m_max > 15 || m_min > m_max)  name = "number of parts";
+	if(n_min < 1 || n_max > 12 || n_min > n_max)  name = "number of notes";
+	if(period < 1 || period > 999)  name = "period";
+	if(sample_size < 1)  name = "sample size";
+	if(!in_range(overall_scale, 0, 11))  name = "overall scale";
+	for(int i = 3; i <= 7; ++i)
+		if(!in_range(omission[i], 1, 13, true))  name = "omission for " + to_string(i) + "-note chords";
+	if(!in_range(bass_avail, 1, 13, true))  name = "bass note allowed";
+	if(enable_pedal)
+	{
+		if(in_bass && (pedal_notes.empty() || (int)pedal_notes.size() > m_max || !in_range(pedal_notes, 0, 127)))
+			name = "pedal notes";
+		if(!in_bass && !in_range(pedal_notes_set, 0, 11))  name = "pedal notes";
+	}
+	vector<bool> used(7, false);
+	for(int i = 0; i < (int)rm_priority.size() && name.empty(); ++i)
+	{
+		if(rm_priority[i] < 0 || rm_priority[i] > 6 || used[rm_priority[i]])
+			name = "priority";
+		else  used[rm_priority[i]] = true;
+	}
+	if(!name.empty())
+	{
+		error = string("ERROR - the setting '") + name + "' of the preset is not valid.";
+		throw error.c_str();
+	}
+}
+
+void BatchRunner::run_generation(const BatchSettings& settings, BatchJob& job, const int& number)
+{
+	if(job.output_name.empty())
+	{
+		job.output_name = output_name;
+		if(number > 0 && job.shards <= 1)  job.output_name += "-" + to_string(number);
+	}
+	copy_field(output_name, sizeof(output_name), job.output_name, "output name");
+	if(strlen(output_path) + job.output_name.size() > MAX_OUTPUT_FILENAME)
+		throw "ERROR - the output path and name are too long.";
+	if(!job.initial.empty())
+	{
+		copy_field(str_notes, sizeof(str_notes), job.initial, "initial chord");
+		automatic = false;
+		if(!parse_chord(str_notes, notes))
+		{
+			if(language == English)
+				throw "ERROR - the initial chord is not valid.";
+			else  throw "错误：初始和弦无效。";
+		}
+	}
+
+	{
+		StageTimer timer(stage_stats[StageDatabase]);
+		load_library(settings.database_path + database_filename);
+		if(chord_library.empty())
+		{
+			if(language == English)
+				throw "ERROR - failed to read the chord database. Please check the database path.";
+			else  throw "错误：无法读取和弦类型库。请检查类型库路径。";
+		}
+		stage_stats[StageDatabase].out += chord_library.size();
+		if(align_mode == List)
+		{
+			if(strcmp(align_db_filename, "N/A") == 0)
+			{
+				if(language == English)
+					throw "ERROR - custom chord alignment is selected without an alignment database (.db) file.";
+				else  throw "错误：已选择自定义和弦排列，但未指定排列库(.db)文件。";
+			}
+			load_alignment(settings.align_path + align_db_filename);
+		}
+	}
+	{
+		StageTimer timer(stage_stats[StageInitial]);
+		if(automatic)  choose_initial();
+		else  check_initial();
+	}
+
+	if(shard_mode == WriteShard)  run_shard();
+	else  Main();
+	job.results = continual ? loop_count : c_size;
+}
+
+void BatchRunner::run_substitution(BatchJob& job, const int& number)
+// The chords to substitute are the antechord and postchord of the preset, or the sequence of the job.
+{
+#ifdef QT_CORE_LIB
+	if(job.output_name.empty())
+	{
+		job.output_name = output_name_sub;
+		if(number > 0 && job.shards <= 1)  job.output_name += "-" + to_string(number);
+	}
+	copy_field(output_name_sub, sizeof(output_name_sub), job.output_name, "output name");
+	if(strlen(output_path) + job.output_name.size() > MAX_OUTPUT_FILENAME)
+		throw "ERROR - the output path and name are too long.";
+	if(!job.sequence.empty())
+	{
+		object = Sequence;
+		copy_field(str_seq_notes, sizeof(str_seq_notes), job.sequence, "sequence");
+		parse_sequence(str_seq_notes);
+	}
+	if(object != Sequence)
+	{
+		if(!parse_chord(str_ante_notes, ante_notes) || !parse_chord(str_post_notes, post_notes)
+			|| ante_notes.empty() || post_notes.empty())
+		{
+			if(language == English)
+				throw "ERROR - the antechord or the postchord is not valid.";
+			else  throw "错误：前和弦或后和弦无效。";
+		}
+	}
+	sub_seed = next_random(job_random);
+	resume_sub = false;
+
+	if(object == Sequence)
+	{
+		substitute_sequence();
+		job.results = 1;
+	}
+	else
+	{
+		substitute();
+		job.results = sub_size;
+	}
+#else
+	(void)job;  (void)number;
+	throw "ERROR - chord substitution needs a build with Qt.";
+#endif
+}
+
+void BatchRunner::run_analysis(BatchJob& job)
+// The antechord and postchord are separated by '/'. The analysis is kept in 'job.text'; no file is written.
+{
+#ifdef QT_CORE_LIB
+	read_job(job);
+	hide_octave = false;
+	stream.str("");
+	stream.clear();
+	analyse();
+	job.text = stream.str();
+	stream.str("");
+	job.results = 1;
+#else
+	(void)job;
+	throw "ERROR - chord analysis needs a build with Qt.";
+#endif
+}
+
+bool read_memory_budget(const string& value, int& budget)
+// Reads a memory budget in MB. Returns false unless it is a whole number from 1 to 'MAX_MEMORY_BUDGET'.
+{
+	char* end;
+	const long long num = strtoll(value.c_str(), &end, 10);
+	if(end == value.c_str() || *end != '\0' || num < 1 || num > MAX_MEMORY_BUDGET)
+		return false;
+	budget = num;
+	return true;
+}
+
+bool read_line(const string& line, BatchSettings& settings, BatchJob& job, bool& is_job, bool& has_seed)
+// Reads a line of a batch manifest (see 'read_manifest') into 'settings', or into 'job' if it is a job.
+// Returns false if the line is not valid.
+{
+	bool first = true;
+	int pos1 = 0, pos2;
+	is_job = false;
+	has_seed = false;
+	while(pos1 < (int)line.size())
+	{
+		pos2 = line.find(';', pos1);
+		if(pos2 == (int)string::npos)  pos2 = line.size();
+		string item = line.substr(pos1, pos2 - pos1);
+		pos1 = pos2 + 1;
+		if(trim(item).empty())  continue;
+		int eq = item.find('=');
+		if(eq == (int)string::npos)
+			return false;
+		string key = trim(item.substr(0, eq)), value = trim(item.substr(eq + 1));
+		if(key == "preset" && first)
+		{
+			job.preset = value;
+			is_job = true;
+		}
+		else if(key == "analyse" && first)
+		{
+			job.analysis = value;
+			is_job = true;
+		}
+		else if(is_job && key == "initial chord")  job.initial = value;
+		else if(is_job && key == "seed")
+		{
+			job.seed = strtoull(value.c_str(), nullptr, 10);
+			has_seed = true;
+		}
+		else if(is_job && key == "output name")  job.output_name = value;
+		else if(is_job && key == "substitute")  job.substitution = (value == "true");
+		else if(is_job && key == "sequence")  job.sequence = value;
+		else if(is_job && key == "metrics")  job.metrics = (value == "true");
+		else if(is_job && key == "memory budget")
+		{
+			if(!read_memory_budget(value, job.memory_budget))  return false;
+		}
+		else if(is_job && key == "shard" && sscanf(value.c_str(), "%d/%d", &job.shard, &job.shards) == 2)
+			job.merge = false;
+		else if(is_job && key == "merge shards")
+		{
+			job.shards = atoi(value.c_str());
+			job.merge = true;
+		}
+		else if(is_job && key == "set" && value.find('=') != string::npos)
+		{
+			int eq = value.find('=');
+			job.overrides.push_back(make_pair(trim(value.substr(0, eq)), trim(value.substr(eq + 1))));
+		}
+		else if(!is_job && key == "threads")  settings.threads = atoi(value.c_str());
+		else if(!is_job && key == "output path")  settings.output_path = value;
+		else if(!is_job && key == "database path")  settings.database_path = value;
+		else if(!is_job && key == "alignment path")  settings.align_path = value;
+		else if(!is_job && key == "summary")  settings.summary = value;
+		else  return false;
+		first = false;
+	}
+	return true;
+}
+
+void read_manifest(const char* filename, BatchSettings& settings, vector<BatchJob>& jobs)
+// Reads a batch manifest. Each line holds some 'key = value;' pairs, as in a preset.
+// A line beginning with 'preset' is a job, which may also set 'initial chord', 'seed', 'output name',
+// 'substitute' (true or false), 'sequence', 'shard' (e.g. '2/4' for the second of 4 parts), 'merge shards'
+// (the number of parts), 'metrics' (true for '<output name>.metrics.json', see 'Chord::print_metrics'),
+// 'memory budget' (MB of results kept in memory in single mode, see 'Chord::spill_results')
+// and any number of 'set = <key of the preset> = <value>'.
+// A line beginning with 'analyse' (e.g. 'analyse = C4 E4 G4 / D4 F4 A4 C5') is the analysis of a progression.
+// The other lines set 'threads', 'output path', 'database path', 'alignment path' and 'summary'.
+// Empty lines and lines beginning with '//' are skipped. Unless given, the seed of a job is its number.
+{
+	ifstream fin(filename);
+	if(!fin.is_open())
+		throw "ERROR - failed to open the batch manifest.";
+	static char message[100];
+	string line;
+	int line_count = 0;
+	jobs.clear();
+	while(getline(fin, line))
+	{
+		++line_count;
+		line = trim(line);
+		if(line.empty() || line.compare(0, 2, "//") == 0)  continue;
+		BatchJob job;
+		bool is_job, has_seed;
+		if(!read_line(line, settings, job, is_job, has_seed))
+		{
+			sprintf(message, "ERROR - line %d of the batch manifest is not valid.", line_count);
+			throw (const char*)message;
+		}
+		if(is_job)
+		{
+			if(!has_seed)  job.seed = jobs.size() + 1;
+			jobs.push_back(job);
+		}
+	}
+	fin.close();
+}
+
+void run_batch(const BatchSettings& settings, vector<BatchJob>& jobs)
+// Runs the jobs on at most 'settings.threads' threads. Each job has its own engine and output files;
+// the databases are shared (see 'load_library').
+// Merges of sharded runs need the partial files written by the other jobs, so they run after all of them.
+{
+	if(!writable(settings.output_path))
+	{
+		for(int i = 0; i < (int)jobs.size(); ++i)
+			jobs[i].message = path_error;
+		return;
+	}
+	int thread_count = settings.threads;
+	if(thread_count <= 0)  thread_count = thread::hardware_concurrency();
+	if(thread_count <= 0)  thread_count = 1;
+
+	vector<int> stages[2];  // the jobs, then the merges
+	for(int i = 0; i < (int)jobs.size(); ++i)
+		stages[jobs[i].shards > 1 && jobs[i].merge].push_back(i);
+	for(int stage = 0; stage < 2; ++stage)
+	{
+		const vector<int>& order = stages[stage];
+		const int count = min(thread_count, (int)order.size());
+		atomic<int> next_job{0};
+		vector<thread> workers;
+		for(int i = 0; i < count; ++i)
+		{
+			workers.push_back(thread([&]()
+			{
+				int next;
+				while((next = next_job++) < (int)order.size())
+				{
+					const int index = order[next];
+					BatchRunner* runner = new BatchRunner;
+					runner -> run(settings, jobs[index], index + 1);
+					delete runner;
+				}
+			}));
+		}
+		for(int i = 0; i < count; ++i)
+			workers[i].join();
+	}
+}
+
+void BatchRunner::preload(const BatchSettings& settings, const string& preset)
+{
+	char title[2][100];
+	bool scale_set;
+	if(!read_preset(preset.c_str(), title, scale_set))
+		throw "ERROR - failed to read the preset.";
+	load_library(settings.database_path + database_filename);
+	if(align_mode == List && strcmp(align_db_filename, "N/A") != 0)
+		load_alignment(settings.align_path + align_db_filename);
+}
+
+void warm_up(const BatchSettings& settings, const vector<string>& presets)
+// Fills the tables shared by all jobs and loads the databases of 'presets' into the cache,
+// so that the first jobs using them (e.g. requests to a server) do not have to wait.
+{
+	set_expansion_indexes();
+#ifdef QT_CORE_LIB
+	BatchRunner::set_sub_index();
+#endif
+	for(int i = 0; i < (int)presets.size(); ++i)
+	{
+		BatchRunner* runner = new BatchRunner;
+		runner -> preload(settings, presets[i]);
+		delete runner;
+	}
+}
+
+void run_single(const BatchSettings& settings, BatchJob& job, const int& number)
+// Runs a job on this thread; see 'BatchRunner::run' for 'number'.
+{
+	if(!writable(settings.output_path))
+	{
+		job.message = path_error;
+		return;
+	}
+	BatchRunner* runner = new BatchRunner;
+	runner -> run(settings, job, number);
+	delete runner;
+}
+
+string check_job(const BatchJob& job)
+// Returns why the job cannot run (see 'BatchRunner::read_job'), or an empty string.
+{
+	BatchRunner* runner = new BatchRunner;
+	string message;
+	try{ runner -> check(job); }
+	catch(const char* msg)  { message = msg; }
+	delete runner;
+	return message;
+}
+
+string job_mode(const BatchJob& job)
+// e.g. "generation", "substitution (shard 2/4)" or "generation (merge of 4 shards)"
+{
+	if(!job.analysis.empty())  return "analysis";
+	string mode = job.substitution ? "substitution" : "generation";
+	if(job.shards > 1 && job.merge)
+		mode += " (merge of " + to_string(job.shards) + " shards)";
+	else if(job.shards > 1)
+		mode += " (shard " + to_string(job.shard) + "/" + to_string(job.shards) + ")";
+	return mode;
+}
+
+string json_string(const string& str)
+{
+	string result = "\"";
+	for(int i = 0; i < (int)str.size(); ++i)
+	{
+		const char ch = str[i];
+		if(ch == '"' || ch == '\\')  { result += '\\';  result += ch; }
+		else if(ch == '\n')  result += "\\n";
+		else if(ch == '\t')  result += "\\t";
+		else if((unsigned char)ch < 0x20)  result += ' ';
+		else  result += ch;
+	}
+	return result + "\"";
+}
+
+string job_json(const BatchSettings& settings, const BatchJob& job, const double& cpu_seconds)
+// The outcome of a job as a single line of JSON; 'cpu_seconds' is left out if negative.
+{
+	char seconds[30];
+	stringstream result;
+	sprintf(seconds, "%.3f", job.seconds);
+	result << "{\"preset\": " << json_string(job.preset)
+			 << ", \"mode\": " << json_string(job_mode(job))
+			 << ", \"status\": \"" << (job.done ? "done" : "failed") << "\""
+			 << ", \"seconds\": " << seconds;
+	if(cpu_seconds >= 0.0)
+	{
+		sprintf(seconds, "%.3f", cpu_seconds);
+		result << ", \"cpu_seconds\": " << seconds;
+	}
+	result << ", \"results\": " << job.results;
+	if(job.analysis.empty() && !job.substitution)
+		result << ", \"candidates\": " << job.candidates;
+	result << ", \"seed\": " << job.seed;
+	if(job.analysis.empty())
+		result << ", \"output\": " << json_string(settings.output_path + job.output_name);
+	else  result << ", \"text\": " << json_string(job.text);
+	result << ", \"message\": " << json_string(job.message) << "}";
+	return result.str();
+}
+
+void write_summary(const BatchSettings& settings, const vector<BatchJob>& jobs, const double& seconds)
+// Writes the status and timing of every job, separated by tabs.
+{
+	string filename = settings.summary;
+	if(filename.empty())
+		filename = settings.output_path + "batch-summary.tsv";
+	ofstream summary(filename, ios::trunc);
+	summary << "job\tpreset\tmode\tinitial chord\tseed\toutput name\tstatus\tseconds\tresults\tmessage\n";
+	int failed = 0;
+	for(int i = 0; i < (int)jobs.size(); ++i)
+	{
+		const BatchJob& job = jobs[i];
+		if(!job.done)  ++failed;
+		summary << i + 1 << '\t' << job.preset << '\t' << job_mode(job) << '\t'
+				  << job.initial << '\t' << job.seed << '\t' << job.output_name << '\t' << (job.done ? "done" : "failed") << '\t'
+				  << fixed << setprecision(3) << job.seconds << '\t' << job.results << '\t' << job.message << '\n';
+	}
+	summary << "total\t\t\t\t\t\t" << jobs.size() - failed << " done, " << failed << " failed\t"
+			  << fixed << setprecision(3) << seconds << "\t\t\n";
+	summary.close();
+}
@@ -0,0 +1,65 @@
+// ChordNova v3.0 [Build: 2021.1.14]
+// (c) 2020 Wenge Chen, Ji-woon Sim.
+// batch.h
+
+#ifndef BATCH
+#define BATCH
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "chord.h"
+
+using std::pair;
+using std::string;
+using std::vector;
+
+struct BatchJob
+// A job of a batch manifest (see 'read_manifest'), and its outcome.
+{
+	string preset;
+	vector<pair<string, string>> overrides;  // settings of the preset replaced (see 'override_preset')
+	bool   substitution = false;  // chord substitution with the settings of the preset instead of generation
+	string initial;       // initial chord; if empty, the one of the preset is used
+	string sequence;      // progression for sequence substitution (see 'parse_sequence')
+	string analysis;      // antechord and postchord separated by '/': only their analysis is run
+	string output_name;   // if empty, the output name of the preset (followed by the job number in a batch)
+	unsigned long long seed = 0;
+	int    shard = 0;     // only part #'shard' of 'shards' is run, to a partial file (see 'Chord::run_shard')
+	int    shards = 0;    // 0 for a run without shards
+	bool   merge = false; // The partial files of all 'shards' parts are merged into the output.
+	bool   metrics = false; // The time and counts of each stage are also written to a file (see 'Chord::print_metrics').
+	int    memory_budget = 0; // MB of results kept in memory (see 'Chord::spill_results'); 0 for the default
+	bool   done = false;
+	string message;       // why the job failed or stopped
+	string text;          // the result of an analysis
+	double seconds = 0.0; // wall-clock time of the job
+	long long results = 0;  // chords generated (progressions in continual mode) or substitutions found
+	long long candidates = 0;  // candidates tested by a generation (see 'Chord::stage_stats')
+};
+
+const int MAX_MEMORY_BUDGET = 1 << 20;  // MB, i.e. 1 TB
+
+struct BatchSettings
+{
+	int    threads = 0;  // at most this many jobs run at the same time; 0 for the number of cores
+	string output_path = "../output/";
+	string database_path = "../db/chord/";
+	string align_path = "../db/align/";
+	string summary;      // if empty, 'batch-summary.tsv' in 'output_path'
+};
+
+extern string job_mode(const BatchJob&);
+extern string json_string(const string&);
+extern string job_json(const BatchSettings&, const BatchJob&, const double& cpu_seconds = -1.0);
+extern bool read_memory_budget(const string&, int&);
+extern bool read_line(const string& line, BatchSettings&, BatchJob&, bool& is_job, bool& has_seed);
+extern void read_manifest(const char* filename, BatchSettings&, vector<BatchJob>&);
+extern void warm_up(const BatchSettings&, const vector<string>& presets);
+extern void run_batch(const BatchSettings&, vector<BatchJob>&);
+extern void run_single(const BatchSettings&, BatchJob&, const int& number = 0);
+extern string check_job(const BatchJob&);
+extern void write_summary(const BatchSettings&, const vector<BatchJob>&, const double& seconds);
+
+#endif
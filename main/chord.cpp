@@ -2,11 +2,14 @@
 // (c) 2020 Wenge Chen, Ji-woon Sim.
 // chord.cpp
 
+#include <algorithm>
 #include <cmath>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <vector>
@@ -17,7 +20,30 @@ using namespace std;
 
 const double _tension[12] = {0.0, 11.0, 8.0, 6.0, 5.0, 3.0, 7.0, 3.0, 5.0, 6.0, 8.0, 11.0};
 const int restriction[12] = {0, 53, 53, 51, 50, 51, 52, 39, 51, 50, 51, 52};
-vector<int> overall_scale = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+thread_local vector<int> overall_scale = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+void save_job_state(JobState& state)
+// Copies the settings of this thread, so that a job on another thread can take them over.
+{
+	for(int i = 0; i < 8; ++i)
+		state.omission[i] = omission[i];
+	state.chord_library = chord_library;
+	state.alignment_list = alignment_list;
+	state.alignment_keys = alignment_keys;
+	state.rm_priority = rm_priority;
+	state.overall_scale = overall_scale;
+}
+
+void load_job_state(const JobState& state)
+{
+	for(int i = 0; i < 8; ++i)
+		omission[i] = state.omission[i];
+	chord_library = state.chord_library;
+	alignment_list = state.alignment_list;
+	alignment_keys = state.alignment_keys;
+	rm_priority = state.rm_priority;
+	overall_scale = state.overall_scale;
+}
 
 void Chord::set_max_count()
 {
@@ -55,6 +81,7 @@ void Chord::init(ChordData& chord)
 	}
 
 	record.push_back(chord);
+	record_keys.insert(notes_to_key(chord.get_notes()));
 	if(unique_mode == RemoveDupType)
 		note_set_to_id(chord.get_note_set(), rec_id);
 }
@@ -135,41 +162,58 @@ void Chord::set_param1()
 
 void Chord::get_progression()
 {
-	begin_progr = clock();
 	new_chords.clear();
+	memory_used = 0;
+	clear_runs();
 	int len = comb(m_max - 1, t_size - 1);
 	// We will expand the chord to a size of 'm_max' by adding some notes from itself.
 	// It can be proved that "len" equals to the number of different "expansions".
+	long long first = 0, last = len * max_cnt;
+	// Candidate #n is movement vector #(n % max_cnt) of expansion #(n / max_cnt).
+	// A shard tests a range of them; see 'run_shard'.
+	if(shard_mode == WriteShard)
+	{
+		first = last * (shard_index - 1) / shard_count;
+		last  = last * shard_index / shard_count;
+	}
 
 #ifdef QT_CORE_LIB
-	prgdialog -> setMaximum(len * 1000);
-	prgdialog -> setMinimumDuration(0);
+	begin_progress(len * 1000);
+	QStringList str1 = {"Progression #", "进行 #"};
+	QString str2;
+	if(continual)  set_progress_text(str1[language] + str2.setNum(progr_count));
 #endif
 	Chord expansion;
-	for(exp_count = 1; exp_count <= len; ++exp_count)
+	if(shard_mode == MergeShards)
+	{
+		StageTimer timer(stage_stats[StageEnumeration]);
+		read_shards();
+	}
+	else
 	{
+		for(exp_count = first / max_cnt + 1; exp_count <= len && (exp_count - 1) * max_cnt < last; ++exp_count)
+		{
 #ifndef QT_CORE_LIB
-		cout << "\n" << exp_count << "/" << len << ":    ";
+			if(!quiet)  cout << "\n" << exp_count << "/" << len << ":    ";
 #endif
-		expand(expansion, m_max, exp_count - 1);
-		set_new_chords(expansion);
+			const long long offset = (exp_count - 1) * max_cnt;
+			{
+				StageTimer timer(stage_stats[StageExpansion]);
+				expand(expansion, m_max, exp_count - 1);
+				++stage_stats[StageExpansion].out;
+			}
+			set_new_chords(expansion, max(first - offset, 0LL), min(last - offset, max_cnt));
+		}
 	}
 
 #ifdef QT_CORE_LIB
-	if(continual)
-	{
-		QStringList str1 = {"Progression #", "进行 #"};
-		QString str2;
-		labeltext = str1[language] + str2.setNum(progr_count) + " ";
-	}
-	else  labeltext.clear();
+	if(canceled())  abort();
 	QStringList str3 = {"(Writing to file(s)...)", "（正在写入文件…）"};
-	labeltext += str3[language];
-	prgdialog -> setLabelText(labeltext);
-	if(prgdialog -> wasCanceled())  abort(false);
-	set_est_time(prgdialog -> maximum(), false);
-	prgdialog -> setValue(prgdialog -> maximum());
+	if(continual)
+		end_progress(str1[language] + str2.setNum(progr_count) + " " + str3[language]);
+	else  end_progress(str3[language]);
 #endif
+	if(shard_mode == WriteShard)  return;
 	if(continual)  print_continual();
 	else  print_single();
 }
@@ -186,11 +230,19 @@ void Chord::expand(Chord& expansion, const int& target_size, const int& index)
 	expansion.t_size = target_size;
 }
 
-void Chord::set_new_chords(Chord& chord)
+void Chord::set_new_chords(Chord& chord, const long long& first, const long long& last)
+// tests movement vectors #'first' to #('last' - 1), in the order of 'next'
 {
 	vector<int> orig_vec;
+	const int choice = (vl_min == 0) ? (2 * vl_max + 1) : (2 * (vl_max - vl_min + 1));
+	long long rest = first;
 	for(int i = 0; i < m_max; ++i)
-		orig_vec.push_back(-vl_max);
+	{
+		int move = rest % choice - vl_max;
+		if(vl_min != 0 && move > -vl_min)  move += 2 * vl_min - 1;
+		orig_vec.push_back(move);
+		rest /= choice;
+	}
 	// This is the (movement) vector and from it we can get a new chord.
 	// However, a new chord may correspond to multiple movement vectors.
 	// 'orig_vec' may not be of the simplest form among all equivalent movement vectors,
@@ -201,39 +253,52 @@ void Chord::set_new_chords(Chord& chord)
 #else
 	long long step = max_cnt / 100;
 #endif
+	StageTimer timer(stage_stats[StageEnumeration]);
+	const long long old_size = c_size;
+	stage_stats[StageEnumeration].in += last - first;
 
-	for(long long count = 0; count < max_cnt; ++count)
+	for(long long count = first; count < last; ++count)
 	{
 		Chord new_chord(chord);
 		for(int i = 0; i < m_max; ++i)
 			new_chord.notes[i] += orig_vec[i];
+		timing = ((count & (METRICS_SAMPLE - 1)) == 0);
 		if( valid(new_chord) )
-		{
-			new_chords.push_back( static_cast<ChordData>(new_chord) );
-			++c_size;
-		}
+			add_result(new_chord);
 		next(orig_vec);
 
 		if(count % step == 0)
 		{
 #ifdef QT_CORE_LIB
-			if(continual)
-			{
-				QStringList str1 = {"Progression #", "进行 #"};
-				QString str2;
-				labeltext = str1[language] + str2.setNum(progr_count);
-			}
-			else  labeltext.clear();
-			double temp = exp_count - 1 + (double)count / max_cnt;
-			set_est_time(temp * 1000, false);
-			prgdialog -> setLabelText(labeltext);
-			if(prgdialog -> wasCanceled())  abort(false);
-			prgdialog -> setValue(temp * 1000);
+			if(canceled())  abort();
+			set_progress( (exp_count - 1 + (double)count / max_cnt) * 1000, (exp_count - 1) * max_cnt + count );
 #else
-			cout << "\b\b\b" << setw(2) << count / step / 5 << "%";
+			if(!quiet)  cout << "\b\b\b" << setw(2) << count / step / 5 << "%";
 #endif
 		}
 	}
+	timing = false;
+	stage_stats[StageEnumeration].out += c_size - old_size;
+}
+
+void Chord::add_result(const ChordData& chord)
+// A shard writes its results to the partial file in the order they are found; see 'run_shard'.
+{
+	++c_size;
+	if(shard_mode == WriteShard)
+	{
+		chord.write_compact(shard_buffer);
+		if((int)shard_buffer.size() >= TEXT_BUFFER_SIZE)
+			write_async(fout, shard_buffer);
+		return;
+	}
+	new_chords.push_back(chord);
+	if(!continual)
+	{
+		memory_used += new_chords.rbegin() -> memory_size();
+		if(memory_used >= ((long long)memory_budget << 20))
+			spill_results();
+	}
 }
 
 void Chord::next(vector<int>& orig_vec)
@@ -254,86 +319,223 @@ void Chord::next(vector<int>& orig_vec)
 	}
 }
 
+void Chord::estimate_cost(CostEstimate& result)
+// Predicts the cost of 'Main' with the current settings from random candidates (an expansion and
+// a movement vector each) drawn for 'ESTIMATE_TIME' seconds: the time per candidate, the rate of
+// acceptance by 'valid' and the memory of the results. The full run finds a result reached by k
+// candidates only once, so every accepted candidate counts 1 / k towards the results.
+// The state changed here is set again by 'Main'.
+{
+	ChordData saved(*this);
+	timing = false;
+	similarity = MINF;
+	sv = MINF;
+	common_note = MINF;
+	set_max_count();
+	set_expansion_indexes();
+	record.clear();
+	record_keys.clear();
+	rec_id.clear();
+	init( static_cast<ChordData&>(*this) );
+	const vector<int> init_rec_id(rec_id);
+
+	const int len = comb(m_max - 1, t_size - 1);
+	vector<int> moves;
+	// the intervals a voice can move by (see 'next')
+	for(int d = -vl_max; d <= vl_max; ++d)
+		if(abs(d) >= vl_min)  moves.push_back(d);
+	RandomEngine engine;
+	seed_random(engine, 1);
+	// Always the same sample, so that an estimate does not change unless the settings do.
+
+	Chord expansion;
+	double weight = 0, memory = 0;
+	int accepted = 0, samples = 0;
+	const double start = now_seconds();
+	for(; samples < ESTIMATE_SAMPLES; ++samples)
+	{
+		if(samples % 256 == 0 && now_seconds() - start > ESTIMATE_TIME)
+			break;
+		expand(expansion, m_max, rand(engine, 0, len - 1));
+		Chord new_chord(expansion);
+		for(int i = 0; i < m_max; ++i)
+			new_chord.notes[i] += moves[rand(engine, 0, moves.size() - 1)];
+		vec_ids.clear();
+		if( valid(new_chord) )
+		{
+			weight += 1.0 / count_candidates(new_chord.notes, len);
+			memory += new_chord.memory_size();
+			++accepted;
+			if(unique_mode == RemoveDupType && !continual)
+				rec_id = init_rec_id;
+		}
+	}
+	const double elapsed = now_seconds() - start;
+
+	result.candidates = (double)len * max_cnt;
+	result.samples = samples;
+	result.acceptance = (samples == 0) ? 0 : weight / samples;
+	result.candidate_time = (samples == 0) ? 0 : elapsed / samples;
+	result.seconds = result.candidates * result.candidate_time * (continual ? loop_count : 1);
+	result.results = result.candidates * result.acceptance;
+	result.memory = (accepted == 0) ? 0 : result.results * (memory / accepted);
+	result.spilled = false;
+	if(!continual && result.memory > ((double)memory_budget * (1 << 20)))
+	{
+		result.memory = (double)memory_budget * (1 << 20);
+		result.spilled = true;
+	}
+
+	static_cast<ChordData&>(*this) = saved;
+	record.clear();
+	record_keys.clear();
+	rec_id.clear();
+	vec_ids.clear();
+}
+
+double Chord::count_candidates(const vector<int>& result, const int& len)
+// The number of candidates (over all 'len' expansions) that give the chord 'result' (sorted, without duplicates).
+// Voice i of an expansion goes to some note of 'result' within the range of movement; the voices keep
+// their order and every note of 'result' is reached. 'ways[j]' counts the ways in which the voices so far
+// reach exactly the notes up to 'result[j]'.
+{
+	const int size = result.size();
+	vector<double> ways(size), next_ways(size);
+	double count = 0;
+	for(int e = 0; e < len; ++e)
+	{
+		const int* index = expansion_indexes[t_size][m_max][e];
+		for(int i = 0; i < m_max; ++i)
+		{
+			const int source = notes[index[i]];
+			for(int j = 0; j < size; ++j)
+			{
+				const int d = abs(result[j] - source);
+				if(d > vl_max || d < vl_min)
+					next_ways[j] = 0;
+				else if(i == 0)
+					next_ways[j] = (j == 0);
+				else  next_ways[j] = ways[j] + ((j > 0) ? ways[j - 1] : 0);
+			}
+			ways.swap(next_ways);
+		}
+		count += ways[size - 1];
+	}
+	return count;
+}
+
 bool Chord::valid(Chord& new_chord)
 // checks various conditions
+// The conditions are grouped into the filters 'FilterOrder' to 'FilterDuplicate', counted by 'reject'.
 {
+	if(timing)
+	{
+		lap_time = now_seconds();
+		lap_allocations = allocation_count;
+	}
 	int i, pos = 1;
 	for(i = 1; i < new_chord.t_size; ++i)
 		if(new_chord.notes[i - 1] > new_chord.notes[i])
-			return false;
+			return reject(FilterOrder);
 
 	if(*new_chord.notes.begin() < lowest || *new_chord.notes.rbegin() > highest)
-		return false;
+		return reject(FilterOrder);
+	if(timing)  lap(FilterOrder);
 
 	remove_duplicate(new_chord.notes);
-	new_chord.set_param1();
+	new_chord.set_param1();  // timed with the alignment filter, the first one after it
 	if(align_mode != Unlimited && !valid_alignment(new_chord))
-		return false;
+		return reject(FilterAlignment);
+	if(timing)  lap(FilterAlignment);
 	if(enable_ex && !valid_exclusion(new_chord))
-		return false;
+		return reject(FilterExclusion);
+	if(timing)  lap(FilterExclusion);
 	if(enable_pedal && continual && !include_pedal(new_chord))
-		return false;
+		return reject(FilterPedal);
+	if(timing)  lap(FilterPedal);
 	if(new_chord.t_size < m_min || new_chord.t_size > m_max)
-		return false;
+		return reject(FilterChord);
 	if(new_chord.s_size < n_min || new_chord.s_size > n_max)
-		return false;
+		return reject(FilterChord);
 	if(new_chord.thickness > h_max || new_chord.thickness < h_min)
-		return false;
+		return reject(FilterChord);
 	if(new_chord.root > r_max || new_chord.root < r_min)
-		return false;
+		return reject(FilterChord);
 	if(new_chord.g_center > g_max || new_chord.g_center < g_min)
-		return false;
+		return reject(FilterChord);
+	if(timing)  lap(FilterChord);
 
 	vector<int> intersection = intersect(new_chord.note_set, overall_scale, true);
-	if((int)intersection.size() < new_chord.s_size)  return false;
+	if((int)intersection.size() < new_chord.s_size)  return reject(FilterScale);
 
 	pos = find(bass_avail, new_chord.alignment[0]);
-	if(pos != -1)  return false;
+	if(pos != -1)  return reject(FilterScale);
 	pos = find(chord_library, new_chord.set_id);
-	if(pos != -1)  return false;
+	if(pos != -1)  return reject(FilterScale);
 
 	if(unique_mode == RemoveDupType)
 	{
 		pos = find(rec_id, new_chord.set_id);
-		if(pos == -1)  return false;
+		if(pos == -1)  return reject(FilterScale);
 	}
+	if(timing)  lap(FilterScale);
 
 	find_vec(new_chord);
 	if(!valid_vec(new_chord))
-		return false;
+		return reject(FilterVoiceLeading);
 	if(new_chord.common_note > c_max || new_chord.common_note < c_min)
-		return false;
+		return reject(FilterVoiceLeading);
 	if(new_chord.sv < sv_min || new_chord.sv > sv_max)
-		return false;
+		return reject(FilterVoiceLeading);
 	if(enable_rm && rm_priority[new_chord.root_movement] == -1)
-		return false;
+		return reject(FilterVoiceLeading);
 	if(!valid_sim(new_chord))
-		return false;
+		return reject(FilterVoiceLeading);
 	if(new_chord.span < s_min || new_chord.span > s_max)
-		return false;
+		return reject(FilterVoiceLeading);
 	if(new_chord.sspan < ss_min || new_chord.sspan > ss_max)
-		return false;
+		return reject(FilterVoiceLeading);
 	if(new_chord.Q_indicator < q_min || new_chord.Q_indicator > q_max)
-		return false;
+		return reject(FilterVoiceLeading);
+	if(timing)  lap(FilterVoiceLeading);
 
 	set_vec_id(new_chord);
 	pos = find(vec_ids, new_chord.vec_id);
-	if(pos == -1)    return false;
+	if(pos == -1)    return reject(FilterDuplicate);
 
 	vec_ids.insert(vec_ids.begin() + pos, new_chord.vec_id);
 	if(unique_mode == RemoveDupType && !continual)
 		note_set_to_id(new_chord.note_set, rec_id);
+	if(timing)  lap(FilterDuplicate);
 	return true;
 }
 
+bool Chord::reject(const Stage& filter)
+// counts a candidate rejected by 'filter' in 'valid'
+{
+	++stage_stats[filter].rejected;
+	if(timing)  lap(filter);
+	return false;
+}
+
+void Chord::lap(const Stage& filter)
+// Adds the time and allocations since the end of the previous filter to 'filter', for a candidate
+// timed through the filters. Timing every candidate would cost more than some filters do.
+{
+	const double time = now_seconds();
+	StageStat& stat = stage_stats[filter];
+	stat.seconds += time - lap_time;
+	stat.allocations += allocation_count - lap_allocations;
+	++stat.calls;
+	lap_time = time;
+	lap_allocations = allocation_count;
+}
+
 bool Chord::valid_alignment(Chord& chord)
 {
 	if(align_mode == List)
 	{
-		for(int i = 0; i < (int)alignment_list.size(); ++i)
-			if(alignment_list[i] == chord.alignment)
-				return true;
-		return false;
+		return alignment_keys.count(notes_to_key(chord.alignment)) != 0;
 	}
 	else
 	{
@@ -875,8 +1077,413 @@ void Chord::sort_results(vector<ChordData>& chords, bool in_substitution)
 	}
 }
 
+bool Chord::better_result(const ChordData& chord1, const ChordData& chord2)
+// Returns true if 'chord1' comes before 'chord2' in the results of single mode, i.e. in the order of
+// 'sort_order', then (as 'print_single' sorts them before) 't', 'kk' and 'k' in descending order.
+// Ties return false so that earlier results stay first.
+{
+	for(int pos = 0; sort_order[pos] != '\0'; ++pos)
+	{
+		char ch = sort_order[pos];
+		bool ascending = (sort_order[pos + 1] == '+');
+		if(ascending)  ++pos;
+		for(int i = 0; i < VAR_TOTAL; ++i)
+		{
+			if(ch == var[i])
+			{
+				if( !compare[i][ascending](chord2, chord1) )  return true;
+				if( !compare[i][ascending](chord1, chord2) )  return false;
+			}
+		}
+	}
+	bool (*tie_break[3]) (const ChordData&, const ChordData&) = {larger_tension, larger_chroma_old, larger_chroma};
+	for(int i = 0; i < 3; ++i)
+	{
+		if( !tie_break[i](chord2, chord1) )  return true;
+		if( !tie_break[i](chord1, chord2) )  return false;
+	}
+	return false;
+}
+
+void Chord::spill_results()
+// Once 'new_chords' takes more than 'memory_budget' in single mode, it is sorted as 'print_single' would
+// sort it and written to a temporary file ("run") in the output folder by 'write_compact'.
+// Only 'k', 'kk' and 't' of each result stay in memory, for the percentile ranges; see 'merge_runs'.
+{
+	for(int i = 0; i < (int)new_chords.size(); ++i)
+	{
+		run_chroma.push_back(new_chords[i].get_chroma());
+		run_chroma_old.push_back(new_chords[i].get_chroma_old());
+		run_tension.push_back(new_chords[i].get_tension());
+	}
+	merge_sort(new_chords.begin(), new_chords.end(), larger_chroma);
+	merge_sort(new_chords.begin(), new_chords.end(), larger_chroma_old);
+	merge_sort(new_chords.begin(), new_chords.end(), larger_tension);
+	sort_results(new_chords, false);
+
+	string buffer;
+	for(int i = 0; i < (int)new_chords.size(); ++i)
+		new_chords[i].write_compact(buffer);
+	new_chords.clear();
+	memory_used = 0;
+
+	char filename[300];
+#ifdef QT_CORE_LIB
+	snprintf(filename, 300, "%s%s.%d.run", output_path, ((QString)output_name).toLocal8Bit().data(),
+				(int)spill_files.size());
+#else
+	snprintf(filename, 300, "%s%s.%d.run", output_path, output_name, (int)spill_files.size());
+#endif
+	ofstream file(filename, ios::binary | ios::trunc);
+	if(!file)
+	{
+		if(language == English)
+			throw "ERROR - failed to write temporary files to the output folder. Please check the output path.";
+		else  throw "错误：无法向输出文件夹写入临时文件。请检查输出路径。";
+	}
+	spill_files.push_back(filename);
+	write_async(file, buffer, true);
+}
+
+double rank_value(vector<double> values, const int& rank)
+// returns 'values[rank]' as if 'values' were sorted in descending order
+{
+	nth_element(values.begin(), values.begin() + rank, values.end(), greater<double>());
+	return values[rank];
+}
+
+void Chord::merge_runs()
+// 'print_single' for results spilled to disk by 'spill_results':
+// the percentile ranges are found from the values kept in memory, then the runs are merged
+// and each result in the ranges is printed, exported and added to the MIDI file at once.
+{
+	StageTimer timer(stage_stats[StageSort]);
+	spill_results();  // The results still in memory form the last run.
+	wait_writer();
+
+	int begin = (double)c_size * k_min / 100.0;
+	int end   = (double)c_size * k_max / 100.0;
+	if(end == c_size)  --end;
+	const double _k_min = rank_value(run_chroma, end);
+	const double _k_max = rank_value(run_chroma, begin);
+
+	begin = (double)c_size * kk_min / 100.0;
+	end   = (double)c_size * kk_max / 100.0;
+	if(end == c_size)  --end;
+	const double _kk_min = rank_value(run_chroma_old, end);
+	const double _kk_max = rank_value(run_chroma_old, begin);
+
+	begin = (double)c_size * t_min / 100.0;
+	end   = (double)c_size * t_max / 100.0;
+	if(end == c_size)  --end;
+	const double _t_min = rank_value(run_tension, end);
+	const double _t_max = rank_value(run_tension, begin);
+
+	int count = 0;
+	for(int i = 0; i < c_size; ++i)
+	{
+		if( run_chroma[i]     >=  _k_min && run_chroma[i]     <=  _k_max
+		 && run_chroma_old[i] >= _kk_min && run_chroma_old[i] <= _kk_max
+		 && run_tension[i]    >=  _t_min && run_tension[i]    <=  _t_max )
+			++count;
+	}
+	c_size = count;
+	if(c_size == 0)
+	{
+		clear_runs();
+		if(language == English)
+		{
+			fout << "Results not found.\n\n";
+			throw "ERROR - results not found under these conditions. Please check your conditions and try again.";
+		}
+		else
+		{
+			fout << "未找到结果。\n\n";
+			throw "错误：在该条件下未找到结果。请检查条件后重试。";
+		}
+	}
+
+	if(language == English)
+		fout << c_size << " progression(s)\n\n";
+	else  fout << c_size << " 种可能的和弦进行\n\n";
+	if(output_mode != TextOnly)
+	{
+		midi_head();
+		if(!interlace)  chord_to_midi(notes);
+	}
+
+	// The results in the ranges are also written to a last run in their final order for 'print_stats'.
+	string merged;
+	ofstream merged_file;
+	if(output_mode != MidiOnly)
+	{
+		spill_files.push_back(spill_files[0] + ".merged");
+		merged_file.open(spill_files.rbegin() -> c_str(), ios::binary | ios::trunc);
+		if(!merged_file)
+		{
+			clear_runs();
+			if(language == English)
+				throw "ERROR - failed to write temporary files to the output folder. Please check the output path.";
+			else  throw "错误：无法向输出文件夹写入临时文件。请检查输出路径。";
+		}
+	}
+
+	// There are only a few runs, so the next result is simply the best of their first results.
+	const int run_count = spill_files.size() - (output_mode != MidiOnly);
+	vector<MappedFile> runs(run_count);
+	vector<const char*> pos(run_count);
+	vector<ChordData> heads(run_count);
+	bool damaged = false;
+	for(int i = 0; i < run_count; ++i)
+	{
+		pos[i] = nullptr;
+		if(map_file(spill_files[i].c_str(), runs[i]) && runs[i].size != 0)
+		{
+			pos[i] = runs[i].data;
+			damaged |= !heads[i].read_compact(pos[i], runs[i].data + runs[i].size);
+		}
+	}
+	while(!damaged)
+	{
+		int best = -1;
+		for(int i = 0; i < run_count; ++i)
+			if(pos[i] != nullptr && (best == -1 || better_result(heads[i], heads[best])))
+				best = i;
+		if(best == -1)  break;
+
+		ChordData& chord = heads[best];
+		if( chord.get_chroma()     >=  _k_min && chord.get_chroma()     <=  _k_max
+		 && chord.get_chroma_old() >= _kk_min && chord.get_chroma_old() <= _kk_max
+		 && chord.get_tension()    >=  _t_min && chord.get_tension()    <=  _t_max )
+		{
+			if(output_mode != MidiOnly)
+			{
+				print(chord, language);
+				chord.write_compact(merged);
+				if((int)merged.size() >= TEXT_BUFFER_SIZE)
+					write_async(merged_file, merged);
+			}
+			if(export_format != NoExport)  to_export(chord);
+			if(output_mode != TextOnly)
+			{
+				if(interlace)  chord_to_midi(notes);
+				chord_to_midi(chord.get_notes());
+			}
+		}
+		if(pos[best] < runs[best].data + runs[best].size)
+			damaged = !chord.read_compact(pos[best], runs[best].data + runs[best].size);
+		else  pos[best] = nullptr;
+	}
+	for(int i = 0; i < run_count; ++i)
+		unmap_file(runs[i]);
+	if(damaged)  run_error();
+
+	if(output_mode != MidiOnly)
+	{
+		write_async(merged_file, merged, true);
+		wait_writer();
+		map_file(spill_files.rbegin() -> c_str(), merged_run);
+		tflush();
+		print_end();
+	}
+	clear_runs();
+}
+
+ChordData& Chord::get_result(const int& index)
+// Returns the 'index'th result in single mode. Once spilled, the results are read in order from
+// 'merged_run', so 'index' has to go up one by one from 0.
+{
+	if(merged_run.data == nullptr)  return new_chords[index];
+	if(index == 0)  merged_pos = merged_run.data;
+	if(!merged_result.read_compact(merged_pos, merged_run.data + merged_run.size))
+		run_error();
+	return merged_result;
+}
+
+void Chord::clear_runs()
+// removes the runs written by 'spill_results' and 'merge_runs'
+{
+	wait_writer();
+	unmap_file(merged_run);
+	for(int i = 0; i < (int)spill_files.size(); ++i)
+		remove(spill_files[i].c_str());
+	spill_files.clear();
+	run_chroma.clear();
+	run_chroma_old.clear();
+	run_tension.clear();
+}
+
+void Chord::run_error()
+// A run cannot be read back as it was written, e.g. as the output folder is full or the file was changed.
+{
+	clear_runs();
+	if(language == English)
+		throw "ERROR - failed to read temporary files in the output folder. Please check the output path.";
+	else  throw "错误：无法读取输出文件夹中的临时文件。请检查输出路径。";
+}
+
+void Chord::set_shard_name(char* name, const char* output, const int& index)
+// the partial file of shard #'index', e.g. "output.2-of-4.part"
+{
+#ifdef QT_CORE_LIB
+	snprintf(name, 300, "%s%s.%d-of-%d.part", output_path, ((QString)output).toLocal8Bit().data(), index, shard_count);
+#else
+	snprintf(name, 300, "%s%s.%d-of-%d.part", output_path, output, index, shard_count);
+#endif
+}
+
+void Chord::write_shard_head(string& str, const vector<double>& fp, const int& index)
+{
+	const int fp_size = fp.size();
+	str.append(SHARD_MAGIC, 4);
+	str.append((const char*)&fp_size, sizeof(int));
+	str.append((const char*)fp.data(), fp_size * sizeof(double));
+	str.append((const char*)&index, sizeof(int));
+	str.append((const char*)&shard_count, sizeof(int));
+}
+
+bool Chord::read_shard_head(const char*& pos, const MappedFile& file, const vector<double>& fp, const int& index)
+// Returns false unless the file is part #'index' of a sharded run with the fingerprint 'fp'.
+{
+	const int fp_size = fp.size();
+	const long long head_size = 4 + (fp_size + 3) * sizeof(int) + fp_size * sizeof(double);
+	if(file.data == nullptr || (long long)file.size < head_size)
+		return false;
+	pos = file.data;
+	int size, head_index, head_count;
+	if(strncmp(pos, SHARD_MAGIC, 4) != 0)  return false;
+	memcpy(&size, pos + 4, sizeof(int));
+	if(size != fp_size || memcmp(pos + 4 + sizeof(int), fp.data(), fp_size * sizeof(double)) != 0)
+		return false;
+	pos += 4 + sizeof(int) + fp_size * sizeof(double);
+	memcpy(&head_index, pos, sizeof(int));
+	memcpy(&head_count, pos + sizeof(int), sizeof(int));
+	pos += 2 * sizeof(int);
+	return head_index == index && head_count == shard_count;
+}
+
+void Chord::set_gen_fingerprint(vector<double>& fp)
+// Everything that the candidates and results of single mode depend on.
+// The partial files of a sharded run are only merged if their fingerprints are the same as the current one.
+// The chord library and the alignment list are too large to include, so only their checksums are.
+{
+	const double bounds[16] = { k_min, k_max, kk_min, kk_max, t_min, t_max, h_min, h_max, q_min, q_max,
+										 steady_min, steady_max, ascending_min, ascending_max, descending_min, descending_max };
+	const int settings[33] = { c_min, c_max, sv_min, sv_max, m_min, m_max, n_min, n_max, r_min, r_max,
+										s_min, s_max, ss_min, ss_max, g_min, g_max, x_min, x_max, lowest, highest,
+										vl_min, vl_max, vl_setting, unique_mode, align_mode, enable_ex, enable_sim,
+										enable_rm, (int)chord_library.size(), i_low, i_high, i_min, i_max };
+	const vector<int>* vecs[9] = { &notes, &bass_avail, &overall_scale, &rm_priority,
+											 &exclusion_notes, &exclusion_roots, &sim_period, &sim_min, &sim_max };
+	fp.assign(bounds, bounds + 16);
+	fp.insert(fp.end(), settings, settings + 33);
+	for(int i = 0; i < 9; ++i)
+	{
+		fp.push_back(vecs[i] -> size());
+		fp.insert(fp.end(), vecs[i] -> begin(), vecs[i] -> end());
+	}
+	fp.push_back(exclusion_intervals.size());
+	for(int i = 0; i < (int)exclusion_intervals.size(); ++i)
+	{
+		const intervalData& item = exclusion_intervals[i];
+		const int values[5] = { item.interval, item.octave_min, item.octave_max, item.num_min, item.num_max };
+		fp.insert(fp.end(), values, values + 5);
+	}
+	for(int i = 0; sort_order[i] != '\0'; ++i)
+		fp.push_back(sort_order[i]);
+
+	vector<int> alignments;
+	for(int i = 0; i < (int)alignment_list.size(); ++i)
+	{
+		alignments.push_back(alignment_list[i].size());
+		alignments.insert(alignments.end(), alignment_list[i].begin(), alignment_list[i].end());
+	}
+	const unsigned long long sums[2] =
+		{ checksum((const char*)chord_library.data(), chord_library.size() * sizeof(int)),
+		  checksum((const char*)alignments.data(), alignments.size() * sizeof(int)) };
+	for(int i = 0; i < 2; ++i)
+	{
+		// in two halves, as a double cannot hold all 64 bits
+		fp.push_back(sums[i] >> 32);
+		fp.push_back(sums[i] & 0xFFFFFFFFULL);
+	}
+}
+
+void Chord::read_shards()
+// 'set_new_chords' for the merge of a sharded run: the results of all parts are taken in the order of
+// the candidates, and those a single run would have rejected as found before ('vec_ids', or 'rec_id'
+// in RemoveDupType mode) are skipped, as a shard only knows its own results.
+{
+	vector<double> fp;
+	set_gen_fingerprint(fp);
+	char name[300];
+	MappedFile file;
+	ChordData chord;
+	for(int index = 1; index <= shard_count; ++index)
+	{
+		const char* pos;
+		int count, found = 0;
+		set_shard_name(name, output_name, index);
+		if(!map_file(name, file) || !read_shard_head(pos, file, fp, index) || file.data + file.size - pos < (int)sizeof(int))
+		{
+			unmap_file(file);
+			shard_error();
+		}
+		const char* end = file.data + file.size - sizeof(int);
+		memcpy(&count, end, sizeof(int));
+		while(pos < end)
+		{
+			if(!chord.read_compact(pos, end))
+			{
+				unmap_file(file);
+				shard_error();
+			}
+			++found;
+			long long id = 0, exp = 1;
+			vector<int>& vec = chord.get_vec();
+			for(int i = 0; i < (int)vec.size(); ++i)
+			{
+				id += (vec[i] + vl_max) * exp;
+				exp *= (2 * vl_max + 1);
+			}
+			int pos_id = find(vec_ids, id);
+			if(pos_id == -1)  continue;
+			if(unique_mode == RemoveDupType)
+			{
+				vector<int>& _note_set = chord.get_note_set();
+				int _set_id = 0;
+				for(int i = 0; i < (int)_note_set.size(); ++i)
+					_set_id += (1 << _note_set[i]);
+				if(find(rec_id, _set_id) == -1)  continue;
+				note_set_to_id(_note_set, rec_id);
+			}
+			vec_ids.insert(vec_ids.begin() + pos_id, id);
+			add_result(chord);
+		}
+		unmap_file(file);
+		if(pos != end || found != count)
+			shard_error();
+	}
+}
+
+void Chord::shard_error()
+{
+	clear_runs();
+	if(language == English)
+		throw "ERROR - a part of the sharded run is missing, incomplete or has other settings.";
+	else  throw "错误：分片运行的某一部分缺失、不完整或设置不同。";
+}
+
 void Chord::print_single()
 {
+	if(!spill_files.empty())
+	{
+		merge_runs();
+		return;
+	}
+
+	StageTimer percentile_timer(stage_stats[StagePercentile]);
+	stage_stats[StagePercentile].in += c_size;
 	merge_sort(new_chords.begin(), new_chords.end(), larger_chroma);
 	int begin = (double)c_size * k_min / 100.0;
 	int end   = (double)c_size * k_max / 100.0;
@@ -910,6 +1517,8 @@ void Chord::print_single()
 		}
 		else  ++i;
 	}
+	stage_stats[StagePercentile].out += c_size;
+	percentile_timer.stop();
 
 	if(c_size == 0)
 	{
@@ -928,13 +1537,25 @@ void Chord::print_single()
 	if(language == English)
 		fout << c_size << " progression(s)\n\n";
 	else  fout << c_size << " 种可能的和弦进行\n\n";
-	sort_results(new_chords, false);
+	{
+		StageTimer timer(stage_stats[StageSort]);
+		sort_results(new_chords, false);
+		stage_stats[StageSort].in += c_size;
+		stage_stats[StageSort].out += c_size;
+	}
 	if(output_mode != MidiOnly)
 	{
+		StageTimer timer(stage_stats[StageText]);
+		stage_stats[StageText].in += c_size;
+		stage_stats[StageText].out += c_size;
 		for(int j = 0; j < c_size; ++j)
 			print(new_chords[j], language);
+		tflush();
 		print_end();
 	}
+	if(export_format != NoExport)
+		for(int j = 0; j < c_size; ++j)
+			to_export(new_chords[j]);
 }
 
 void Chord::print_continual()
@@ -944,11 +1565,12 @@ void Chord::print_continual()
 		if(output_mode != MidiOnly)
 		{
 			if(language == English)
-				fout << "Results not found.\n\n";
-			else  fout << "未找到结果。\n\n";
+				tprint("Results not found.\n\n");
+			else  tprint("未找到结果。\n\n");
 			print_end();
 		}
 		if(output_mode != TextOnly)  to_midi();
+		print_metrics();
 		if(progr_count == 1)
 		{
 			if(language == English)
@@ -958,6 +1580,8 @@ void Chord::print_continual()
 		else  throw progr_count;
 	}
 
+	StageTimer percentile_timer(stage_stats[StagePercentile]);
+	stage_stats[StagePercentile].in += c_size;
 	merge_sort(new_chords.begin(), new_chords.end(), larger_chroma);
 	int begin = (double)c_size * k_min / 100.0;
 	int end   = (double)c_size * k_max / 100.0;
@@ -985,24 +1609,25 @@ void Chord::print_continual()
 		 && new_chords[i].get_chroma_old() >= _kk_min && new_chords[i].get_chroma_old() <= _kk_max )
 		{
 			b = true;
-			if(unique_mode == RemoveDup)
-				for(int j = 0; j < (int)record.size(); ++j)
-					if(record[j].get_notes() == new_chords[i].get_notes())
-					{ b = false;  break; }
+			if(unique_mode == RemoveDup && record_keys.count(notes_to_key(new_chords[i].get_notes())) != 0)
+				b = false;
 		}
 		if(b)  indexes.push_back(i);
 	}
+	stage_stats[StagePercentile].out += indexes.size();
+	percentile_timer.stop();
 
 	if(indexes.empty())
 	{
 		if(output_mode != MidiOnly)
 		{
 			if(language == English)
-				fout << "Results not found.\n\n";
-			else  fout << "未找到结果。\n\n";
+				tprint("Results not found.\n\n");
+			else  tprint("未找到结果。\n\n");
 			print_end();
 		}
 		if(output_mode != TextOnly)  to_midi();
+		print_metrics();
 		if(progr_count == 1)
 		{
 			if(language == English)
@@ -1013,7 +1638,13 @@ void Chord::print_continual()
 	}
 	int index = indexes[ rand(0, indexes.size() - 1) ];
 	if(output_mode != MidiOnly)
+	{
+		StageTimer timer(stage_stats[StageText]);
+		++stage_stats[StageText].in;
+		++stage_stats[StageText].out;
 		print(new_chords[index], language);
+	}
+	if(export_format != NoExport)  to_export(new_chords[index]);
 	notes = new_chords[index].get_notes();
 	single_chroma = new_chords[index].get_single_chroma();
 	prev_chroma_old = chroma_old;
@@ -1023,12 +1654,7 @@ void Chord::print_continual()
 
 void Chord::print_stats()
 {
-	vector<ChordData>* ptr;
-	if(continual)
-		ptr = &record;
-	else
-		ptr = &new_chords;
-	int count = ptr -> size();
+	int count = (continual ? record.size() : c_size);
 	int count_ = (continual ? (count - 1) : count);
 
 	vector<Movement> movement;
@@ -1039,15 +1665,16 @@ void Chord::print_stats()
 	int cardinal_change = 0;
 	for(int i = 0; i < count; ++i)
 	{
-		for(int j = 0; j < (int)(*ptr)[i].get_vec().size(); ++j)
+		ChordData& chord = (continual ? record[i] : get_result(i));
+		for(int j = 0; j < (int)chord.get_vec().size(); ++j)
 		{
-			int num = (*ptr)[i].get_vec()[j];
+			int num = chord.get_vec()[j];
 			++movement[num + vl_max].instance;
 		}
 
-		if(continual && i != 0 && (*ptr)[i].get_s_size() != (*ptr)[i - 1].get_s_size())
+		if(continual && i != 0 && chord.get_s_size() != record[i - 1].get_s_size())
 			++cardinal_change;
-		if(!continual && (*ptr)[i].get_s_size() != s_size)
+		if(!continual && chord.get_s_size() != s_size)
 			++cardinal_change;
 	}
 
@@ -1109,75 +1736,76 @@ void Chord::print_stats()
 
 	for(int i = 0; i < count; ++i)
 	{
+		ChordData& chord = (continual ? record[i] : get_result(i));
 		if( !(continual && i == 0) )
 		{
-			temp2 = abs((*ptr)[i].get_chroma());
+			temp2 = abs(chord.get_chroma());
 			if(temp2 > _k_max)  { _k_max = temp2;  k_max_index = i; }
 			if(temp2 < _k_min)  { _k_min = temp2;  k_min_index = i; }
 			k_sum += temp2;
 
-			temp2 = (*ptr)[i].get_Q_indicator();
+			temp2 = chord.get_Q_indicator();
 			if(temp2 > _q_max)  { _q_max = temp2;  q_max_index = i; }
 			if(temp2 < _q_min)  { _q_min = temp2;  q_min_index = i; }
 			q_sum += temp2;
 
-			temp1 = (*ptr)[i].get_similarity();
+			temp1 = chord.get_similarity();
 			if(temp1 > _x_max)  { _x_max = temp1;  x_max_index = i; }
 			if(temp1 < _x_min)  { _x_min = temp1;  x_min_index = i; }
 			x_sum += temp1;
 
-			temp1 = (*ptr)[i].get_common_note();
+			temp1 = chord.get_common_note();
 			if(temp1 > _c_max)  { _c_max = temp1;  c_max_index = i; }
 			if(temp1 < _c_min)  { _c_min = temp1;  c_min_index = i; }
 			c_sum += temp1;
 
-			temp1 = (*ptr)[i].get_sspan();
+			temp1 = chord.get_sspan();
 			if(temp1 > _ss_max)  { _ss_max = temp1;  ss_max_index = i; }
 			if(temp1 < _ss_min)  { _ss_min = temp1;  ss_min_index = i; }
 			ss_sum += temp1;
 
-			temp1 = (*ptr)[i].get_sv();
+			temp1 = chord.get_sv();
 			if(temp1 > _sv_max)  { _sv_max = temp1;  sv_max_index = i; }
 			if(temp1 < _sv_min)  { _sv_min = temp1;  sv_min_index = i; }
 			sv_sum += temp1;
 		}
 
-		temp1 = (*ptr)[i].get_s_size();
+		temp1 = chord.get_s_size();
 		if(temp1 > _n_max)  { _n_max = temp1;  n_max_index = i; }
 		if(temp1 < _n_min)  { _n_min = temp1;  n_min_index = i; }
 		n_sum += temp1;
 
-		temp1 = (*ptr)[i].get_t_size();
+		temp1 = chord.get_t_size();
 		if(temp1 > _m_max)  { _m_max = temp1;  m_max_index = i; }
 		if(temp1 < _m_min)  { _m_min = temp1;  m_min_index = i; }
 		m_sum += temp1;
 
-		temp2 = (double) (*ptr)[i].get_s_size() / (*ptr)[i].get_t_size();
+		temp2 = (double) chord.get_s_size() / chord.get_t_size();
 		if(temp2 > nm_max)  { nm_max = temp2;  nm_max_index = i; }
 		if(temp2 < nm_min)  { nm_min = temp2;  nm_min_index = i; }
 		nm_sum += temp2;
 
-		temp2 = (*ptr)[i].get_thickness();
+		temp2 = chord.get_thickness();
 		if(temp2 > _h_max)  { _h_max = temp2;  h_max_index = i; }
 		if(temp2 < _h_min)  { _h_min = temp2;  h_min_index = i; }
 		h_sum += temp2;
 
-		temp2 = (*ptr)[i].get_tension();
+		temp2 = chord.get_tension();
 		if(temp2 > _t_max)  { _t_max = temp2;  t_max_index = i; }
 		if(temp2 < _t_min)  { _t_min = temp2;  t_min_index = i; }
 		t_sum += temp2;
 
-		temp1 = (*ptr)[i].get_root();
+		temp1 = chord.get_root();
 		if(temp1 > _r_max)  { _r_max = temp1;  r_max_index = i; }
 		if(temp1 < _r_min)  { _r_min = temp1;  r_min_index = i; }
 		r_sum += temp1;
 
-		temp1 = (*ptr)[i].get_g_center();
+		temp1 = chord.get_g_center();
 		if(temp1 > _g_max)  { _g_max = temp1;  g_max_index = i; }
 		if(temp1 < _g_min)  { _g_min = temp1;  g_min_index = i; }
 		g_sum += temp1;
 
-		temp1 = (*ptr)[i].get_span();
+		temp1 = chord.get_span();
 		if(temp1 > _s_max)  { _s_max = temp1;  s_max_index = i; }
 		if(temp1 < _s_min)  { _s_min = temp1;  s_min_index = i; }
 		s_sum += temp1;
@@ -1185,43 +1813,43 @@ void Chord::print_stats()
 		if( !(continual && i == 0) )
 		{
 			if(continual)
-				temp2 = (*ptr)[i].get_chroma_old() - (*ptr)[i - 1].get_chroma_old();
-			else  temp2 = (*ptr)[i].get_chroma_old() - chroma_old;
+				temp2 = chord.get_chroma_old() - record[i - 1].get_chroma_old();
+			else  temp2 = chord.get_chroma_old() - chroma_old;
 			if(temp2 > dt_max)  { _kk_max = temp2;  kk_max_index = i; }
 			if(temp2 < dt_min)  { _kk_min = temp2;  kk_min_index = i; }
 			kk_sum += temp2;
 
 			if(continual)
-				temp2 = (*ptr)[i].get_tension() - (*ptr)[i - 1].get_tension();
-			else  temp2 = (*ptr)[i].get_tension() - tension;
+				temp2 = chord.get_tension() - record[i - 1].get_tension();
+			else  temp2 = chord.get_tension() - tension;
 			if(temp2 > dt_max)  { dt_max = temp2;  dt_max_index = i; }
 			if(temp2 < dt_min)  { dt_min = temp2;  dt_min_index = i; }
 			dt_sum += temp2;
 
 			if(continual)
-				temp1 = (*ptr)[i].get_root() - (*ptr)[i - 1].get_root();
-			else  temp1 = (*ptr)[i].get_root() - root;
+				temp1 = chord.get_root() - record[i - 1].get_root();
+			else  temp1 = chord.get_root() - root;
 			if(temp1 > dr_max)  { dr_max = temp1;  dr_max_index = i; }
 			if(temp1 < dr_min)  { dr_min = temp1;  dr_min_index = i; }
 			dr_sum += temp1;
 
 			if(continual)
-				temp1 = (*ptr)[i].get_g_center() - (*ptr)[i - 1].get_g_center();
-			else  temp1 = (*ptr)[i].get_g_center() - g_center;
+				temp1 = chord.get_g_center() - record[i - 1].get_g_center();
+			else  temp1 = chord.get_g_center() - g_center;
 			if(temp1 > dg_max)  { dg_max = temp1;  dg_max_index = i; }
 			if(temp1 < dg_min)  { dg_min = temp1;  dg_min_index = i; }
 			dg_sum += temp1;
 
 			if(continual)
-				temp1 = (*ptr)[i].get_span() - (*ptr)[i - 1].get_span();
-			else  temp1 = (*ptr)[i].get_span() - span;
+				temp1 = chord.get_span() - record[i - 1].get_span();
+			else  temp1 = chord.get_span() - span;
 			if(temp1 > ds_max)  { ds_max = temp1;  ds_max_index = i; }
 			if(temp1 < ds_min)  { ds_min = temp1;  ds_min_index = i; }
 			ds_sum += temp1;
 
 			if(continual)
-				temp1 = (*ptr)[i].get_s_size() - (*ptr)[i - 1].get_s_size();
-			else  temp1 = (*ptr)[i].get_s_size() - s_size;
+				temp1 = chord.get_s_size() - record[i - 1].get_s_size();
+			else  temp1 = chord.get_s_size() - s_size;
 			if(temp1 > dn_max)  { dn_max = temp1;  dn_max_index = i; }
 			if(temp1 < dn_min)  { dn_min = temp1;  dn_min_index = i; }
 			dn_sum += temp1;
@@ -1399,6 +2027,7 @@ void Chord::print_stats()
 
 void Chord::print_end()
 {
+	tflush();
 	if(language == Chinese)
 	{
 		fout << "分析报告结果指标说明：\n"
@@ -1410,13 +2039,88 @@ void Chord::print_end()
 			  << "【星号注解】* - 等音记谱（色值溢出）； ** - 等音记谱（色差溢出）。\n\n";
 	}
 	fout << "==========\n";
-	print_stats();
+	{
+		StageTimer timer(stage_stats[StageStats]);
+		print_stats();
+	}
 	end = clock();
 	double dur = (double) (end - begin) / CLOCKS_PER_SEC;
 	if(language == English)
 		fout << "\nGeneration completed in " << fixed << setprecision(2) << dur << " seconds.";
 	else  fout << "\n本次生成耗时 " << fixed << setprecision(2) << dur << " 秒。";
-	fout.close();
+}
+
+void Chord::reset_metrics(const Stage& first)
+// clears the stages from 'first' on; 'Main' keeps those of the database and the initial chord,
+// which are timed by the caller before it
+{
+	for(int i = first; i < STAGE_COUNT; ++i)
+		stage_stats[i] = StageStat{0.0, 0, 0, 0, 0, 0};
+	timing = false;
+	main_time = now_seconds();
+	main_allocations = allocation_count;
+}
+
+void Chord::print_metrics()
+// Writes the time, calls, chords in and out and heap allocations of each stage as the footer of the
+// text report (after the line 'METRICS_HEAD'), and to '<output name>.metrics.json' if 'metrics_file'.
+// Only 1 in 'METRICS_SAMPLE' candidates is timed through the filters (see 'lap'), so the time and
+// allocations of the filters are scaled up to all the candidates. Allocations are only counted by
+// programs replacing 'operator new' (see 'allocation_count').
+{
+	static const char* const names[STAGE_COUNT] = {"database", "initial chord", "expansion", "enumeration",
+		"filter: order and range", "filter: alignment", "filter: exclusion", "filter: pedal", "filter: chord",
+		"filter: scale and library", "filter: voice leading", "filter: duplicates",
+		"percentile", "sorting", "text output", "MIDI output", "stats"};
+	StageStat stats[STAGE_COUNT + 1];
+	for(int i = 0; i < STAGE_COUNT; ++i)
+		stats[i] = stage_stats[i];
+	long long in = stats[StageEnumeration].in;
+	for(int i = FilterOrder; i <= FilterDuplicate; ++i)
+	{
+		StageStat& stat = stats[i];
+		if(stat.calls > 0)
+		{
+			stat.seconds *= (double)in / stat.calls;
+			stat.allocations = (double)stat.allocations * in / stat.calls;
+		}
+		stat.calls = stat.in = in;
+		stat.out = in -= stat.rejected;
+	}
+	StageStat& total = stats[STAGE_COUNT];
+	total = StageStat{now_seconds() - main_time, 1, stats[StageEnumeration].in,
+							continual ? (long long)record.size() : c_size,
+							allocation_count - main_allocations, 0};
+	for(int i = StageDatabase; i <= StageInitial; ++i)
+	{
+		total.seconds += stats[i].seconds;
+		total.allocations += stats[i].allocations;
+	}
+
+	if(fout.is_open())
+	{
+		tflush();
+		fout << "\n\n" << METRICS_HEAD << "\nstage\tseconds\tcalls\tin\tout\tallocations\n";
+		for(int i = 0; i <= STAGE_COUNT; ++i)
+			fout << (i == STAGE_COUNT ? "total" : names[i]) << '\t' << fixed << setprecision(6) << stats[i].seconds
+				  << '\t' << stats[i].calls << '\t' << stats[i].in << '\t' << stats[i].out << '\t' << stats[i].allocations << '\n';
+		fout.close();
+	}
+	if(!metrics_file)  return;
+
+	char name[300];
+#ifdef QT_CORE_LIB
+	snprintf(name, 300, "%s%s.metrics.json", output_path, ((QString)output_name).toLocal8Bit().data());
+#else
+	snprintf(name, 300, "%s%s.metrics.json", output_path, output_name);
+#endif
+	ofstream file(name, ios::trunc);
+	file << "{\"stages\": [";
+	for(int i = 0; i <= STAGE_COUNT; ++i)
+		file << (i == 0 ? "" : ",") << "\n  {\"stage\": \"" << (i == STAGE_COUNT ? "total" : names[i])
+			  << "\", \"seconds\": " << fixed << setprecision(6) << stats[i].seconds << ", \"calls\": " << stats[i].calls
+			  << ", \"in\": " << stats[i].in << ", \"out\": " << stats[i].out << ", \"allocations\": " << stats[i].allocations << "}";
+	file << "\n], \"sample\": " << METRICS_SAMPLE << "}\n";
 }
 
 void Chord::to_midi()
@@ -1426,53 +2130,30 @@ void Chord::to_midi()
 // The first track contains some information including title, tempo and copyright,
 // the second track contains non-pedal notes, and the third track contains pedal notes.
 {
-	int chord_count, note_count = 0;
+	StageTimer timer(stage_stats[StageMidi]);
+	if(!continual && c_size != 0 && new_chords.empty())
+	// The chords have been added by 'merge_runs'.
+	{
+		midi_flush();
+		return;
+	}
+	midi_head();
 	if(continual)
 	{
+		int chord_count = record.size();
 		if(!enable_pedal || !connect_pedal)
 		{
-			chord_count = record.size();
-			for(int i = 0; i < chord_count; ++i)
-				note_count += record[i].get_t_size();
-			midi_head(chord_count, note_count);
 			for(int i = 0; i < chord_count; ++i)
 				chord_to_midi(record[i].get_notes());
 		}
 		else
 		{
-			char str1[19] = "\x4D\x54\x68\x64\x00\x00\x00\x06\x00\x01\x00\x03\x01\xE0\x4D\x54\x72\x6B";
-			m_fout.write(str1, 18);
-			int _len = swapInt(74);
-			m_fout.write((char*)&_len, sizeof(int));
-			char str2[79] = { "\x00\xFF\x02\x21\x28\x63\x29\x20\x32\x30\x32\x30\x20\x57\x65\x6E\x67\x65\x20\x43\x68\x65\x6E\x2C\x20\x4A"
-									"\x69\x2D\x77\x6F\x6F\x6E\x20\x53\x69\x6D\x2E\x00\xFF\x04\x05\x50\x69\x61\x6E\x6F\x00\xFF\x51\x03\x0F\x42\x40"
-									"\x00\xFF\x58\x04\x04\x02\x18\x08\x00\xFF\x59\x02\x00\x00\x00\xC0\x00\x00\xFF\x2F\x00\x4D\x54\x72\x6B"};
-			m_fout.write(str2, 78);
-
-			chord_count = record.size();
+			midi_track();
 			for(int i = 0; i < chord_count; ++i)
-				note_count += (record[i].get_t_size() - record[i].pedal_notes.size());
-			_len = swapInt(8 * note_count + chord_count + 4);
-			m_fout.write((char*)&_len, sizeof(int));
-	
-			for(int i = 0; i < chord_count; ++i)
-			{
-				vector<int> non_pedal = get_complement(record[i].get_notes(), record[i].pedal_notes);
-				chord_to_midi(non_pedal);
-			}
-			m_fout.write("\x00\xFF\x2F\x00\x4D\x54\x72\x6B", 8);
-			
-			// Please refer to the function 'chord_to_midi' in the file 'functions'.
-			if(in_bass)  period = chord_count;
-			int group_count = ceil(record.size() / period);
-			int addition = ((period > 34) ? 2 : 1) * group_count;
-			if(period > 34 && chord_count % period <= 34)  --addition;
-			note_count = 0;
-			for(int i = 0; i < chord_count; i += period)
-				note_count += record[i].pedal_notes.size();
-			_len = swapInt(8 * note_count + addition + 4);
-			m_fout.write((char*)&_len, sizeof(int));
+				chord_to_midi(get_complement(record[i].get_notes(), record[i].pedal_notes));
 
+			midi_track();
+			if(in_bass)  period = chord_count;
 			for(int i = 0; i < chord_count; i += period)
 			{
 				int beat = period;
@@ -1484,33 +2165,22 @@ void Chord::to_midi()
 	}
 	else
 	{
-		if(interlace)
-		{
-			chord_count = 2 * c_size;
-			for(int i = 0; i < c_size; ++i)
-				note_count += new_chords[i].get_t_size();
-			note_count += (c_size * t_size);
-			midi_head(chord_count, note_count);
-			for(int i = 0; i < c_size; ++i)
-			{
-				chord_to_midi(notes);
-				chord_to_midi(new_chords[i].get_notes());
-			}
-		}  
-		else
+		if(!interlace)  chord_to_midi(notes);
+		for(int i = 0; i < c_size; ++i)
 		{
-			chord_count = c_size + 1;
-			for(int i = 0; i < c_size; ++i)
-				note_count += new_chords[i].get_t_size();
-			note_count += t_size;
-			midi_head(chord_count, note_count);
-			chord_to_midi(notes);
-			for(int i = 0; i < c_size; ++i)
-				chord_to_midi(new_chords[i].get_notes());
+			if(interlace)  chord_to_midi(notes);
+			chord_to_midi(new_chords[i].get_notes());
 		}
 	}
-	m_fout.write("\x00\xFF\x2F\x00", 4);
-	m_fout.close();
+	midi_flush();
+}
+
+void Chord::to_export(const ChordData& chord)
+// exports a result (or the initial chord, if 'chord' is '*this') in 'export_format'
+{
+	ResultRecord record;
+	set_record(chord, record);
+	export_result(export_format, record);
 }
 
 void Chord::check_initial()
@@ -1692,16 +2362,29 @@ void Chord::Main()
 		fout.open(name1, ios::trunc);
 	if(output_mode != TextOnly)
 		m_fout.open(name2, ios::trunc | ios::binary);
+	if(export_format != NoExport)
+	{
+		const char ext[4][7] = {"", ".cnr", ".csv", ".jsonl"};
+		strcpy(name1, output_path);
+		strcat(name1, name3);
+		strcat(name1, ext[export_format]);
+		e_fout.open(name1, ios::trunc | ios::binary);
+		export_head(export_format);
+	}
 	record.clear();
+	record_keys.clear();
 	rec_id.clear();
 
 	similarity = MINF;
 	sv = MINF;
 	common_note = MINF;
+	reset_metrics(StageExpansion);
 	set_max_count();
 	set_expansion_indexes();
 	init( static_cast<ChordData&>(*this) );
 	printInitial(language);
+	tflush();
+	if(export_format != NoExport)  to_export(*this);
 	if(language == English)
 		fout << "Results:\n";
 	else  fout << "生成结果：\n";
@@ -1710,16 +2393,86 @@ void Chord::Main()
 	{
 		for(progr_count = 1; progr_count <= loop_count; ++progr_count)
 		{
-			if(language == English)
-				fout << "Progression #" << progr_count << ":\n";
-			else  fout << "和弦进行 #" << progr_count << ":\n";
+			if(output_mode != MidiOnly)
+			{
+				tprint((language == English) ? "Progression #" : "和弦进行 #");
+				tprint(progr_count);
+				tprint(":\n");
+			}
 			get_progression();
 		}
 	}
 	else  get_progression();
-	if(fout.is_open())
+	if(continual && fout.is_open())
 		print_end();
 	if(output_mode != TextOnly)  to_midi();
+	print_metrics();
+	if(e_fout.is_open())  export_end();
+	wait_writer();
+}
+
+void Chord::run_shard()
+// Tests part #'shard_index' of the candidates of single mode, split into 'shard_count' ranges of about
+// the same size, and writes the results (unsorted and unfiltered) to a partial file instead of the output.
+// The shards may run as separate processes, e.g. on different computers; once every partial file is in
+// the output folder, 'Main' with 'shard_mode' MergeShards gives the same output as a run without shards.
+// The partial file is written under a temporary name and renamed once complete, so that a merge
+// never reads a part still being written.
+{
+	if(continual)
+	{
+		if(language == English)
+			throw "ERROR - only single mode can be sharded, as each progression of continual mode depends on the previous one.";
+		else  throw "错误：只有单步模式可以分片运行，因为连续模式的每个和弦进行都取决于前一个。";
+	}
+	begin = clock();
+	record.clear();
+	record_keys.clear();
+	rec_id.clear();
+
+	similarity = MINF;
+	sv = MINF;
+	common_note = MINF;
+	reset_metrics(StageExpansion);
+	set_max_count();
+	set_expansion_indexes();
+	init( static_cast<ChordData&>(*this) );
+
+	char name[300], temp_name[310];
+	vector<double> fp;
+	set_gen_fingerprint(fp);
+	set_shard_name(name, output_name, shard_index);
+	snprintf(temp_name, sizeof(temp_name), "%s.tmp", name);
+	fout.open(temp_name, ios::trunc | ios::binary);
+	if(!fout.is_open())
+	{
+		if(language == English)
+			throw "ERROR - failed to write to the output folder. Please check the output path.";
+		else  throw "错误：无法写入输出文件夹。请检查输出路径。";
+	}
+	shard_buffer.clear();
+	write_shard_head(shard_buffer, fp, shard_index);
+	try
+	{
+		get_progression();
+		shard_buffer.append((const char*)&c_size, sizeof(int));
+		write_async(fout, shard_buffer, true);
+		wait_writer();
+	}
+	catch(...)
+	{
+		wait_writer();
+		if(fout.is_open())  fout.close();
+		remove(temp_name);
+		throw;
+	}
+	if(!replace_file(temp_name, name))
+	{
+		remove(temp_name);
+		if(language == English)
+			throw "ERROR - failed to write to the output folder. Please check the output path.";
+		else  throw "错误：无法写入输出文件夹。请检查输出路径。";
+	}
 }
 
 void Chord::find_vec(Chord& new_chord, bool in_analyser, bool in_substitution)
@@ -1774,50 +2527,38 @@ void Chord::find_vec(Chord& new_chord, bool in_analyser, bool in_substitution)
 }
 
 #ifdef QT_CORE_LIB
-void Chord::set_est_time(const int& value, bool in_substitution)
-{	
-	const int MAX = in_substitution ? prgdialog_sub -> maximum() : prgdialog -> maximum();
-	static double  prev[9] = {0, 0, 0, 0, 0, 0, 0, 0, 0};
-	const double weight[9] = {1, 1, 1.5, 1.5, 1.5, 2, 2, 2, 1.5};
-	// To avoid huge fluctuation, we will calculate weighted mean with previous remaining times.
-	// However, the array itself is given somewhat randomly.
-	if(value == MAX)
-	{
-		for(int i = 0; i < 9; ++i)
-			prev[i] = 0;
-		return;
-	}
-
-	double dur;
-	if(in_substitution)
-	{
-		end_sub = clock();
-		dur = (end_sub - begin_loop_sub) / CLOCKS_PER_SEC;
-	}
-	else
-	{
-		end = clock();
-		dur = (end - begin_progr) / CLOCKS_PER_SEC;
-	}
+void Chord::begin_progress(const int& maximum, bool timed)
+// Starts a new stage of the job: the progress goes back to 0 and the texts are cleared.
+// If 'timed' is set, the remaining time of the stage is estimated from now on.
+{
+	lock_guard<mutex> guard(progress -> lock);
+	progress -> label.clear();
+	progress -> detail.clear();
+	progress -> value = 0;
+	progress -> items = 0;
+	progress -> maximum = maximum;
+	progress -> timed = timed;
+	++progress -> stage;
+}
 
-	double rem = (double)dur / (value + 1.0) * (MAX - value)
-					 * ( ( value + 2 * MAX ) / ( 2 * value + MAX ) );
-	// The last term is a modification. At first it is 2 and it gradually drops to 1.
-	// This is set because the speed of the program becomes slower when the size of 'new_chord' grows up.
-	double weighted_rem = rem;
-	for(int i = 0; i < 9; ++i)
-	{
-		if(prev[i] == 0)
-			weighted_rem += rem * weight[i];
-		else  weighted_rem += prev[i] * weight[i];
-	}
+void Chord::set_progress_text(const QString& label, const QString& detail)
+{
+	lock_guard<mutex> guard(progress -> lock);
+	progress -> label = label;
+	progress -> detail = detail;
+}
 
-	weighted_rem /= 15.0;
-	for(int i = 0; i <= 7; ++i)
-		prev[i] = prev[i + 1];
-	prev[8] = weighted_rem;
+void Chord::end_progress(const QString& label)
+// The stage is completed; only 'label' is shown from now on.
+{
+	set_progress_text(label);
+	progress -> value = (int)progress -> maximum;
+}
 
-	long long _rem = floor(weighted_rem);
+QString Chord::time_text(const double& seconds)
+// e.g. "1 hr 5 mins", "3 mins 20 secs"
+{
+	long long _rem = floor(seconds);
 	int sec = _rem % 60;
 	int min =(_rem / 60) % 60;
 	long long hour = _rem / 3600;
@@ -1853,19 +2594,38 @@ void Chord::set_est_time(const int& value, bool in_substitution)
 		time = time + ' ' + str1.setNum(min) + str_min[language];
 		if(language == English && min  > 1)  time += 's';
 	}
+	return time;
+}
+
+QString Chord::count_text(const double& count)
+// e.g. "950", "12.5k", "3.2M"
+{
+	QString str;
+	if(count >= 1E9)  return str.setNum(count / 1E9, 'f', 1) + 'G';
+	if(count >= 1E6)  return str.setNum(count / 1E6, 'f', 1) + 'M';
+	if(count >= 1E3)  return str.setNum(count / 1E3, 'f', 1) + 'k';
+	return str.setNum((int)round(count));
+}
 
+QString Chord::est_time(const int& maximum)
+// the remaining time and the throughput of the stage, from 'est'
+{
+	const double seconds = remaining_time(est, maximum);
+	if(seconds < 0)  return "";
+	QString time = time_text(seconds);
 	QStringList str3 = {" (Estimated remaining time: ", " （预计剩余时间："};
 	QStringList str4 = {") ", "） "};
-	if(in_substitution)
-		labeltext_sub = labeltext_sub + str3[language]+ time + str4[language];
-	else  labeltext = labeltext + str3[language]+ time + str4[language];
+	if(est.item_rate >= 1)
+	{
+		QStringList str5 = {"; ", "；"};
+		QStringList str6 = {" candidates/s", " 个/秒"};
+		time = time + str5[language] + count_text(est.item_rate) + str6[language];
+	}
+	return str3[language] + time + str4[language];
 }
 
-void Chord::abort(bool in_substitution)
+void Chord::abort()
 {
-	if(in_substitution)
-		set_est_time(prgdialog_sub -> maximum(), true);
-	else  set_est_time(prgdialog -> maximum(), false);
 	if(language == English)
 		throw "The generation is aborted.";
 	else  throw "生成已中止。";
@@ -11,9 +11,13 @@
 #include <vector>
 
 #include "chorddata.h"
+#include "functions.h"
 #ifdef QT_CORE_LIB
-	#include <QApplication>
-	#include <QProgressDialog>
+	#include <atomic>
+	#include <mutex>
+	#include <QString>
+	#include <QStringList>
+	class QProgressDialog;
 #endif
 
 using std::vector;
@@ -22,7 +26,94 @@ enum OutputMode {Both, MidiOnly, TextOnly};
 enum UniqueMode {Disabled, RemoveDup, RemoveDupType};
 enum AlignMode  {Interval, List, Unlimited};
 enum VLSetting  {Percentage, Number, Default};
-enum SubstituteObj {Postchord, Antechord, BothChords};
+enum SubstituteObj {Postchord, Antechord, BothChords, Sequence};
+enum ShardMode  {NoShard, WriteShard, MergeShards};
+enum Stage {StageDatabase, StageInitial, StageExpansion, StageEnumeration,
+				FilterOrder, FilterAlignment, FilterExclusion, FilterPedal, FilterChord, FilterScale,
+				FilterVoiceLeading, FilterDuplicate,  // the filters of 'valid', in this order
+				StagePercentile, StageSort, StageText, StageMidi, StageStats, STAGE_COUNT};
+
+const int TOP_SUB_SIZE = 12; // number of substitutions previewed while searching
+const int CHECKPOINT_INTERVAL = 60; // seconds between two checkpoints of a BothChords search
+const int DEFAULT_MEMORY_BUDGET = 1024; // MB of results kept in memory in single mode; see 'spill_results'
+const char CHECKPOINT_MAGIC[5] = "CNCK";
+const char SHARD_MAGIC[5] = "CNSH";
+const double ESTIMATE_TIME = 0.5;      // seconds spent sampling candidates in 'estimate_cost'
+const int ESTIMATE_SAMPLES = 1 << 20;  // at most this many candidates are sampled
+const int METRICS_SAMPLE = 256; // 1 in this many candidates is timed through the filters (a power of 2); see 'lap'
+const char METRICS_HEAD[] = "[metrics]";  // begins the footer of the text report; see 'print_metrics'
+
+struct CostEstimate
+// what a run with the current settings is expected to cost; see 'estimate_cost'
+{
+	double candidates = 0;      // candidates (expansion and movement vector) tested in a progression
+	int    samples = 0;         // candidates tested for the estimate
+	double acceptance = 0;      // fraction of candidates giving a new result
+	double candidate_time = 0;  // seconds per candidate
+	double seconds = 0;         // runtime of the whole run
+	double results = 0;         // results of a progression
+	double memory = 0;          // peak memory of the results, in bytes
+	bool   spilled = false;     // The results will not fit into 'memory_budget' (see 'spill_results').
+};
+
+struct StageStat
+// Wall-clock time, calls, chords (or candidates) going in and out, and heap allocations of a stage
+// of a generation; see 'print_metrics'. There are no initial values, as the copies of 'Chord' made
+// for every candidate do not need them; see 'reset_metrics'.
+{
+	double seconds;
+	long long calls, in, out, allocations;
+	long long rejected;  // candidates rejected by a filter of 'valid'
+};
+
+struct StageTimer
+// Adds the time and the allocations of its lifetime (e.g. a block), or until 'stop', to a stage, as a call.
+{
+	StageStat& stat;
+	double begin_time;
+	long long begin_allocations;
+	bool running = true;
+	StageTimer(StageStat& _stat): stat(_stat), begin_time(now_seconds()), begin_allocations(allocation_count)
+	{ ++stat.calls; }
+	~StageTimer()  { stop(); }
+	void stop()
+	{
+		if(!running)  return;
+		running = false;
+		stat.seconds += now_seconds() - begin_time;
+		stat.allocations += allocation_count - begin_allocations;
+	}
+};
+
+struct JobState
+// The thread-local settings a job takes over from the thread that starts it; see 'save_job_state'.
+{
+	vector<int> omission[8];
+	vector<int> chord_library;
+	vector<vector<int>> alignment_list;
+	VoicingSet alignment_keys;
+	vector<int> rm_priority;
+	vector<int> overall_scale;
+};
+
+#ifdef QT_CORE_LIB
+const int PROGRESS_INTERVAL = 100; // milliseconds between two updates of a progress dialog
+
+struct JobProgress
+// Progress of a job running on a worker thread (see 'Interface::run_job').
+// The job only stores values here; the GUI thread reads them and updates the progress dialog.
+{
+	std::atomic<bool> canceled{false};
+	std::atomic<int>  value{0};
+	std::atomic<int>  maximum{100};
+	std::atomic<long long> items{0}; // candidates tested in this stage
+	std::atomic<int>  stage{0};      // increased by 'begin_progress'
+	std::atomic<bool> timed{false};  // The remaining time of the stage is estimated.
+	std::mutex lock;
+	QString label;   // shown before the estimated time; guarded by 'lock'
+	QString detail;  // shown after it; guarded by 'lock'
+};
+#endif
 
 struct intervalData
 {
@@ -33,6 +124,14 @@ struct intervalData
 	int num_max;
 };
 
+struct subIndexEntry
+// single-chord parameters of a set in chord substitution
+{
+	double tension;
+	int root;
+	int id;
+};
+
 class Chord: public ChordData
 {
 protected:
@@ -41,6 +140,12 @@ protected:
 	char output_name[100];
 	bool continual;
 	OutputMode output_mode;
+	ExportFormat export_format;
+	int  memory_budget; // in MB
+	bool quiet = false; // no progress on the console (without Qt), e.g. for jobs running side by side
+	ShardMode shard_mode = NoShard; // see 'run_shard'
+	bool metrics_file = false; // 'print_metrics' also writes '<output name>.metrics.json'
+	int  shard_index = 1, shard_count = 1; // This run is part #'shard_index' of 'shard_count'.
 	int  loop_count;
 	bool m_unchanged;
 	bool nm_same;
@@ -87,8 +192,12 @@ protected:
 	// we have to apply the same rules to the chords in chord analysis.
 	char str_ante_notes[100];
 	char str_post_notes[100];
+	vector<vector<int>> seq_notes; // the progression in sequence substitution
+	char str_seq_notes[300];
 	int  sample_size;
+	unsigned long long sub_seed; // seed of the sample in chord substitution
 	bool test_all;
+	bool resume_sub; // Resume a BothChords search from its checkpoint (if there is one).
 	SubstituteObj object;
 	bool detailed_ref;
 	char output_name_sub[100];
@@ -144,8 +253,8 @@ protected:
 	double  p_min_sub,  p_max_sub;
 	double  q_min_sub,  q_max_sub;
 
-	clock_t begin, begin_progr, end;
-	clock_t begin_sub, begin_loop_sub, end_sub;
+	clock_t begin, end;
+	clock_t begin_sub, end_sub;
 	int exp_count;   // expansion counter
 	int progr_count; // progression counter
 	int c_size;      // size of new_chords
@@ -156,19 +265,41 @@ protected:
 	vector<int> rec_id; // contains 'set_id' of all 12 transpositions of 'note_set'
 	vector<long long> vec_ids; // contains the 'vec_id' of generated chords in a single progression
 	vector<ChordData> record;  // contains the generated chords in continual mode
+	VoicingSet record_keys;    // keys of the notes of 'record'
 	vector<ChordData> new_chords; // contains the generated chords in a single progression
+	long long memory_used;        // approximate memory taken by 'new_chords'
+	vector<string> spill_files;   // sorted runs of results spilled to disk in single mode
+	vector<double> run_chroma, run_chroma_old, run_tension;
+	// values of all spilled results, for the percentile ranges of 'k', 'kk' and 't'
+	MappedFile merged_run;        // the spilled results in their final order; see 'get_result'
+	string shard_buffer;          // results of a shard waiting to be written; see 'add_result'
+	const char* merged_pos;
+	ChordData merged_result;
 	vector<ChordData> record_ante; // contains antechords in substitutions
 	vector<ChordData> record_post; // contains postchords in substitutions
-	vector<vector<int>> sub_library; // Contains all possible chords for substitution.
+	vector<int> sub_library; // ids (see 'id_to_notes') of the sets for substitution; see 'sub_id'
+	StageStat stage_stats[STAGE_COUNT];
+	bool   timing;          // The candidate in 'valid' is one of those timed through the filters; see 'lap'.
+	double lap_time;        // when the last filter of the timed candidate ended
+	long long lap_allocations;
+	double main_time;       // when 'Main' began
+	long long main_allocations;
 
 	void set_max_count();
 	void init(ChordData&);
 	void set_param1();
 	void get_progression();
 	void expand(Chord&, const int&, const int&);
-	void set_new_chords(Chord&);
+	void set_new_chords(Chord&, const long long& first, const long long& last);
+	void add_result(const ChordData&);
 	void next(vector<int>&);
+	void estimate_cost(CostEstimate&);
+	double count_candidates(const vector<int>& result, const int& len);
 	bool valid(Chord&);
+	bool reject(const Stage&);
+	void lap(const Stage&);
+	void reset_metrics(const Stage& first = StageDatabase);
+	void print_metrics();
 	bool valid_alignment(Chord&);
 	bool valid_exclusion(Chord&);
 	bool include_pedal(Chord&);
@@ -183,13 +314,32 @@ protected:
 	bool valid_vec(Chord&);
 	bool valid_sim(Chord&);
 	void sort_results(vector<ChordData>&, bool);
+	bool better_result(const ChordData&, const ChordData&);
+	void spill_results();
+	void merge_runs();
+	void clear_runs();
+	void run_error();
+	void set_shard_name(char* name, const char* output, const int& index);
+	void write_shard_head(string& str, const vector<double>& fp, const int& index);
+	bool read_shard_head(const char*& pos, const MappedFile&, const vector<double>& fp, const int& index);
+	void set_gen_fingerprint(vector<double>&);
+	void read_shards();
+	void shard_error();
+	ChordData& get_result(const int&);
 	void print_single();
 	void print_continual();
 	void print_stats();
 	void print_end();
 	void to_midi();
+	void to_export(const ChordData&);
 	void check_initial();
 	void choose_initial();
+	bool read_preset(const char* filename, char title[][100], bool& scale_set);
+	void read_preset(std::istream&, char title[][100], bool& scale_set);
+	bool parse_chord(const char*, vector<int>&);
+	bool parse_exclusion();
+	bool parse_sim();
+	bool parse_sequence(const char*);
 
 public:
 	Chord();
@@ -199,6 +349,7 @@ public:
 	int& get_set_id();
 	void _set_vl_max(const int&);
 	void Main();
+	void run_shard();
 	// Used in utilities. This function is needed because 'similarity' is related to 'vl_max'.
 	void find_vec(Chord& new_chord, bool in_analyser = false, bool in_substitution = false);
 	// interface of '_find_vec'
@@ -207,19 +358,54 @@ public:
 protected:
 	QProgressDialog* prgdialog;
 	QProgressDialog* prgdialog_sub;
-	QString labeltext;
-	QString labeltext_sub;
-	void set_est_time(const int&, bool);
-	void abort(bool);
+	JobProgress* progress;     // shared by the job and the GUI thread
+	vector<ChordData> top_sub; // the best (at most 'TOP_SUB_SIZE') substitutions found so far, in the order of 'sort_order_sub'
+	bool sub_canceled;         // The user stopped the search early; the results found so far are kept.
+	RateEstimator est;         // throughput of the stage shown (see 'show_progress')
+	int est_stage = 0;         // 'progress -> stage' that 'est' belongs to
+	void begin_progress(const int& maximum, bool timed = true);
+	void set_progress(const int& value)  { progress -> value = value; }
+	void set_progress(const int& value, const long long& items)  { progress -> items = items;  progress -> value = value; }
+	void set_progress_text(const QString& label, const QString& detail = "");
+	void end_progress(const QString& label);
+	bool canceled()  { return progress -> canceled; }
+	void show_progress(QProgressDialog*);
+	QString est_time(const int& maximum);
+	QString time_text(const double& seconds);
+	QString count_text(const double&);
+	void abort();
 
 	void analyse();
 	void substitute();
+	void substitute_sequence();
+	void print_sub_sequence(const vector<int>& best_ids, bool found);
+	void add_sub_score(const vector<double>& score, ChordData& chord, vector<double>& result);
+	bool larger_score(const vector<double>&, const vector<double>&);
+	void set_sub_passed(Chord& antechord, Chord& postchord, vector<bool>& ante_passed, vector<bool>& post_passed);
 	void set_param_center();
 	void set_param_range();
 	void set_sub_library();
+	int  sub_id(const int&);
+	int  sub_pair_count();
+	static vector<subIndexEntry> sub_index[13];
+	// 'sub_index[n]' contains all n-note sets, sorted by tension.
+	// It is used to find the sets within the range of N, T and R without building their progressions.
+	static void set_sub_index();
+	void query_sub_index(vector<int>&);
 	bool valid_sub(Chord&, Chord&);
+	bool valid_sub_single(Chord&);
 	bool valid_single_chord(Chord&);
+	bool test_sub_pair(const int&, Chord&, Chord&);
+	void set_checkpoint_name(char*);
+	void set_sub_fingerprint(vector<double>&);
+	void save_checkpoint_sub(const int& cursor, const vector<int>& accepted);
+	bool load_checkpoint_sub(int& cursor, vector<int>& accepted);
+	void write_sub_shard(const int& first, const int& last, const vector<int>& accepted);
+	void read_sub_shards(int& cursor, vector<int>& accepted);
+	bool better_sub(const ChordData&, const ChordData&);
+	void update_top_sub(const ChordData&);
 	void print_sub();
+	void print_sub_conditions();
 	void print_stats_sub();
 	void to_midi_sub();
 #endif
@@ -227,6 +413,11 @@ protected:
 
 extern const double _tension[12];
 extern const int restriction[12];
-extern vector<int> overall_scale;
+extern thread_local vector<int> overall_scale;
+extern void save_job_state(JobState&);
+extern void load_job_state(const JobState&);
+extern int  read_data(std::istream&, char*, const int& size = 200);  // can read a string, bool or int from preset
+extern void read_vec(std::istream&, char*, vector<int>&);  // reads a vector from preset
+extern bool override_preset(std::string& text, const std::string& key, const std::string& value);
 
 #endif
@@ -7,7 +7,7 @@
 #include "chorddata.h"
 #include "functions.h"
 
-vector<int> rm_priority;
+thread_local vector<int> rm_priority;
 
 void ChordData::inverse_param()
 {
@@ -21,56 +21,58 @@ void ChordData::inverse_param()
 void ChordData::printInitial(Language language)
 {
 	if(language == English)
-		fprint("Initial chord: ", notes, " ", ", ");
-	else  fprint("起始和弦：", notes, " ", ", ");
-	fout << "(" << name << ")\n"
-		  << "t = " << fixed << setprecision(1) << round_double(tension, 1) << ",  "
-		  << "s = " << span << ",  ";
-	fprint("vec = ", count_vec, "\0", ",  ", false);
-	fprint("d = ", self_diff);
-	fout << "n = " << s_size << ",  "
-		  << "m = " << t_size << ",  "
-		  << "n/m = " << fixed << setprecision(2) << round_double((double)s_size / t_size, 2) << ",  "
-		  << "h = " << fixed << setprecision(2) << round_double(thickness, 2) << ",  "
-		  << "g = " << g_center << "%,  "
-		  << (language == Chinese ? "根音：" : "root: ") << root_name
-		  << " (r = " << root << ")\n\n";
+		tprint("Initial chord: ", notes, " ", ", ");
+	else  tprint("起始和弦：", notes, " ", ", ");
+	tprint("(");  tprint(name);  tprint(")\n");
+	tprint("t = ");  tprint(tension, 1);  tprint(",  ");
+	tprint("s = ");  tprint(span);  tprint(",  ");
+	tprint("vec = ", count_vec, "\0", ",  ", false);
+	tprint("d = ", self_diff);
+	tprint("n = ");  tprint(s_size);  tprint(",  ");
+	tprint("m = ");  tprint(t_size);  tprint(",  ");
+	tprint("n/m = ");  tprint((double)s_size / t_size, 2);  tprint(",  ");
+	tprint("h = ");  tprint(thickness, 2);  tprint(",  ");
+	tprint("g = ");  tprint(g_center);  tprint("%,  ");
+	tprint(language == Chinese ? "根音：" : "root: ");  tprint(root_name);
+	tprint(" (r = ");  tprint(root);  tprint(")\n\n");
+	tflush(false);
 }
 
 void ChordData::print(const ChordData& chord, Language language)
 {
-	fprint("-> ", chord.notes, " ", ", ");
-	fout << "(" << chord.name << ")";
+	tprint("-> ", chord.notes, " ", ", ");
+	tprint("(");  tprint(chord.name);  tprint(")");
 	switch(chord.overflow_state)
 	{
-		case Single:     fout << "*\n";   break;
-		case Total:      fout << "**\n";  break;
-		case NoOverflow: fout << "\n";    break;
+		case Single:     tprint("*\n");   break;
+		case Total:      tprint("**\n");  break;
+		case NoOverflow: tprint("\n");    break;
 	}
-	fout << "k = " << fixed << setprecision(1) << round_double(chord.chroma, 1) << ",  "
-		  << "kk = " << fixed << setprecision(2) << round_double(chord.chroma_old - chord.prev_chroma_old, 2) << ",  "
-		  << "c = " << chord.common_note << ",  "
-		  << "ss = " << chord.sspan << ",  "
-		  << "sv = " << chord.sv << ",  ";
-	fprint("v = ", chord.vec);
-	fout << "t = " << fixed << setprecision(1) << round_double(chord.tension, 1) << ",  "
-		  << "s = " << chord.span << ",  ";
-	fprint("vec = ", chord.count_vec, "\0", ",  ", false);
-	fprint("d = ", chord.self_diff);
-	fout << "n = " << chord.s_size << ",  "
-		  << "m = " << chord.t_size << ",  "
-		  << "n/m = " << fixed << setprecision(2) << round_double((double)chord.s_size / chord.t_size, 2) << ",  "
-		  << "h = " << fixed << setprecision(2) << round_double(chord.thickness, 2) << ",  "
-		  << "g = " << chord.g_center << "%,  "
-		  << (language == Chinese ? "根音：" : "root: ") << chord.root_name
-		  << " (r = " << chord.root << ")\n";
-	fout << "Q = " << fixed << setprecision(1) << round_double(chord.Q_indicator, 1) << ",  "
-		  << "x = " << chord.similarity << "%,  "
-		  << "dr = " << chord.root - root << ",  "
-		  << "dn = " << chord.s_size - s_size << ",  "
-		  << "dt = " << fixed << setprecision(1) << round_double(chord.tension - tension, 1) << ",  "
-		  << "ds = " << chord.span - span << ",  "
-		  << "dg = " << chord.g_center - g_center << "%\n\n";
+	tprint("k = ");  tprint(chord.chroma, 1);  tprint(",  ");
+	tprint("kk = ");  tprint(chord.chroma_old - chord.prev_chroma_old, 2);  tprint(",  ");
+	tprint("c = ");  tprint(chord.common_note);  tprint(",  ");
+	tprint("ss = ");  tprint(chord.sspan);  tprint(",  ");
+	tprint("sv = ");  tprint(chord.sv);  tprint(",  ");
+	tprint("v = ", chord.vec);
+	tprint("t = ");  tprint(chord.tension, 1);  tprint(",  ");
+	tprint("s = ");  tprint(chord.span);  tprint(",  ");
+	tprint("vec = ", chord.count_vec, "\0", ",  ", false);
+	tprint("d = ", chord.self_diff);
+	tprint("n = ");  tprint(chord.s_size);  tprint(",  ");
+	tprint("m = ");  tprint(chord.t_size);  tprint(",  ");
+	tprint("n/m = ");  tprint((double)chord.s_size / chord.t_size, 2);  tprint(",  ");
+	tprint("h = ");  tprint(chord.thickness, 2);  tprint(",  ");
+	tprint("g = ");  tprint(chord.g_center);  tprint("%,  ");
+	tprint(language == Chinese ? "根音：" : "root: ");  tprint(chord.root_name);
+	tprint(" (r = ");  tprint(chord.root);  tprint(")\n");
+	tprint("Q = ");  tprint(chord.Q_indicator, 1);  tprint(",  ");
+	tprint("x = ");  tprint(chord.similarity);  tprint("%,  ");
+	tprint("dr = ");  tprint(chord.root - root);  tprint(",  ");
+	tprint("dn = ");  tprint(chord.s_size - s_size);  tprint(",  ");
+	tprint("dt = ");  tprint(chord.tension - tension, 1);  tprint(",  ");
+	tprint("ds = ");  tprint(chord.span - span);  tprint(",  ");
+	tprint("dg = ");  tprint(chord.g_center - g_center);  tprint("%\n\n");
+	tflush(false);
 }
 
 void ChordData::print_analysis(const ChordData& antechord, const ChordData& postchord,
@@ -140,12 +142,12 @@ void ChordData::print_substitution(const char* param, bool print_ante, bool prin
 {
 	if( !(print_ante || print_post) )  return;
 
-	fout << "(" << antechord.name << ") -> (" << postchord.name << ")";
+	tprint("(");  tprint(antechord.name);  tprint(") -> (");  tprint(postchord.name);  tprint(")");
 	switch(postchord.overflow_state)
 	{
-		case Single:     fout << "*";   break;
-		case Total:      fout << "**";  break;
-		case NoOverflow: fout << "";    break;
+		case Single:     tprint("*");   break;
+		case Total:      tprint("**");  break;
+		case NoOverflow: break;
 	}
 
 	const ChordData* pChord = (print_post ? &postchord : &antechord);
@@ -153,57 +155,208 @@ void ChordData::print_substitution(const char* param, bool print_ante, bool prin
 	if( !(print_ante && print_post) )
 	{
 		if(strchr(param, var[2]) != nullptr)
-			fout << ",  t = " << fixed << setprecision(1) << round_double(pChord -> tension, 1);
+		{  tprint(",  t = ");  tprint(pChord -> tension, 1);  }
 		if(strchr(param, var[5]) != nullptr)
-			fout << ",  s = " << pChord -> span;
+		{  tprint(",  s = ");  tprint(pChord -> span);  }
 		if(strchr(param, var[1]) != nullptr)
-			fout << ",  n = " << pChord -> s_size;
+		{  tprint(",  n = ");  tprint(pChord -> s_size);  }
 		if(strchr(param, var[14]) != nullptr || strchr(param, var[15]) != nullptr)
-			fout << (language == Chinese ? ",  根音：" : ",  root: ") << pChord -> root_name
-				  << " (r = " << pChord -> root << ")";
+		{
+			tprint(language == Chinese ? ",  根音：" : ",  root: ");  tprint(pChord -> root_name);
+			tprint(" (r = ");  tprint(pChord -> root);  tprint(")");
+		}
 	}
 	else
 	{
 		if(strchr(param, var[2]) != nullptr)
-			fout << ",  t_a = " << fixed << setprecision(1) << round_double(antechord.tension, 1)
-				  << ",  t_b = " << fixed << setprecision(1) << round_double(postchord.tension, 1);
+		{
+			tprint(",  t_a = ");  tprint(antechord.tension, 1);
+			tprint(",  t_b = ");  tprint(postchord.tension, 1);
+		}
 		if(strchr(param, var[5]) != nullptr)
-			fout << ",  s_a = " << antechord.span << ",  s_b = " << postchord.span;
+		{
+			tprint(",  s_a = ");  tprint(antechord.span);
+			tprint(",  s_b = ");  tprint(postchord.span);
+		}
 		if(strchr(param, var[1]) != nullptr)
-			fout << ",  n_a = " << antechord.s_size << ", n_b = " << postchord.s_size;
+		{
+			tprint(",  n_a = ");  tprint(antechord.s_size);
+			tprint(", n_b = ");   tprint(postchord.s_size);
+		}
 		if(strchr(param, var[14]) != nullptr || strchr(param, var[15]) != nullptr)
-			fout << (language == Chinese ? ",  根音（前）：" : ",  root_a: ") << antechord.root_name
-				  << " (r_a = " << antechord.root << ")"
-				  << (language == Chinese ? ",  根音（后）：" : ",  root_b: ") << postchord.root_name
-				  << " (r_b = " << postchord.root << ")";
+		{
+			tprint(language == Chinese ? ",  根音（前）：" : ",  root_a: ");  tprint(antechord.root_name);
+			tprint(" (r_a = ");  tprint(antechord.root);  tprint(")");
+			tprint(language == Chinese ? ",  根音（后）：" : ",  root_b: ");  tprint(postchord.root_name);
+			tprint(" (r_b = ");  tprint(postchord.root);  tprint(")");
+		}
 	}
 
 	if(strchr(param, var[3]) != nullptr)
-		fout << ",  k = " << fixed << setprecision(1) << round_double(pChord -> chroma, 1);
+	{  tprint(",  k = ");  tprint(pChord -> chroma, 1);  }
 	if(strchr(param, var[13]) != nullptr)
-		fout << ",  kk = " << fixed << setprecision(2) << round_double(pChord -> chroma_old - pChord -> prev_chroma_old, 2);
+	{  tprint(",  kk = ");  tprint(pChord -> chroma_old - pChord -> prev_chroma_old, 2);  }
 	if(strchr(param, var[4]) != nullptr)
-		fout << ",  c = " << pChord -> common_note;
+	{  tprint(",  c = ");  tprint(pChord -> common_note);  }
 	if(strchr(param, var[5]) != nullptr)
-		fout << ",  ss = " << pChord -> sspan;
+	{  tprint(",  ss = ");  tprint(pChord -> sspan);  }
 	if(strchr(param, var[10]) != nullptr)
-		fout << ",  sv = " << pChord -> sv;
+	{  tprint(",  sv = ");  tprint(pChord -> sv);  }
 	if(strchr(param, var[11]) != nullptr)
-		fout << ",  Q = " << fixed << setprecision(1) << round_double(pChord -> Q_indicator, 1);
+	{  tprint(",  Q = ");  tprint(pChord -> Q_indicator, 1);  }
 	if(strchr(param, var[12]) != nullptr)
-		fout << ",  x = " << pChord -> similarity << "%";
+	{  tprint(",  x = ");  tprint(pChord -> similarity);  tprint("%");  }
 	if(strchr(param, var[0]) != nullptr)
-		fout << ",  p = " << pChord -> sim_orig << "%";
+	{  tprint(",  p = ");  tprint(pChord -> sim_orig);  tprint("%");  }
 
 	if(strchr(param, var[14]) != nullptr)
-		fout << ",  dr = " << postchord.root - antechord.root;
+	{  tprint(",  dr = ");  tprint(postchord.root - antechord.root);  }
 	if(strchr(param, var[1]) != nullptr)
-		fout << ",  dn = " << postchord.s_size - antechord.s_size;
+	{  tprint(",  dn = ");  tprint(postchord.s_size - antechord.s_size);  }
 	if(strchr(param, var[2]) != nullptr)
-		fout << ",  dt = " << fixed << setprecision(1) << round_double(postchord.tension - antechord.tension, 1);
+	{  tprint(",  dt = ");  tprint(postchord.tension - antechord.tension, 1);  }
 	if(strchr(param, var[5]) != nullptr)
-		fout << ",  ds = " << postchord.span - antechord.span;
-	fout << endl;
+	{  tprint(",  ds = ");  tprint(postchord.span - antechord.span);  }
+	tprint("\n");
+	tflush(false);
+}
+
+void ChordData::set_record(const ChordData& chord, ResultRecord& record) const
+{
+	record.notes = chord.notes;
+	record.vec = chord.vec;
+	const double param[RESULT_FIELD_COUNT] =
+	{ chord.chroma, chord.chroma_old - chord.prev_chroma_old, (double)chord.common_note, (double)chord.sspan,
+	  (double)chord.sv, chord.tension, (double)chord.span, (double)chord.s_size, (double)chord.t_size,
+	  chord.thickness, (double)chord.g_center, (double)chord.root, chord.Q_indicator, (double)chord.similarity,
+	  (double)chord.sim_orig, (double)(chord.root - root), (double)(chord.s_size - s_size),
+	  chord.tension - tension, (double)(chord.span - span), (double)(chord.g_center - g_center),
+	  (double)chord.overflow_state };
+	for(int i = 0; i < RESULT_FIELD_COUNT; ++i)
+		record.param[i] = param[i];
+
+	if(&chord == this)
+	// the initial chord: there is no progression into it
+	{
+		record.vec.clear();
+		const int progression_fields[8] = {0, 1, 2, 3, 4, 12, 13, 14};  // k, kk, c, ss, sv, Q, x, p
+		for(int i = 0; i < 8; ++i)
+			record.param[progression_fields[i]] = 0;
+	}
+}
+
+// Every number is written as it is in memory, except that vectors are written as their size (1 byte)
+// followed by 16-bit elements, and strings as their length (1 byte) followed by the characters.
+template<typename T>
+void write_value(string& str, const T& value)
+{
+	str.append((const char*)&value, sizeof(T));
+}
+
+template<typename T>
+bool read_value(const char*& pos, const char* end, T& value)
+{
+	if(end - pos < (long long)sizeof(T))  return false;
+	memcpy(&value, pos, sizeof(T));
+	pos += sizeof(T);
+	return true;
+}
+
+void write_vector(string& str, const vector<int>& v)
+{
+	str.push_back((char)v.size());
+	for(int i = 0; i < (int)v.size(); ++i)
+		write_value(str, (short)v[i]);
+}
+
+bool read_vector(const char*& pos, const char* end, vector<int>& v)
+{
+	if(pos == end)  return false;
+	const int size = (unsigned char)*(pos++);
+	if(end - pos < size * (long long)sizeof(short))  return false;
+	v.resize(size);
+	short num;
+	for(int i = 0; i < size; ++i)
+	{
+		read_value(pos, end, num);
+		v[i] = num;
+	}
+	return true;
+}
+
+void write_string(string& str, const char* s)
+{
+	const int len = strlen(s);
+	str.push_back((char)len);
+	str.append(s, len);
+}
+
+bool read_string(const char*& pos, const char* end, char* s, const int& size)
+// Fails if the string does not fit into the 'size' characters of 's', its end included.
+{
+	if(pos == end)  return false;
+	const int len = (unsigned char)*(pos++);
+	if(len >= size || end - pos < len)  return false;
+	memcpy(s, pos, len);
+	s[len] = '\0';
+	pos += len;
+	return true;
+}
+
+void ChordData::write_compact(string& str) const
+{
+	const int ints[18] = { t_size, s_size, root, g_center, common_note, sv, span, sspan, similarity, sim_orig,
+								  steady_count, ascending_count, descending_count, root_movement, overflow_amount,
+								  hide_octave, overflow_state, orig_pos };
+	const double doubles[6] = {tension, thickness, chroma_old, prev_chroma_old, chroma, Q_indicator};
+	str.append((const char*)ints, sizeof(ints));
+	str.append((const char*)doubles, sizeof(doubles));
+	write_string(str, root_name);
+	write_string(str, name);
+	write_string(str, name_with_octave);
+	const vector<int>* vecs[9] = { &notes, &note_set, &single_chroma, &vec, &self_diff, &count_vec,
+											 &alignment, &pedal_notes_set, &pedal_notes };
+	for(int i = 0; i < 9; ++i)
+		write_vector(str, *vecs[i]);
+}
+
+bool ChordData::read_compact(const char*& pos, const char* end)
+// Returns false if the data ends before 'end' or does not fit into the fields (e.g. a damaged file).
+{
+	int ints[18];
+	double doubles[6];
+	if(!read_value(pos, end, ints) || !read_value(pos, end, doubles))
+		return false;
+	int* int_fields[15] = { &t_size, &s_size, &root, &g_center, &common_note, &sv, &span, &sspan, &similarity,
+									&sim_orig, &steady_count, &ascending_count, &descending_count, &root_movement,
+									&overflow_amount };
+	for(int i = 0; i < 15; ++i)
+		*int_fields[i] = ints[i];
+	hide_octave = ints[15];
+	overflow_state = (OverflowState)ints[16];
+	orig_pos = ints[17];
+	double* double_fields[6] = {&tension, &thickness, &chroma_old, &prev_chroma_old, &chroma, &Q_indicator};
+	for(int i = 0; i < 6; ++i)
+		*double_fields[i] = doubles[i];
+	if(!read_string(pos, end, root_name, sizeof(root_name)) || !read_string(pos, end, name, sizeof(name))
+		|| !read_string(pos, end, name_with_octave, sizeof(name_with_octave)))
+		return false;
+	vector<int>* vecs[9] = { &notes, &note_set, &single_chroma, &vec, &self_diff, &count_vec,
+									 &alignment, &pedal_notes_set, &pedal_notes };
+	for(int i = 0; i < 9; ++i)
+		if(!read_vector(pos, end, *vecs[i]))  return false;
+	return true;
+}
+
+long long ChordData::memory_size() const
+{
+	const vector<int>* vecs[9] = { &notes, &note_set, &single_chroma, &vec, &self_diff, &count_vec,
+											 &alignment, &pedal_notes_set, &pedal_notes };
+	long long size = sizeof(ChordData);
+	for(int i = 0; i < 9; ++i)
+		if(vecs[i] -> capacity() != 0)
+			size += vecs[i] -> capacity() * sizeof(int) + 16;  // 16 bytes for the allocation itself
+	return size;
 }
 
 bool larger_t_size(const ChordData& data1, const ChordData& data2)
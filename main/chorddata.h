@@ -5,11 +5,14 @@
 #ifndef CHORDDATA
 #define CHORDDATA
 
+#include <string>
 #include <vector>
+using std::string;
 using std::vector;
 
 enum Language      {English, Chinese};
 enum OverflowState {NoOverflow, Single, Total};
+struct ResultRecord;
 
 class ChordData
 {
@@ -21,7 +24,7 @@ protected:
 	int root;           // r
 	int g_center;       // g
 	double chroma_old;  // kk
-	double prev_chroma_old;
+	double prev_chroma_old = 0.0;  // kk of the previous chord
 	double chroma;      // k
 	double Q_indicator; // Q
 	int common_note;    // c
@@ -65,6 +68,11 @@ public:
 	// prints data of both chords in chord analysis
 	void print_substitution(const char*, bool, bool, const ChordData&, const ChordData&, Language);
 	// prints data of a single progression in chord substitution
+	void set_record(const ChordData&, ResultRecord&) const;
+	// sets the exported record of a single chord (see 'export_result'), like 'print'
+	void write_compact(string&) const;  // appends all data to a string, e.g. to spill results to disk
+	bool read_compact(const char*&, const char* end);  // reads data written by 'write_compact' and moves past it
+	long long memory_size() const;      // approximate memory taken, including that of the vectors
 
 	int& get_t_size()           { return t_size; }
 	int& get_s_size()           { return s_size; }
@@ -86,6 +94,7 @@ public:
 	int& get_descending_count() { return descending_count; }
 	int& get_root_movement()    { return root_movement; }
 	int& get_overflow_amount()  { return overflow_amount; }
+	char* get_name()            { return name; }
 	
 	vector<int>& get_notes()           { return notes; }
 	vector<int>& get_note_set()        { return note_set; }
@@ -171,6 +180,6 @@ const char var[VAR_TOTAL] = {'P', 'N', 'T', 'K', 'C', 'a', 'A', 'm', 'h', 'g', '
 // name of parameters (a = S, A = SS, S = sv, k = KK)
 extern bool (*compare[VAR_TOTAL][2]) (const ChordData&, const ChordData&);
 // to unify the compare functions
-extern vector<int> rm_priority;
+extern thread_local vector<int> rm_priority;
 
 #endif
@@ -2,9 +2,12 @@
 // (c) 2020 Wenge Chen, Ji-woon Sim.
 // functions.cpp
 
+#include <atomic>
 #include <cstdlib>
 #include <cstring>
 #include <cmath>
+#include <cstdio>
+#include <ctime>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
@@ -12,17 +15,37 @@
 #include <vector>
 
 #include "functions.h"
+#if __WIN32
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
 using namespace std;
 
-ofstream fout, m_fout;
-stringstream stream;
+thread_local ofstream fout, m_fout, e_fout;
+thread_local MidiBuffer m_buffer;
+OutputWriter writer;
+thread_local int writer_pending = 0;
+thread_local stringstream stream;
+thread_local string t_buffer;
+thread_local int t_precision = -1;
+thread_local string e_buffer;
+thread_local long long allocation_count = 0;
+const ResultField result_fields[RESULT_FIELD_COUNT] =
+{ {"k", 'd'},  {"kk", 'd'}, {"c", 'i'},  {"ss", 'i'}, {"sv", 'i'}, {"t", 'd'},  {"s", 'i'},
+  {"n", 'i'},  {"m", 'i'},  {"h", 'd'},  {"g", 'i'},  {"r", 'i'},  {"Q", 'd'},  {"x", 'i'},
+  {"p", 'i'},  {"dr", 'i'}, {"dn", 'i'}, {"dt", 'd'}, {"ds", 'i'}, {"dg", 'i'}, {"o", 'i'} };
 double INF  =  1E9;
 double MINF = -1E9;
 int expansion_indexes[16][16][3432][15];
 int note_pos[12] = {1, 9, 9, 3, 3, 11, 11, 5, 13, 13, 7, 7};
-vector<int> omission[8];
-vector<int> chord_library;
-vector<vector<int>> alignment_list;
+thread_local vector<int> omission[8];
+thread_local vector<int> chord_library;
+thread_local vector<vector<int>> alignment_list;
+thread_local VoicingSet alignment_keys;
 
 void inputY_N(char& ch)
 // Input 'Y', 'y', 'N' or 'n'.
@@ -130,28 +153,249 @@ void ignore_path_ext(char* dest, char* source)
 	dest[index] = '\0';
 }
 
+bool map_file(const char* filename, MappedFile& file)
+// Maps the whole file into memory (read only). Returns false if the file cannot be opened.
+{
+	unmap_file(file);
+#if __WIN32
+	HANDLE handle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(handle == INVALID_HANDLE_VALUE)  return false;
+	LARGE_INTEGER size;
+	GetFileSizeEx(handle, &size);
+	file.size = size.QuadPart;
+	file.file = handle;
+	if(file.size == 0)  return true;
+	file.mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if(file.mapping != NULL)
+		file.data = (const char*)MapViewOfFile(file.mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+	int fd = open(filename, O_RDONLY);
+	if(fd == -1)  return false;
+	struct stat st;
+	fstat(fd, &st);
+	file.size = st.st_size;
+	if(file.size > 0)
+	{
+		void* data = mmap(nullptr, file.size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(data != MAP_FAILED)
+			file.data = (const char*)data;
+	}
+	close(fd);
+	// The mapping stays valid after the file is closed.
+#endif
+	if(file.size > 0 && file.data == nullptr)
+	{
+		unmap_file(file);
+		return false;
+	}
+	return true;
+}
+
+void unmap_file(MappedFile& file)
+{
+#if __WIN32
+	if(file.data != nullptr)  UnmapViewOfFile(file.data);
+	if(file.mapping != nullptr)  CloseHandle(file.mapping);
+	if(file.file != nullptr)  CloseHandle(file.file);
+	file.mapping = nullptr;
+	file.file = nullptr;
+#else
+	if(file.data != nullptr)  munmap((void*)file.data, file.size);
+#endif
+	file.data = nullptr;
+	file.size = 0;
+}
+
+unsigned long long checksum(const char* data, const long long& size)
+// 64-bit FNV-1a hash
+{
+	unsigned long long hash = 0xCBF29CE484222325ULL;
+	for(long long i = 0; i < size; ++i)
+	{
+		hash ^= (unsigned char)data[i];
+		hash *= 0x100000001B3ULL;
+	}
+	return hash;
+}
+
+void set_compiled_db_name(char* dest, const char* filename)
+// 'xxx.db' -> 'xxx.cdb'
+{
+	strcpy(dest, filename);
+	char* pc = strrchr(dest, '.');
+	if(pc != nullptr && strcmp(pc, ".db") == 0)
+		*pc = '\0';
+	strcat(dest, ".cdb");
+}
+
+bool set_omission_key(unsigned char* key)
+// 'key[i]' is the bitmask of 'omission[i + 3]' (1 -> bit 0, 3 -> bit 1, ..., 13 -> bit 6).
+// Returns false if an omitted note is not one of these, as it would share a bit with another one;
+// such settings are not compiled.
+{
+	for(int i = 0; i < 5; ++i)
+	{
+		key[i] = 0;
+		for(int j = 0; j < (int)omission[i + 3].size(); ++j)
+		{
+			const int note = omission[i + 3][j];
+			if(note < 1 || note > 13 || note % 2 == 0)  return false;
+			key[i] |= (1 << (note / 2));
+		}
+	}
+	return true;
+}
+
+bool read_compiled_db(const char* filename, const unsigned long long& source_checksum)
+// Sets 'chord_library' from the compiled database of 'filename', if it is up to date
+// and contains the current omission settings; otherwise returns false.
+{
+	char name[300];
+	set_compiled_db_name(name, filename);
+	MappedFile file;
+	if(!map_file(name, file))  return false;
+
+	CompiledDbHeader header;
+	unsigned char key[5];
+	if(!set_omission_key(key))
+	{
+		unmap_file(file);
+		return false;
+	}
+	bool found = false;
+	if(file.size >= (long long)sizeof(CompiledDbHeader))
+	{
+		memcpy(&header, file.data, sizeof(CompiledDbHeader));
+		if(strncmp(header.magic, COMPILED_DB_MAGIC, 4) == 0 && header.version == COMPILED_DB_VERSION
+		&& header.source_checksum == source_checksum
+		&& file.size == (long long)(sizeof(CompiledDbHeader) + header.record_count * sizeof(CompiledDbRecord)))
+		{
+			const CompiledDbRecord* records = (const CompiledDbRecord*)(file.data + sizeof(CompiledDbHeader));
+			for(int i = 0; i < header.record_count && !found; ++i)
+			{
+				if(memcmp(records[i].omission_key, key, 5) != 0)
+					continue;
+				found = true;
+				chord_library.clear();
+				for(int id = 0; id < (1 << 12); ++id)
+				{
+					if(records[i].bitmap[id / 32] & (1U << (id % 32)))
+						chord_library.push_back(id);
+				}
+				// The ids come out sorted, as 'dbentry' leaves them.
+			}
+		}
+	}
+	unmap_file(file);
+	return found;
+}
+
+bool replace_file(const char* temp_name, const char* name)
+// Renames 'temp_name' to 'name', replacing it in one step: a program reading (or mapping) the old file
+// keeps the old contents, and the others see the new file.
+{
+#if __WIN32
+	return MoveFileExA(temp_name, name, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return rename(temp_name, name) == 0;
+#endif
+}
+
+void write_compiled_db(const char* filename, const unsigned long long& source_checksum,
+							  const int& db_size, const char* title)
+// Adds 'chord_library' (for the current omission settings) to the compiled database of 'filename'.
+// Records of other omission settings are kept if they were compiled from the same source.
+// Other processes (e.g. shards, or the daemon next to the main program) may map the file or compile it
+// at the same time, so it is written to a temporary file of this process and renamed into place.
+// If two processes compile different omission settings at once, the record of one may be lost;
+// it is then compiled again the next time it is needed.
+{
+	char name[300], temp_name[340];
+	set_compiled_db_name(name, filename);
+#if __WIN32
+	snprintf(temp_name, sizeof(temp_name), "%s.%lu.tmp", name, (unsigned long)GetCurrentProcessId());
+#else
+	snprintf(temp_name, sizeof(temp_name), "%s.%lu.tmp", name, (unsigned long)getpid());
+#endif
+	CompiledDbHeader header;
+	vector<CompiledDbRecord> records;
+	unsigned char key[5];
+	if(!set_omission_key(key))  return;
+
+	MappedFile file;
+	if(map_file(name, file) && file.size >= (long long)sizeof(CompiledDbHeader))
+	{
+		memcpy(&header, file.data, sizeof(CompiledDbHeader));
+		if(strncmp(header.magic, COMPILED_DB_MAGIC, 4) == 0 && header.version == COMPILED_DB_VERSION
+		&& header.source_checksum == source_checksum
+		&& file.size == (long long)(sizeof(CompiledDbHeader) + header.record_count * sizeof(CompiledDbRecord)))
+		{
+			const CompiledDbRecord* old_records = (const CompiledDbRecord*)(file.data + sizeof(CompiledDbHeader));
+			for(int i = 0; i < header.record_count; ++i)
+			{
+				if(memcmp(old_records[i].omission_key, key, 5) != 0)
+					records.push_back(old_records[i]);
+			}
+		}
+	}
+	unmap_file(file);
+
+	CompiledDbRecord record;
+	memset(&record, 0, sizeof(record));
+	memcpy(record.omission_key, key, 5);
+	for(int i = 0; i < (int)chord_library.size(); ++i)
+		record.bitmap[chord_library[i] / 32] |= (1U << (chord_library[i] % 32));
+	records.push_back(record);
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, COMPILED_DB_MAGIC, 4);
+	header.version = COMPILED_DB_VERSION;
+	header.db_size = db_size;
+	header.record_count = records.size();
+	header.source_checksum = source_checksum;
+	strncpy(header.title, title, sizeof(header.title) - 1);
+
+	ofstream _fout(temp_name, ios::trunc | ios::binary);
+	if(!_fout.is_open())  return;
+	// The database folder may be read-only, in which case the text file is simply read every time.
+	_fout.write((char*)&header, sizeof(header));
+	_fout.write((char*)records.data(), records.size() * sizeof(CompiledDbRecord));
+	_fout.close();
+	if(!_fout || !replace_file(temp_name, name))
+		remove(temp_name);
+}
+
 void dbentry(const char* filename)
 // Reads the chord database.
+// The result is also saved in a compiled database (.cdb) next to the text file,
+// which is used instead of the text file as long as the latter is not modified.
 {
+	unsigned long long source_checksum = 0;
+	ChordReader reader;
+	if(open_chords(filename, reader))
+	{
+		source_checksum = checksum(reader.file.data, reader.file.size);
+		if(read_compiled_db(filename, source_checksum))
+		{
+			close_chords(reader);
+			return;
+		}
+	}
+
 	chord_library.clear();
-	ifstream fin(filename, ifstream::in);
-	 char str[100], ch;
-	while(fin.peek() == '/' || fin.peek() == 't')
-		  fin.getline(str, 100, '\n');
+	char str[100], title[100] = "\0";
+	int db_size = 0;
+	while(read_header(reader, str, 100))
+	{
+		if(title[0] == '\0')  strcpy(title, str);
+	}
 
 	vector<int> note_set;
-	int note;
-	do{
-		note_set.clear();
-		do{
-			fin >> note;
-			note_set.push_back(note);
-			ch = fin.get();
-		}  while(fin && !fin.eof() && ch != '\r' && ch != '\n');
-		if(!fin)  break;
-
+	while(read_chord(reader))
+	{
+		note_set = reader.notes;
 		int s_size = note_set.size();
-		if(s_size == 0)  break;
+		++db_size;
 
 		bubble_sort(note_set);
 		int root = find_root(note_set);
@@ -182,43 +426,213 @@ void dbentry(const char* filename)
 			if(omitted.size() != 0)
 				note_set_to_id(omitted, chord_library);
 		}
-	}  while(!fin.eof());
-	fin.close();
+	}
+	close_chords(reader);
 	remove_duplicate(chord_library);
+	if(source_checksum != 0)
+		write_compiled_db(filename, source_checksum, db_size, title);
+}
+
+bool open_chords(const char* filename, ChordReader& reader)
+// Opens a chord data file (one chord per line), a database or exported results (.cnr) for 'read_chord'.
+// The file is mapped into memory and is never copied as a whole.
+{
+	close_chords(reader);
+	reader.is_results = open_results(filename, reader.results);
+	if(reader.is_results)  return true;
+	return map_file(filename, reader.file);
+}
+
+bool read_line(ChordReader& reader, const char*& begin, const char*& end)
+// Points [begin, end) at the next line of the file (without the line break) and moves past it.
+// Returns false at the end of the file.
+{
+	const long long size = reader.file.size;
+	if(reader.is_results || reader.pos >= size)  return false;
+	begin = reader.file.data + reader.pos;
+	end = (const char*)memchr(begin, '\n', size - reader.pos);
+	if(end == nullptr)
+	{
+		end = reader.file.data + size;
+		reader.pos = size;
+	}
+	else  reader.pos = end - reader.file.data + 1;
+	if(end > begin && *(end - 1) == '\r')  --end;
+	return true;
+}
+
+void parse_notes(const char* begin, const char* end, vector<int>& notes)
+// Appends all integers in [begin, end) to 'notes'; any other character separates them.
+{
+	const char* pos = begin;
+	while(pos < end)
+	{
+		bool negative = (*pos == '-' && pos + 1 < end && *(pos + 1) >= '0' && *(pos + 1) <= '9');
+		if(negative)  ++pos;
+		if(*pos < '0' || *pos > '9')
+		{
+			++pos;
+			continue;
+		}
+		int num = 0;
+		while(pos < end && *pos >= '0' && *pos <= '9')
+			num = num * 10 + (*(pos++) - '0');
+		notes.push_back(negative ? -num : num);
+	}
+}
+
+bool read_header(ChordReader& reader, char* str, const int& max_len)
+// Reads a header line, i.e. one beginning with '/' or 't' as at the top of a database, into 'str'.
+// Returns false (and reads nothing) if the next line is not a header line.
+{
+	if(reader.is_results || reader.pos >= reader.file.size)  return false;
+	const char ch = reader.file.data[reader.pos];
+	if(ch != '/' && ch != 't')  return false;
+	const char *begin, *end;
+	read_line(reader, begin, end);
+	int len = end - begin;
+	if(len > max_len - 1)  len = max_len - 1;
+	memcpy(str, begin, len);
+	str[len] = '\0';
+	return true;
+}
+
+bool read_chord(ChordReader& reader)
+// Reads the next chord into 'reader.notes'; blank lines are skipped. Returns false at the end of the file.
+{
+	reader.notes.clear();
+	if(reader.is_results)
+	{
+		if(!read_result(reader.results, reader.record))  return false;
+		reader.notes.swap(reader.record.notes);
+		return true;
+	}
+	const char *begin, *end;
+	while(reader.notes.empty() && read_line(reader, begin, end))
+		parse_notes(begin, end, reader.notes);
+	return !reader.notes.empty();
+}
+
+void close_chords(ChordReader& reader)
+{
+	close_results(reader.results);
+	unmap_file(reader.file);
+	reader.pos = 0;
+	reader.is_results = false;
+}
+
+bool open_results(const char* filename, ResultReader& reader)
+// Opens a binary result file written by 'export_result'. Returns false if it is not one.
+// Fields are matched to 'result_fields' by name, so files from other versions can still be read.
+{
+	close_results(reader);
+	if(!map_file(filename, reader.file))  return false;
+	const MappedFile& file = reader.file;
+	int version, field_count;
+	if(file.size < 12 || strncmp(file.data, RESULT_MAGIC, 4) != 0)
+	{
+		close_results(reader);
+		return false;
+	}
+	memcpy(&version, file.data + 4, sizeof(int));
+	memcpy(&field_count, file.data + 8, sizeof(int));
+	if(version != RESULT_VERSION || field_count < 0 || file.size < 12 + field_count * (long long)sizeof(ResultField))
+	{
+		close_results(reader);
+		return false;
+	}
+
+	for(int i = 0; i < field_count; ++i)
+	{
+		ResultField field;
+		memcpy(&field, file.data + 12 + i * sizeof(ResultField), sizeof(ResultField));
+		reader.types.push_back(field.type);
+		reader.index.push_back(-1);
+		for(int j = 0; j < RESULT_FIELD_COUNT; ++j)
+			if(strncmp(field.name, result_fields[j].name, 7) == 0)
+			{
+				reader.index.back() = j;
+				break;
+			}
+	}
+	reader.pos = 12 + field_count * sizeof(ResultField);
+	return true;
+}
+
+bool read_result(ResultReader& reader, ResultRecord& record)
+// Reads the next record; returns false at the end of the file (or if the file is cut short).
+{
+	const char* data = reader.file.data;
+	const long long size = reader.file.size;
+	long long pos = reader.pos;
+	if(pos >= size)  return false;
+
+	record.notes.resize((unsigned char)data[pos++]);
+	if(pos + (long long)record.notes.size() >= size)  return false;
+	for(int i = 0; i < (int)record.notes.size(); ++i)
+		record.notes[i] = (unsigned char)data[pos++];
+	record.vec.resize((unsigned char)data[pos++]);
+	if(pos + (long long)record.vec.size() > size)  return false;
+	for(int i = 0; i < (int)record.vec.size(); ++i)
+		record.vec[i] = (signed char)data[pos++];
+
+	for(int i = 0; i < RESULT_FIELD_COUNT; ++i)
+		record.param[i] = 0;
+	for(int i = 0; i < (int)reader.types.size(); ++i)
+	{
+		double value;
+		if(reader.types[i] == 'd')
+		{
+			if(pos + 8 > size)  return false;
+			memcpy(&value, data + pos, 8);
+			pos += 8;
+		}
+		else
+		{
+			int num;
+			if(pos + 4 > size)  return false;
+			memcpy(&num, data + pos, 4);
+			pos += 4;
+			value = num;
+		}
+		if(reader.index[i] != -1)
+			record.param[reader.index[i]] = value;
+	}
+	reader.pos = pos;
+	return true;
+}
+
+void close_results(ResultReader& reader)
+{
+	unmap_file(reader.file);
+	reader.pos = 0;
+	reader.types.clear();
+	reader.index.clear();
 }
 
 void read_alignment(const char* filename)
 // Reads the alignment database.
 {
 	alignment_list.clear();
-	ifstream fin(filename);
-	 char str[100], ch;
-	fin.getline(str, 100, '\n');
-	fin.getline(str, 100, '\n');
-	fin.getline(str, 100, '\n');
-	fin.getline(str, 100, '\n');
-	fin.getline(str, 100, '\n');
+	alignment_keys.clear();
+	ChordReader reader;
+	open_chords(filename, reader);
+	char str[100];
+	while(read_header(reader, str, 100));
 	vector<int> single_align;
-	int num;
-	while(true)
+	while(read_chord(reader))
 	{
-		single_align.clear();
-		do{
-			fin >> num;
-			single_align.push_back(num);
-			ch = fin.get();
-		}  while(fin && !fin.eof() && ch != '\n' && ch != '\r');
+		single_align = reader.notes;
 		int len = single_align.size();
-		if(len == 0)  break;
 		for(int i = 0; i < len; ++i)
 		{
 			alignment_list.push_back(single_align);
+			alignment_keys.insert(notes_to_key(single_align));
 			single_align.push_back(single_align[0]);
 			single_align.erase(single_align.begin());
 		}
-		if(!fin || fin.eof())  break;
 	}
-	fin.close();
+	close_chords(reader);
 }
 
 
@@ -259,6 +673,289 @@ void cprint(const char* begin, const vector<int>& v, const char* sep, const char
 	cout << "]" << end;
 }
 
+void tprint(const char* str)
+// appends a string to 't_buffer'
+{
+	t_buffer.append(str);
+}
+
+void append_digits(string& dest, unsigned long long num, const int& base, const int& min_digits = 1)
+// appends 'num' to 'dest' in base 10 or 16 (upper case), with at least 'min_digits' digits
+{
+	char str[24];
+	int pos = 24;
+	do
+	{
+		str[--pos] = "0123456789ABCDEF"[num % base];
+		num /= base;
+	}  while(num != 0 || 24 - pos < min_digits);
+	dest.append(str + pos, 24 - pos);
+}
+
+void append_int(string& dest, const int& num)
+// i.e. 'fout << num', but appends to 'dest'
+{
+	if(num < 0)  dest.push_back('-');
+	append_digits(dest, (num < 0) ? -(long long)num : num, 10);
+}
+
+void tprint(const int& num)
+{
+	append_int(t_buffer, num);
+}
+
+void tprint(const double& val, const int& precision)
+// i.e. 'fout << fixed << setprecision(precision) << round_double(val, precision)'
+{
+	double exp = 1;
+	for(int i = 0; i < precision; ++i)
+		exp *= 10;
+	long long num = llround(val * exp);
+	t_precision = precision;
+	if(num < 0)
+	{
+		t_buffer.push_back('-');
+		num = -num;
+	}
+	append_digits(t_buffer, num, 10, precision + 1);
+	if(precision > 0)
+		t_buffer.insert(t_buffer.size() - precision, 1, '.');
+}
+
+void tprint(const char* begin, const vector<int>& v, const char* sep, const char* end, bool is_decimal)
+// i.e. 'fprint', but appends to 't_buffer'
+{
+	int size = v.size();
+	t_buffer.append(begin);
+	t_buffer.push_back('[');
+	for(int i = 0; i < size; ++i)
+	{
+		if(i != 0)  t_buffer.append(sep);
+		if(is_decimal)  append_int(t_buffer, v[i]);
+		else  append_digits(t_buffer, (unsigned int)v[i], 16);
+	}
+	t_buffer.push_back(']');
+	t_buffer.append(end);
+}
+
+void tflush(bool force)
+// Hands 't_buffer' to the writer thread, which writes it to 'fout'.
+// Unless 'force' is set, it waits until 'TEXT_BUFFER_SIZE' bytes have gathered and returns at once;
+// 'tflush()' returns only when everything is written.
+// Anything written to 'fout' directly must be preceded by 'tflush()' to keep the order of output.
+{
+	if(!force && (int)t_buffer.size() < TEXT_BUFFER_SIZE)  return;
+	if(!t_buffer.empty())  write_async(fout, t_buffer);
+	if(!force)  return;
+	wait_writer();
+	if(t_precision != -1)
+	// Leave 'fout' formatted as if the numbers had been written through it; the stats rely on it.
+	{
+		fout << fixed << setprecision(t_precision);
+		t_precision = -1;
+	}
+}
+
+void writer_loop()
+// the writer thread: writes the tasks in 'writer.queue' one by one until 'writer.stop' is set
+{
+	unique_lock<mutex> lock(writer.lock);
+	while(true)
+	{
+		writer.task_added.wait(lock, []{ return writer.stop || !writer.queue.empty(); });
+		if(writer.queue.empty())  return;
+		WriterTask task = move(writer.queue.front());
+		writer.queue.pop_front();
+		lock.unlock();
+
+		task.stream -> write(task.data.data(), task.data.size());
+		if(task.close)
+		{
+			task.stream -> close();
+			delete task.stream;
+		}
+		task.data.clear();
+
+		lock.lock();
+		if((int)writer.spare.size() < WRITER_QUEUE_SIZE)
+			writer.spare.push_back(move(task.data));
+		--*task.pending;
+		writer.task_done.notify_all();
+	}
+}
+
+OutputWriter::~OutputWriter()
+// Everything still in the queue is written before the thread ends.
+{
+	{
+		lock_guard<mutex> guard(lock);
+		stop = true;
+	}
+	task_added.notify_one();
+	if(worker.joinable())  worker.join();
+}
+
+void write_async(ofstream& stream, string& data, bool close)
+// Queues 'data' to be written to 'stream' by the writer thread; 'data' is left empty.
+// If 'close' is set, the file is moved out of 'stream' and closed once written, so 'stream' can be
+// opened again at once. Blocks while 'WRITER_QUEUE_SIZE' tasks are waiting.
+// The streams are 'thread_local', so a job thread must call 'wait_writer' before it ends.
+{
+	unique_lock<mutex> lock(writer.lock);
+	if(!writer.worker.joinable())
+		writer.worker = thread(writer_loop);
+	writer.task_done.wait(lock, []{ return (int)writer.queue.size() < WRITER_QUEUE_SIZE; });
+
+	WriterTask task;
+	task.stream = close ? new ofstream(move(stream)) : &stream;
+	task.close = close;
+	task.pending = &writer_pending;
+	++writer_pending;
+	task.data.swap(data);
+	if(!writer.spare.empty())
+	{
+		data.swap(writer.spare.back());
+		writer.spare.pop_back();
+	}
+	writer.queue.push_back(move(task));
+	writer.task_added.notify_one();
+}
+
+void wait_writer()
+// returns once everything this thread has handed to the writer thread has been written;
+// the tasks of jobs on other threads are not waited for
+{
+	unique_lock<mutex> lock(writer.lock);
+	writer.task_done.wait(lock, []{ return writer_pending == 0; });
+}
+
+void export_head(const ExportFormat& format)
+// Writes the schema of exported results to 'e_fout':
+// for binary files, the magic "CNRS", the version, the number of fields and each 'ResultField';
+// for CSV, the header row; for JSON Lines, a first line describing the fields.
+{
+	e_buffer.clear();
+	switch(format)
+	{
+		case ExportBinary:
+		{
+			e_buffer.append(RESULT_MAGIC, 4);
+			e_buffer.append((const char*)&RESULT_VERSION, sizeof(int));
+			e_buffer.append((const char*)&RESULT_FIELD_COUNT, sizeof(int));
+			e_buffer.append((const char*)result_fields, sizeof(result_fields));
+			break;
+		}
+		case ExportCsv:
+		{
+			e_buffer.append("notes,vec");
+			for(int i = 0; i < RESULT_FIELD_COUNT; ++i)
+			{
+				e_buffer.push_back(',');
+				e_buffer.append(result_fields[i].name);
+			}
+			e_buffer.push_back('\n');
+			break;
+		}
+		case ExportJsonl:
+		{
+			e_buffer.append("{\"schema\": \"ChordNova results\", \"version\": ");
+			append_int(e_buffer, RESULT_VERSION);
+			e_buffer.append(", \"fields\": {\"notes\": \"int[]\", \"vec\": \"int[]\"");
+			for(int i = 0; i < RESULT_FIELD_COUNT; ++i)
+			{
+				e_buffer.append(", \"");
+				e_buffer.append(result_fields[i].name);
+				e_buffer.append(result_fields[i].type == 'd' ? "\": \"double\"" : "\": \"int\"");
+			}
+			e_buffer.append("}}\n");
+			break;
+		}
+		case NoExport:  break;
+	}
+}
+
+void export_result(const ExportFormat& format, const ResultRecord& record)
+// Appends a record to 'e_buffer', which is written to 'e_fout' once 'TEXT_BUFFER_SIZE' bytes have gathered.
+{
+	char str[32];
+	switch(format)
+	{
+		case ExportBinary:
+		{
+			e_buffer.push_back((char)record.notes.size());
+			for(int i = 0; i < (int)record.notes.size(); ++i)
+				e_buffer.push_back((char)record.notes[i]);
+			e_buffer.push_back((char)record.vec.size());
+			for(int i = 0; i < (int)record.vec.size(); ++i)
+				e_buffer.push_back((char)record.vec[i]);
+			for(int i = 0; i < RESULT_FIELD_COUNT; ++i)
+			{
+				if(result_fields[i].type == 'd')
+					e_buffer.append((const char*)&record.param[i], 8);
+				else
+				{
+					const int num = record.param[i];
+					e_buffer.append((const char*)&num, 4);
+				}
+			}
+			break;
+		}
+		case ExportCsv:
+		case ExportJsonl:
+		{
+			const bool csv = (format == ExportCsv);
+			const vector<int>* vecs[2] = {&record.notes, &record.vec};
+			for(int k = 0; k < 2; ++k)
+			{
+				if(csv)  e_buffer.append(k == 0 ? "" : ",");
+				else  e_buffer.append(k == 0 ? "{\"notes\": [" : "], \"vec\": [");
+				for(int i = 0; i < (int)vecs[k] -> size(); ++i)
+				{
+					if(i != 0)  e_buffer.append(csv ? " " : ", ");
+					append_int(e_buffer, (*vecs[k])[i]);
+				}
+			}
+			if(!csv)  e_buffer.push_back(']');
+			for(int i = 0; i < RESULT_FIELD_COUNT; ++i)
+			{
+				if(csv)  e_buffer.push_back(',');
+				else
+				{
+					e_buffer.append(", \"");
+					e_buffer.append(result_fields[i].name);
+					e_buffer.append("\": ");
+				}
+				if(result_fields[i].type == 'd')
+				{
+					snprintf(str, 32, "%.10g", record.param[i]);
+					e_buffer.append(str);
+				}
+				else  append_int(e_buffer, record.param[i]);
+			}
+			e_buffer.append(csv ? "\n" : "}\n");
+			break;
+		}
+		case NoExport:  return;
+	}
+	if((int)e_buffer.size() >= TEXT_BUFFER_SIZE)
+		write_async(e_fout, e_buffer);
+}
+
+void export_end()
+// writes what is left in 'e_buffer' and closes 'e_fout' (both by the writer thread)
+{
+	write_async(e_fout, e_buffer, true);
+}
+
+void close_files()
+// Closes the output files of this thread after a job has stopped early.
+{
+	if(e_fout.is_open())  export_end();
+	wait_writer();
+	if(fout.is_open())  fout.close();
+	if(m_fout.is_open())  m_fout.close();
+}
+
 
 int nametonum(char* str)
 // Converts pitch name to midi note number.
@@ -422,6 +1119,66 @@ void note_set_to_id(const vector<int>& note_set, vector<int>& rec)
 	merge_sort(rec.begin(), rec.end(), smaller);
 }
 
+void reduce_notes(const vector<int>& notes, vector<int>& result)
+// Reduces 'notes' to a set of pitch classes, placed between 72 and 83.
+// This is how chords are represented in chord substitution.
+{
+	result = notes;
+	for(int i = 0; i < (int)result.size(); ++i)
+		result[i] %= 12;
+	bubble_sort(result);
+	remove_duplicate(result);
+	for(int i = 0; i < (int)result.size(); ++i)
+		result[i] += 72;
+}
+
+int notes_to_id(const vector<int>& v)
+// the inverse of 'id_to_notes'
+{
+	int id = 0;
+	for(int i = 0; i < (int)v.size(); ++i)
+		id |= (1 << (v[i] - 72));
+	return id;
+}
+
+VoicingKey notes_to_key(const vector<int>& notes)
+// Packs 'notes' into a 'VoicingKey'; only the first 15 notes are kept.
+{
+	VoicingKey key;
+	const int size = (notes.size() > 15) ? 15 : notes.size();
+	for(int i = 0; i < size; ++i)
+	{
+		const unsigned long long note = notes[i] & 0x7F;
+		const int pos = 121 - 7 * i;  // the lowest bit of the note
+		if(pos >= 64)  key.hi |= note << (pos - 64);
+		else
+		{
+			key.lo |= note << pos;
+			if(pos + 7 > 64)  key.hi |= note >> (64 - pos);
+		}
+	}
+	key.lo |= size;
+	return key;
+}
+
+void key_to_notes(const VoicingKey& key, vector<int>& notes)
+// the inverse of 'notes_to_key'
+{
+	notes.resize(key.lo & 0xF);
+	for(int i = 0; i < (int)notes.size(); ++i)
+	{
+		const int pos = 121 - 7 * i;
+		unsigned long long bits;
+		if(pos >= 64)  bits = key.hi >> (pos - 64);
+		else
+		{
+			bits = key.lo >> pos;
+			if(pos + 7 > 64)  bits |= key.hi << (64 - pos);
+		}
+		notes[i] = bits & 0x7F;
+	}
+}
+
 void id_to_notes(const int& id, vector<int>& v)
 // Similar to the function 'next' but the base number is 72.
 {
@@ -437,16 +1194,128 @@ void id_to_notes(const int& id, vector<int>& v)
 }
 
 
+static RandomEngine new_job_random()
+// Seeds the engine of a new thread from the time and a counter, so that threads started
+// at the same time still get different sequences.
+{
+	static atomic<unsigned long long> count(0);
+	RandomEngine engine;
+	seed_random(engine, (unsigned long long)time(0) ^ (++count * 0x9E3779B97F4A7C15ULL));
+	return engine;
+}
+
+thread_local RandomEngine job_random = new_job_random();
+
 int rand(const int& min, const int& max)
 // 'min' and 'max' are included in the result.
 {
-	return rand() % (max - min + 1) + min;
+	return rand(job_random, min, max);
 }
 
 double rand(const double& min, const double& max)
 // 'min' and 'max' are included in the result.
 {
-	return (double) rand() / RAND_MAX * (max - min) + min;
+	return (double)(next_random(job_random) >> 11) / ((1ULL << 53) - 1) * (max - min) + min;
+}
+
+void seed_random(RandomEngine& engine, const unsigned long long& seed)
+{
+	engine.state = seed;
+}
+
+RandomEngine split_random(const RandomEngine& engine, const unsigned long long& key)
+// Derives an independent engine from 'engine' and 'key' without advancing 'engine'.
+// Streams for different keys do not depend on the order in which they are drawn,
+// which keeps the results reproducible however the work is divided.
+{
+	RandomEngine result;
+	result.state = engine.state ^ (key * 0xD1B54A32D192ED03ULL);
+	next_random(result);
+	return result;
+}
+
+unsigned long long next_random(RandomEngine& engine)
+// SplitMix64 (Steele, Lea & Flood, 2014).
+{
+	unsigned long long z = (engine.state += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+int rand(RandomEngine& engine, const int& min, const int& max)
+// 'min' and 'max' are included in the result.
+// Multiply-shift reduction; the bias is below 2^-32 for the ranges used here.
+{
+	unsigned long long range = max - min + 1;
+	return min + (int)( ((next_random(engine) >> 32) * range) >> 32 );
+}
+
+void sample_ids(RandomEngine& engine, const int& count, const int& max_id, vector<int>& result)
+// Draws 'count' distinct integers from [1, 'max_id'] and saves them in ascending order.
+// Floyd's algorithm: every draw is accepted, so the cost is O(count) draws instead of
+// the O(count ^ 2) of rejecting duplicates from a sorted vector.
+{
+	vector<bool> chosen(max_id + 1, false);
+	result.clear();
+	for(int j = max_id - count + 1; j <= max_id; ++j)
+	{
+		int id = rand(engine, 1, j);
+		if(chosen[id])  id = j;
+		chosen[id] = true;
+		result.push_back(id);
+	}
+	merge_sort(result.begin(), result.end(), smaller);
+}
+
+double now_seconds()
+// Wall-clock seconds from a monotonic clock. Unlike 'clock()', it counts the time spent waiting
+// and is not summed over the threads of the process.
+{
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void update_rate(RateEstimator& est, const double& value, const double& items)
+// Adds a sample of the progress taken now.
+// For the first 'RATE_SMOOTHING' seconds the rate is the average since the first sample.
+// After that the rate between two samples is blended in with weight 1 - exp(-dt / RATE_SMOOTHING),
+// i.e. an exponential moving average over time, which follows a job slowing down (as results pile up)
+// without depending on how often it is sampled.
+{
+	const double now = now_seconds();
+	if(est.samples == 0)
+	{
+		est.begin_time  = now;
+		est.begin_value = value;
+		est.begin_items = items;
+	}
+	else
+	{
+		const double dt = now - est.time;
+		if(dt <= 0)  return;
+		if(now - est.begin_time <= RATE_SMOOTHING)
+		{
+			est.rate      = (value - est.begin_value) / (now - est.begin_time);
+			est.item_rate = (items - est.begin_items) / (now - est.begin_time);
+		}
+		else
+		{
+			const double weight = 1 - exp(-dt / RATE_SMOOTHING);
+			est.rate      += weight * ((value - est.value) / dt - est.rate);
+			est.item_rate += weight * ((items - est.items) / dt - est.item_rate);
+		}
+	}
+	est.time  = now;
+	est.value = value;
+	est.items = items;
+	++est.samples;
+}
+
+double remaining_time(const RateEstimator& est, const double& maximum)
+// in seconds; -1 if it can not be estimated yet
+{
+	if(est.rate <= 0)  return -1;
+	return (maximum - est.value) / est.rate;
 }
 
 int sign(const int& n)
@@ -578,76 +1447,100 @@ vector<int> normal_form(vector<int>& set)
 }
 
 
-int swapInt(const int& value, const int& len)
-// Converts an integer in Big-Endian to Little-Endian, and vice versa.
+void put_int(const unsigned int& value, const int& len)
+// Appends 'value' to the MIDI buffer as a big-endian integer of 'len' bytes.
 {
-	switch(len)
-	{
-		case 1:  return value;
-		case 2:  return ((value & 0x00FF) << 8) | ((value & 0xFF00) >> 8);
-		case 3:  return ((value & 0x0000FF) << 16) | (value & 0x00FF00) | ((value & 0xFF0000) >> 16);
-		case 4:  return ((value & 0x000000FF) << 24) | ((value & 0x0000FF00) << 8) |
-							 ((value & 0x00FF0000) >> 8)  | ((value & 0xFF000000) >> 24);
-		default:  exit(-1);
-	}
+	for(int i = len - 1; i >= 0; --i)
+		m_buffer.data.push_back((char)((value >> (8 * i)) & 0xFF));
 }
 
-int to_VLQ(int value)
-// Converts an integer to a variable length quantity.
+void put_VLQ(unsigned int value)
+// Appends 'value' to the MIDI buffer as a variable length quantity (7 bits per byte, most significant first).
 {
-	int count = 0, result = 0;
-	while(value != 0)
-	{
-		result += ((value & 0x7F) << (8 * count));
-		if(count != 0)
-			result += (1 << ((8 * (count + 1)) - 1) );
-		value >>= 7;
+	int count = 1;
+	while((value >> (7 * count)) != 0 && count < 5)
 		++count;
-	}
-	return swapInt(result, count);
+	for(int i = count - 1; i > 0; --i)
+		m_buffer.data.push_back((char)(((value >> (7 * i)) & 0x7F) | 0x80));
+	m_buffer.data.push_back((char)(value & 0x7F));
+}
+
+void midi_end_track()
+// Closes the current track with an "end of track" event and fills in its chunk length.
+{
+	if(m_buffer.track_pos < 0)  return;
+	m_buffer.data.insert(m_buffer.data.end(), "\x00\xFF\x2F\x00", "\x00\xFF\x2F\x00" + 4);
+	const unsigned int len = m_buffer.data.size() - m_buffer.track_pos - 4;
+	for(int i = 0; i < 4; ++i)
+		m_buffer.data[m_buffer.track_pos + i] = (char)((len >> (8 * (3 - i))) & 0xFF);
+	m_buffer.track_pos = -1;
 }
 
-void midi_head(const int& chord_count, const int& note_count)
-// It is written only for one specific usage and it contains some copyright information.
-// Better to refer to some MIDI instructions and try to modify it.
+void midi_track()
+// Starts a new track; the previous one (if any) is closed.
 {
-	char str1[19] = "\x4D\x54\x68\x64\x00\x00\x00\x06\x00\x00\x00\x01\x01\xE0\x4D\x54\x72\x6B";
-	m_fout.write(str1, 18);
-	int _len = swapInt(8 * note_count + chord_count + 74);
-	m_fout.write((char*)&_len, sizeof(int));
-	char str2[71] = { "\x00\xFF\x02\x21\x28\x63\x29\x20\x32\x30\x32\x30\x20\x57\x65\x6E\x67\x65\x20\x43\x68\x65\x6E"
-							"\x2C\x20\x4A\x69\x2D\x77\x6F\x6F\x6E\x20\x53\x69\x6D\x2E\x00\xFF\x04\x05\x50\x69\x61\x6E\x6F"
-							"\x00\xFF\x51\x03\x0F\x42\x40\x00\xFF\x58\x04\x04\x02\x18\x08\x00\xFF\x59\x02\x00\x00\x00\xC0\x00"};
-	m_fout.write(str2, 70);
+	midi_end_track();
+	m_buffer.data.insert(m_buffer.data.end(), "MTrk", "MTrk" + 4);
+	m_buffer.track_pos = m_buffer.data.size();
+	put_int(0, 4);  // chunk length, filled in by 'midi_end_track'
+	++m_buffer.track_count;
 }
 
-void chord_to_midi(vector<int>& notes, int beat)
-// Writes a single chord to MIDI with the beat of notes equal to 'beat'.
+void midi_head()
+// Starts a MIDI file in 'm_buffer': the header chunk, and the first track with title, tempo and copyright.
+// Notes may follow in the same track, or in further tracks started with 'midi_track'.
+// The number of tracks and all chunk lengths are filled in by 'midi_flush'.
+{
+	m_buffer.data.clear();
+	m_buffer.track_pos = -1;
+	m_buffer.track_count = 0;
+	m_buffer.data.insert(m_buffer.data.end(), "MThd", "MThd" + 4);
+	put_int(6, 4);
+	put_int(0, 2);    // format, see 'midi_flush'
+	put_int(1, 2);    // number of tracks, see 'midi_flush'
+	put_int(480, 2);  // ticks per quarter note
+	midi_track();
+	const char str[71] = { "\x00\xFF\x02\x21\x28\x63\x29\x20\x32\x30\x32\x30\x20\x57\x65\x6E\x67\x65\x20\x43\x68\x65\x6E"
+								  "\x2C\x20\x4A\x69\x2D\x77\x6F\x6F\x6E\x20\x53\x69\x6D\x2E\x00\xFF\x04\x05\x50\x69\x61\x6E\x6F"
+								  "\x00\xFF\x51\x03\x0F\x42\x40\x00\xFF\x58\x04\x04\x02\x18\x08\x00\xFF\x59\x02\x00\x00\x00\xC0\x00"};
+	m_buffer.data.insert(m_buffer.data.end(), str, str + 70);
+}
+
+void chord_to_midi(const vector<int>& notes, int beat)
+// Appends a single chord to the current track with the beat of notes equal to 'beat'.
 {
 	int size = notes.size();
 	for(int i = 0; i < size; ++i)
 	{
-		m_fout.write("\x00\x90", 2);
-		m_fout.put((char)notes[i]);
-		m_fout.put('\x50');
+		m_buffer.data.push_back('\x00');
+		m_buffer.data.push_back('\x90');
+		m_buffer.data.push_back((char)notes[i]);
+		m_buffer.data.push_back('\x50');
 	}
 
 	for(int i = 0; i < size; ++i)
 	{
-		if(i == 0)
-		{
-			int vlq = to_VLQ(beat * 480);
-			int len = (beat > 34) ? 3 : 2;
-			// For simplicity we constraint 'len' under 1000, and then the length of 'vlq' would not exceed 3.
-			m_fout.write((char*)&vlq, len);
-			m_fout.put('\x80');
-		}
-		else  m_fout.write("\x00\x80", 2);
-		m_fout.put((char)notes[i]);
-		m_fout.put('\x40');
+		if(i == 0)  put_VLQ(beat * 480);
+		else  m_buffer.data.push_back('\x00');
+		m_buffer.data.push_back('\x80');
+		m_buffer.data.push_back((char)notes[i]);
+		m_buffer.data.push_back('\x40');
 	}
 }
 
+void midi_flush()
+// Closes the last track and hands the whole MIDI file to the writer thread, which writes it to 'm_fout'
+// at once and closes it.
+// A single track is written in format 0, several tracks in format 1.
+{
+	midi_end_track();
+	const int count = m_buffer.track_count;
+	m_buffer.data[9]  = (count > 1) ? '\x01' : '\x00';
+	m_buffer.data[10] = (char)((count >> 8) & 0xFF);
+	m_buffer.data[11] = (char)(count & 0xFF);
+	write_async(m_fout, m_buffer.data, true);
+	m_buffer.track_count = 0;
+}
 
 bool different_name(const char* str1, const char* str2)
 // Here 'str1' and 'str2' are names of a chord.
@@ -793,7 +1686,7 @@ void insert(int* ar, int* pos, int len1, int len2)
 // e.g. ar = [0, 1, 2, 3], pos = [1, 1, 2]
 // ar -> [0, 1, 2, 2, 3] -> [0, 1, 1, 2, 2, 3] -> [0, 1, 1, 1, 2, 2, 3]
 
-void set_expansion_indexes()
+static void fill_expansion_indexes()
 {
 	for(int min = 1; min <= 15; ++min)
 		for(int max = min; max <= 15; ++max)
@@ -812,7 +1705,10 @@ void set_expansion_indexes()
 			while(index1 >= 0)
 			{
 				if(index2 >= min)
-					index2 = pos[--index1] + 1;
+				{
+					if(--index1 < 0)  break;
+					index2 = pos[index1] + 1;
+				}
 				else if(index1 == diff)
 				{
 					int* ar = expansion_indexes[min][max][index3];
@@ -828,6 +1724,13 @@ void set_expansion_indexes()
 		}
 }
 
+void set_expansion_indexes()
+// 'expansion_indexes' never changes once filled, so it is filled only once and shared by all jobs.
+{
+	static once_flag filled;
+	call_once(filled, fill_expansion_indexes);
+}
+
 
 bool smaller(const int& num1, const int& num2)
 { return num1 < num2; }
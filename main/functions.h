@@ -5,18 +5,39 @@
 #ifndef FUNCTIONS
 #define FUNCTIONS
 
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <iostream>
 #include <iomanip>
 #include <fstream>
+#include <mutex>
 #include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_set>
 #include <vector>
 
 using namespace std;
 
-extern ofstream fout, m_fout;
-// 'fout' for text output; 'm_fout' for MIDI output
-extern stringstream stream;
+// Every generation or analysis job runs on a single thread. The state of a job (output streams
+// and buffers, the chord database, alignments and omissions) is 'thread_local', so jobs on
+// different threads do not share it; a thread must load its own database (see 'dbentry').
+// 'writer' and the read-only tables ('expansion_indexes', 'note_pos' etc.) are shared.
+extern thread_local ofstream fout, m_fout, e_fout;
+// 'fout' for text output; 'm_fout' for MIDI output; 'e_fout' for exported results (see 'export_head')
+extern thread_local stringstream stream;
 // for output in chord analysis
+extern thread_local string t_buffer;
+// Text output of results is formatted here by 'tprint' and written to 'fout' by 'tflush'.
+extern thread_local int t_precision;
+// precision of the last decimal number in 't_buffer' (-1 if none)
+extern thread_local string e_buffer;
+// exported results waiting to be written to 'e_fout'
+extern thread_local long long allocation_count;
+// heap allocations made by this thread, counted only by programs replacing 'operator new' (chordnova-bench);
+// 0 in the others. See 'StageTimer'.
+const int TEXT_BUFFER_SIZE = 1 << 20;
 extern double INF;
 extern double MINF;
 extern int expansion_indexes[16][16][3432][15];
@@ -25,13 +46,41 @@ extern int expansion_indexes[16][16][3432][15];
 // (sorted in ascending order), then the desired expansion is simply { notes[expansion[i]] }.
 // 'expansion_indexes[min][max][i]' is the 'i'th alternative of expansion (*) for 'notes.size() = min' and 'm_max = max'.
 extern int note_pos[12];
-extern vector<int> omission[8];
+extern thread_local vector<int> omission[8];
 // 'omission[i]' represents omission allowed for i-note chords.
 // All elements in the vectors belong to {1, 3, 5, 7, 9, 11, 13}.
-extern vector<int> chord_library;
+extern thread_local vector<int> chord_library;
 // i.e. chord database (in integer form).
 // Contains 'set_id' of all 12 transpositions of all 'note_set's in the chord database file.
-extern vector<vector<int>> alignment_list;
+extern thread_local vector<vector<int>> alignment_list;
+
+struct VoicingKey
+// A voicing packed into 128 bits, for notes from 0 to 127 and at most 15 voices:
+// 7 bits for each note from the highest bits down, then the number of notes in the lowest 4 bits.
+// Keys compare (and sort) the same way as the vectors they come from. See 'notes_to_key'.
+{
+	unsigned long long hi = 0;
+	unsigned long long lo = 0;
+};
+
+inline bool operator==(const VoicingKey& key1, const VoicingKey& key2)
+{ return key1.hi == key2.hi && key1.lo == key2.lo; }
+
+inline bool operator!=(const VoicingKey& key1, const VoicingKey& key2)
+{ return !(key1 == key2); }
+
+inline bool operator<(const VoicingKey& key1, const VoicingKey& key2)
+{ return key1.hi < key2.hi || (key1.hi == key2.hi && key1.lo < key2.lo); }
+
+struct VoicingKeyHash
+{
+	size_t operator()(const VoicingKey& key) const
+	{ return (size_t)(key.hi * 0x9E3779B97F4A7C15ULL ^ key.lo); }
+};
+typedef unordered_set<VoicingKey, VoicingKeyHash> VoicingSet;
+
+extern thread_local VoicingSet alignment_keys;
+// keys of all vectors in 'alignment_list'
 
 struct Movement
 {
@@ -40,6 +89,145 @@ struct Movement
 	double percentage;
 };
 
+struct MappedFile
+// a file mapped into memory (read only); see 'map_file'
+{
+	const char* data = nullptr;
+	long long size = 0;
+#if __WIN32
+	void* file = nullptr;
+	void* mapping = nullptr;
+#endif
+};
+
+const char COMPILED_DB_MAGIC[5] = "CNDB";
+const int  COMPILED_DB_VERSION = 1;
+
+struct CompiledDbHeader
+// Header of a compiled chord database (.cdb), followed by 'record_count' records.
+{
+	char magic[4];
+	int  version;
+	int  db_size;       // number of chords in the text database
+	int  record_count;
+	unsigned long long source_checksum; // checksum of the text database it is compiled from
+	char title[104];
+};
+
+struct CompiledDbRecord
+// 'chord_library' for one omission setting, as a bitmap of all 4096 set ids
+{
+	unsigned char omission_key[8]; // see 'set_omission_key'; only the first 5 bytes are used
+	unsigned int  bitmap[128];
+};
+
+enum ExportFormat {NoExport, ExportBinary, ExportCsv, ExportJsonl};
+
+const char RESULT_MAGIC[5] = "CNRS";
+const int  RESULT_VERSION = 1;
+const int  RESULT_FIELD_COUNT = 21;
+
+struct ResultField
+// a parameter of exported results; 'type' is 'i' (stored as a 32-bit integer) or 'd' (stored as a double)
+{
+	char name[7];
+	char type;
+};
+extern const ResultField result_fields[RESULT_FIELD_COUNT];
+// k, kk, c, ss, sv, t, s, n, m, h, g, r, Q, x, p, dr, dn, dt, ds, dg, o (overflow state)
+
+struct ResultRecord
+// A single exported result: the chord, the voice leading into it and every parameter,
+// in the order of 'result_fields'.
+{
+	vector<int> notes;
+	vector<int> vec;
+	double param[RESULT_FIELD_COUNT];
+};
+
+struct ResultReader
+// reads a binary result file (.cnr); see 'open_results'
+{
+	MappedFile file;
+	long long pos = 0;
+	vector<char> types;  // type of each field in the file
+	vector<int>  index;  // position of each field in 'result_fields' (-1 if unknown)
+};
+
+struct ChordReader
+// Reads chords one by one from a memory-mapped chord data file, database or exported results;
+// see 'open_chords'.
+{
+	MappedFile file;
+	long long pos = 0;
+	bool is_results = false;
+	ResultReader results;
+	ResultRecord record;
+	vector<int> notes;  // the chord last read by 'read_chord'
+};
+
+struct MidiBuffer
+// A MIDI file being built in memory, written to 'm_fout' at once by 'midi_flush'.
+{
+	string data;
+	int track_pos = -1;  // position of the length field of the current track (-1 if none)
+	int track_count = 0;
+};
+extern thread_local MidiBuffer m_buffer;
+
+const int WRITER_QUEUE_SIZE = 8;
+
+struct WriterTask
+// a chunk of output waiting for the writer thread; see 'write_async'
+{
+	ofstream* stream = nullptr;
+	string data;
+	bool close = false;  // If set, 'stream' is owned by the task and closed after 'data' is written.
+	int* pending = nullptr;  // 'writer_pending' of the job that queued the task
+};
+
+struct OutputWriter
+// A thread writing output files in the background. Formatted text, MIDI files and exported results
+// are handed over through a queue of at most 'WRITER_QUEUE_SIZE' tasks, so that generation and
+// formatting go on while earlier output is being written. Tasks are written in order.
+// The queue is shared by all jobs, but each job only waits for its own tasks (see 'wait_writer').
+{
+	deque<WriterTask> queue;
+	vector<string> spare;  // emptied buffers, given back to the producer to save reallocation
+	mutex lock;
+	condition_variable task_added, task_done;
+	thread worker;
+	bool stop = false;
+	~OutputWriter();
+};
+extern OutputWriter writer;
+extern thread_local int writer_pending;
+// tasks of this thread's job queued or being written; guarded by 'writer.lock'
+
+struct RandomEngine
+// A seedable pseudo-random number generator (SplitMix64).
+// Unlike 'rand()' it has no hidden global state, so every job (or every row of a job)
+// can own an engine, and the same seed always gives the same sequence.
+{
+	unsigned long long state = 0;
+};
+extern thread_local RandomEngine job_random;
+// used by 'rand(min, max)'; seeded differently for every thread, or by 'seed_random' for a repeatable job
+
+const double RATE_SMOOTHING = 5.0; // seconds over which the throughput of a job is averaged
+
+struct RateEstimator
+// Throughput of a stage of a job, measured on a monotonic clock from samples of its progress
+// (see 'update_rate'). Both the progress ('value') and the number of candidates tested ('items')
+// are tracked, the first for the remaining time and the second to be shown to the user.
+{
+	int    samples = 0;
+	double begin_time = 0,  begin_value = 0,  begin_items = 0; // the first sample
+	double time = 0, value = 0, items = 0;                     // the last sample
+	double rate = 0;       // progress per second
+	double item_rate = 0;  // candidates per second
+};
+
 // input from console
 template<typename T>
 void inputNum(T& num, const T& min, const T& max, const T& dflt)
@@ -108,7 +296,25 @@ extern void inputVec(vector<int>& vec, const int& min = MINF, const int& max = I
 
 // file reading
 extern void ignore_path_ext(char*, char*);
+extern bool map_file(const char*, MappedFile&);
+extern void unmap_file(MappedFile&);
+extern unsigned long long checksum(const char* data, const long long& size);
+extern bool replace_file(const char* temp_name, const char* name);
+extern void set_compiled_db_name(char* dest, const char* filename);
+extern bool set_omission_key(unsigned char*);
+extern bool read_compiled_db(const char* filename, const unsigned long long& source_checksum);
+extern void write_compiled_db(const char* filename, const unsigned long long& source_checksum,
+										const int& db_size, const char* title);
 extern void dbentry(const char*);
+extern bool open_chords(const char*, ChordReader&);
+extern bool read_line(ChordReader&, const char*& begin, const char*& end);
+extern void parse_notes(const char* begin, const char* end, vector<int>& notes);
+extern bool read_header(ChordReader&, char* str, const int& max_len);
+extern bool read_chord(ChordReader&);
+extern void close_chords(ChordReader&);
+extern bool open_results(const char*, ResultReader&);
+extern bool read_result(ResultReader&, ResultRecord&);
+extern void close_results(ResultReader&);
 extern void read_alignment(const char*);
 
 // output
@@ -117,6 +323,18 @@ extern void fprint(const char* begin, const vector<int>& v, const char* sep = ",
 extern void sprint(const char* begin, const vector<int>& v, const char* sep = ", ",
 						 const char* end = "\n", bool is_decimal = true);
 extern void cprint(const char* begin, const vector<int>& v, const char* sep = ", ", const char* end = ", ");
+extern void tprint(const char*);
+extern void tprint(const int&);
+extern void tprint(const double& val, const int& precision);
+extern void tprint(const char* begin, const vector<int>& v, const char* sep = ", ",
+						 const char* end = "\n", bool is_decimal = true);
+extern void tflush(bool force = true);
+extern void write_async(ofstream&, string& data, bool close = false);
+extern void wait_writer();
+extern void export_head(const ExportFormat&);
+extern void export_result(const ExportFormat&, const ResultRecord&);
+extern void export_end();
+extern void close_files();
 
 // type conversion
 extern int  nametonum(char* str);
@@ -125,10 +343,22 @@ extern void chromatoname(int, char*);
 extern void inttostring (int num, char* str, int base = 10);
 extern void note_set_to_id(const vector<int>&, vector<int>&);
 extern void id_to_notes (const int&, vector<int>&);
+extern int  notes_to_id (const vector<int>&);
+extern void reduce_notes(const vector<int>& notes, vector<int>& result);
+extern VoicingKey notes_to_key(const vector<int>&);
+extern void key_to_notes(const VoicingKey&, vector<int>&);
 
 // mathematics
 extern int    rand(const int&, const int&);
 extern double rand(const double&, const double&);
+extern void   seed_random(RandomEngine&, const unsigned long long&);
+extern RandomEngine split_random(const RandomEngine&, const unsigned long long& key);
+extern unsigned long long next_random(RandomEngine&);
+extern int    rand(RandomEngine&, const int&, const int&);
+extern void   sample_ids(RandomEngine&, const int& count, const int& max_id, vector<int>& result);
+extern double now_seconds();
+extern void   update_rate(RateEstimator&, const double& value, const double& items);
+extern double remaining_time(const RateEstimator&, const double& maximum);
 extern int    sign(const int&);
 extern int    sign(const double& x, const double& bound = 1E-5);
 extern double round_double(const double&, const int&);
@@ -141,10 +371,13 @@ extern vector<int> get_complement(const vector<int>&, const vector<int>&);
 extern vector<int> normal_form(vector<int>&);
 
 // MIDI operation
-extern int  swapInt(const int& value, const int& len = 4);
-extern int  to_VLQ(int);
-extern void midi_head(const int&, const int&);
-extern void chord_to_midi(vector<int>& notes, int beat = 1);
+extern void put_int(const unsigned int& value, const int& len = 4);
+extern void put_VLQ(unsigned int);
+extern void midi_head();
+extern void midi_track();
+extern void midi_end_track();
+extern void chord_to_midi(const vector<int>& notes, int beat = 1);
+extern void midi_flush();
 
 // misc
 extern bool different_name(const char*, const char*);
@@ -5,11 +5,14 @@
 #ifndef INTERFACE
 #define INTERFACE
 
+#include <QApplication>
 #include <QButtonGroup>
 #include <QCheckBox>
 #include <QCloseEvent>
+#include <QComboBox>
 #include <QDesktopServices>
 #include <QDir>
+#include <QEventLoop>
 #include <QFileDialog>
 #include <QFileInfo>
 #include <QFont>
@@ -22,11 +25,16 @@
 #include <QPainter>
 #include <QPalette>
 #include <QPixmap>
+#include <QProgressDialog>
 #include <QPushButton>
 #include <QRadioButton>
 #include <QString>
 #include <QTextEdit>
+#include <QTimer>
 #include <QUrl>
+#include <exception>
+#include <functional>
+#include <thread>
 
 #if __WIN32
 #include <windows.h>  // in order to get 'hscale' and 'vscale'
@@ -47,6 +55,7 @@ private:
 	double vscale; // It seems that the magnification scales of two directions are not equal.
 	QFont  font;   // default font of the program
 	QVBoxLayout* main_vbox;  // the frame of maingui
+	JobProgress job_progress;
 	QString  root_path;
 	QString  cur_preset[2];
 	QString  cur_preset_filename;
@@ -66,6 +75,9 @@ private:
 	QRadioButton* btn_def;
 	QRadioButton* btn_midi;
 	QRadioButton* btn_text;
+	QComboBox* combo_export;
+	QLineEdit* edit_memory_budget;
+	QLabel* label_estimate;
 
 	QLabel* label_loop_count;
 	QLineEdit* edit_loop_count;
@@ -192,11 +204,13 @@ private:
 	QWidget* analyser_window;
 	QLineEdit* edit_ante;
 	QLineEdit* edit_post;
+	QLineEdit* edit_seq;
 	QCheckBox* cb_hide_octave;
 	QTextEdit* edit_stats;
 	QRadioButton* btn_post;
 	QRadioButton* btn_ante;
 	QRadioButton* btn_both;
+	QRadioButton* btn_seq;
 	QRadioButton* btn_test_all;
 	QRadioButton* btn_test_part;
 	QLineEdit* edit_sample_size;
@@ -255,8 +269,6 @@ private:
 
 public slots:
 	void import_preset();  // selects a preset and opens it
-	int  read_data(ifstream&, char*);  // can read a string, bool or int from preset
-	void read_vec(ifstream&, char*, vector<int>&);  // reads a vector from preset
 	void read_preset(char*);  // assigns values to variables from preset
 	void set_to_Chinese();
 	void set_to_English();
@@ -266,6 +278,8 @@ public slots:
 	void set_output_path();
 	void set_continual(bool);
 	void set_output_format(bool);
+	void set_export_format(int);
+	void set_memory_budget();
 	void set_loop_count();
 	void set_note_min();
 	void set_note_max();
@@ -287,9 +301,13 @@ public slots:
 	void set_remove_dup(int);
 	void set_remove_dup_type(int);
 	void open_utilities();
+	bool prepare_run();
+	// reads chord and align database and checks the initial chord; false (after a message) if it fails
 	void run();
 	// reads chord and align database, receives and displays error messages,
 	// and runs the program
+	void estimate();
+	void run_job(QProgressDialog*, const function<void()>&);
 
 	void set_save_mode(bool);
 	void set_preset_Chinese();
@@ -376,6 +394,7 @@ public slots:
 	void random_chords();
 	void set_antechord();
 	void set_postchord();
+	void set_sequence();
 	void swap_chords();
 	void set_hide_octave();
 	void analyse();
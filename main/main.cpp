@@ -2,14 +2,12 @@
 // (c) 2020 Wenge Chen, Ji-woon Sim.
 // main.cpp
 
-#include <ctime>
 #include <QApplication>
 #include <QLayout>
 #include "interface.h"
 
 int main(int argc, char *argv[])
 {
-	srand( (int)time(0) );
 	QApplication app(argc, argv);
 	Interface window;
 
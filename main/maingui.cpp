@@ -30,6 +30,10 @@ Interface::Interface(QWidget* parent): QWidget(parent)
 	cur_preset[English] = "default settings";
 	cur_preset_filename = "default.preset";
 	cur_preset_path = "../presets/default.preset";
+	strcpy(str_seq_notes, "");
+	export_format = NoExport;
+	memory_budget = DEFAULT_MEMORY_BUDGET;
+	progress = &job_progress;
 	read_preset(cur_preset_path.toLatin1().data());
 }
 
@@ -201,6 +205,27 @@ void Interface::mainGui()
 		connect(btn_midi, SIGNAL(toggled(bool)), this, SLOT(set_output_format(bool)));
 		connect(btn_text, SIGNAL(toggled(bool)), this, SLOT(set_output_format(bool)));
 
+		QStringList str9 = {"Export Results:", "导出结果："};
+		QLabel* label4 = new QLabel(str9[language], this);
+		grid[2] -> addWidget(label4, 3, 0, Qt::AlignRight);
+		QStringList str10 = {"None", "无"};
+		QStringList str11 = {"Binary (.cnr)", "二进制(.cnr)"};
+		combo_export = new QComboBox(this);
+		combo_export -> addItem(str10[language]);
+		combo_export -> addItem(str11[language]);
+		combo_export -> addItem("CSV (.csv)");
+		combo_export -> addItem("JSON Lines (.jsonl)");
+		grid[2] -> addWidget(combo_export, 3, 1, 1, 3);
+		connect(combo_export, SIGNAL(currentIndexChanged(int)), this, SLOT(set_export_format(int)));
+
+		QStringList str12 = {"Memory (MB):", "内存(MB)："};
+		QLabel* label5 = new QLabel(str12[language], this);
+		grid[2] -> addWidget(label5, 4, 0, Qt::AlignRight);
+		edit_memory_budget = new QLineEdit(this);
+		edit_memory_budget -> setFixedWidth(60 * hscale);
+		grid[2] -> addWidget(edit_memory_budget, 4, 1, 1, 2, Qt::AlignLeft);
+		connect(edit_memory_budget, &QLineEdit::editingFinished, this, &Interface::set_memory_budget);
+
 		QPixmap pic2 = QPixmap("icons/go.png");
 		QPushButton* btn2 = new QPushButton(this);
 		btn2 -> setIcon(pic2);
@@ -208,6 +233,14 @@ void Interface::mainGui()
 		btn2 -> setIconSize (QSize(80 * hscale, 50 * hscale));
 		grid[2] -> addWidget(btn2, 0, 5, 3, 1, Qt::AlignCenter);
 		connect(btn2, &QPushButton::clicked, this, &Interface::run);
+
+		QStringList str13 = {"Estimate", "预估"};
+		QPushButton* btn3 = new QPushButton(str13[language], this);
+		grid[2] -> addWidget(btn3, 3, 5, 2, 1, Qt::AlignCenter);
+		connect(btn3, &QPushButton::clicked, this, &Interface::estimate);
+		label_estimate = new QLabel(this);
+		label_estimate -> setWordWrap(true);
+		grid[2] -> addWidget(label_estimate, 5, 0, 1, 6);
 	}
 
 	{
@@ -573,8 +606,10 @@ void Interface::initMain()
 		case MidiOnly: btn_midi -> setChecked(true);  break;
 		case TextOnly: btn_text -> setChecked(true);  break;
 	}
+	combo_export -> setCurrentIndex(export_format);
 
 	QString str;
+	edit_memory_budget -> setText(str.setNum(memory_budget));
 	if(continual)
 		edit_loop_count -> setText(str.setNum(loop_count));
 	else  edit_loop_count -> setText("/");
@@ -794,59 +829,12 @@ void Interface::import_preset()
 	}
 }
 
-int Interface::read_data(ifstream& fin, char* data)
-// Reads the closest string beginning from '=' (not included) to ';' (not included) and saves it to 'data'.
-// The data will also be converted to bool or int and the function returns the value.
-{
-	fin.getline(data, 100, '=');
-	fin.get();
-	fin.getline(data, 200, ';');
-	if(strcmp(data, "true") == 0)
-		return 1;
-	else if(strcmp(data, "false") == 0)
-		return 0;
-	return atoi(data);
-}
-
-void Interface::read_vec(ifstream& fin, char* str, vector<int>& v)
-{
-	read_data(fin, str);
-	int pos1 = 1, pos2 = 0, len = strlen(str) - 1, num;
-	char temp[5];
-	v.clear();
-	while(pos1 < len)
-	{
-		pos2 = 0;
-		while(pos1 < len && str[pos1] == ' ')
-			++pos1;
-		if(pos1 == len)  break;
-		while(pos1 < len && str[pos1] != ' ')
-		{
-			temp[pos2] = str[pos1];
-			++pos1;  ++pos2;
-		}
-		temp[pos2] = '\0';
-		num = atoi(temp);
-		v.push_back(num);
-	}
-}
-
 void Interface::read_preset(char* filename)
 {
-	ifstream fin(filename);
-	char str[200];
-
-	read_data(fin, str);
-	cur_preset[English] = str;
-	read_data(fin, str);
-	cur_preset[Chinese] = str;
-	read_data(fin, str);
-	if(strcmp(str, "Chinese") == 0)
-		language = Chinese;
-	else  language = English;
-
-	read_data(fin, output_name);
-	read_data(fin, output_path);
+	char title[2][100];
+	if(!Chord::read_preset(filename, title, have_set_overall_scale))  return;
+	cur_preset[English] = title[English];
+	cur_preset[Chinese] = title[Chinese];
 	if(strcmp(output_path, "'DESKTOP'") == 0)
 	{
 #if __WIN32
@@ -869,182 +857,13 @@ void Interface::read_preset(char* filename)
 		strcpy(output_path, "~/Desktop/");
 #endif
 	}
-	read_data(fin, str);
-	continual = (strcmp(str, "continual") == 0);
-	read_data(fin, str);
-	if(strcmp(str, "Both") == 0)  output_mode = Both;
-	else if(strcmp(str, "TextOnly") == 0)  output_mode = TextOnly;
-	else if(strcmp(str, "MidiOnly") == 0)  output_mode = MidiOnly;
-
-	if(continual)
-		loop_count = read_data(fin, str);
-	lowest = read_data(fin, str);
-	highest = read_data(fin, str);
-	m_min = read_data(fin, str);
-	m_max = read_data(fin, str);
-	n_min = read_data(fin, str);
-	n_max = read_data(fin, str);
-	m_unchanged = read_data(fin, str);
-	nm_same = read_data(fin, str);
-
-	read_data(fin, database_filename);
-	read_data(fin, database[English]);
-	read_data(fin, database[Chinese]);
-	database_size = read_data(fin, str);
-
-	read_data(fin, str);
-	automatic = (strcmp(str, "automatic") == 0);
-	connect_pedal = read_data(fin, str);
-	interlace = read_data(fin, str);
-	read_data(fin, str);
-	if(strcmp(str, "RemoveDupType") == 0)   unique_mode = RemoveDupType;
-	else if(strcmp(str, "RemoveDup") == 0)  unique_mode = RemoveDup;
-	else if(strcmp(str, "Disabled") == 0)   unique_mode = Disabled;
-
-	have_set_overall_scale = read_data(fin, str);
-	read_vec(fin, str, overall_scale);
-
-	for(int i = 3; i <= 7; ++i)
-		read_vec(fin, str, omission[i]);
-	read_vec(fin, str, bass_avail);
-
-	read_data(fin, str);
-	if(strcmp(str, "Interval") == 0)   align_mode = Interval;
-	else if(strcmp(str, "List") == 0)  align_mode = List;
-	else if(strcmp(str, "Unlimited") == 0)   align_mode = Unlimited;
-	switch(align_mode)
-	{
-		case Interval:
-		{
-			i_low = read_data(fin, str);
-			i_high = read_data(fin, str);
-			i_min = read_data(fin, str);
-			i_max = read_data(fin, str);
-			strcpy(align_db[Chinese], "未选择");
-			strcpy(align_db[English], "Not selected");
-			strcpy(align_db_filename, "N/A");
-			align_db_size = 0;
-			break;
-		}
-		case List:
-		{
-			read_data(fin, align_db_filename);
-			read_data(fin, align_db[English]);
-			read_data(fin, align_db[Chinese]);
-			align_db_size = read_data(fin, str);
-			i_low = 3;    i_high = 11;
-			i_min = 1;    i_max = 8;
-			break;
-		}
-		case Unlimited:  break;
-	}
-
-	enable_pedal = read_data(fin, str);
-	in_bass = read_data(fin, str);
-	if(in_bass)
-	{
-		read_vec(fin, str, pedal_notes);
-		pedal_notes_set.clear();
-	}
-	else
-	{
-		read_vec(fin, str, pedal_notes_set);
-		pedal_notes.clear();
-	}
-	realign = read_data(fin, str);
-	period = read_data(fin, str);
-
-	read_data(fin, str);
-	if(strcmp(str, "Percentage") == 0)    vl_setting = Percentage;
-	else if(strcmp(str, "Number") == 0)   vl_setting = Number;
-	else if(strcmp(str, "Default") == 0)  vl_setting = Default;
-	enable_steady = read_data(fin, str);
-	enable_ascending = read_data(fin, str);
-	enable_descending = read_data(fin, str);
-	steady_min = read_data(fin, str);
-	steady_max = read_data(fin, str);
-	ascending_min = read_data(fin, str);
-	ascending_max = read_data(fin, str);
-	descending_min = read_data(fin, str);
-	descending_max = read_data(fin, str);
-	custom_vl_range = read_data(fin, str);
-	vl_min = read_data(fin, str);
-	vl_max = read_data(fin, str);
-	enable_rm = read_data(fin, str);
-	if(enable_rm)  read_vec(fin, str, rm_priority);
-	enable_ex = read_data(fin, str);
-	if(enable_ex)
-	{
-		read_data(fin, exclusion);
-		set_ex();
-	}
-	enable_sim = read_data(fin, str);
-	if(enable_sim)
-	{
-		read_data(fin, str_sim);
-		set_sim();
-	}
-
-	t_min = read_data(fin, str);  t_max = read_data(fin, str);
-	k_min = read_data(fin, str);  k_max = read_data(fin, str);
-	c_min = read_data(fin, str);  c_max = read_data(fin, str);
-	s_min = read_data(fin, str);  s_max = read_data(fin, str);
-  ss_min = read_data(fin, str); ss_max = read_data(fin, str);
-	h_min = read_data(fin, str);  h_max = read_data(fin, str);
-	g_min = read_data(fin, str);  g_max = read_data(fin, str);
-  sv_min = read_data(fin, str); sv_max = read_data(fin, str);
-	q_min = read_data(fin, str);  q_max = read_data(fin, str);
-	x_min = read_data(fin, str);  x_max = read_data(fin, str);
-  kk_min = read_data(fin, str); kk_max = read_data(fin, str);
-	r_min = read_data(fin, str);  r_max = read_data(fin, str);
-	read_data(fin, sort_order);
-
-	read_data(fin, str_ante_notes);
-	read_data(fin, str_post_notes);
-	hide_octave = read_data(fin, str);
-	read_data(fin, str);
-	if(strcmp(str, "Postchord") == 0)  object = Postchord;
-	else if(strcmp(str, "Antechord") == 0)   object = Antechord;
-	else if(strcmp(str, "BothChords") == 0)  object = BothChords;
-	test_all = read_data(fin, str);
-	sample_size = read_data(fin, str);
-	read_data(fin, str);
-	detailed_ref = (strcmp(str, "customized") == 0);
-	read_data(fin, output_name_sub);
-	read_data(fin, str);
-	if(strcmp(str, "Both") == 0)  output_mode_sub = Both;
-	else if(strcmp(str, "TextOnly") == 0)  output_mode_sub = TextOnly;
-	else if(strcmp(str, "MidiOnly") == 0)  output_mode_sub = MidiOnly;
-
-	p_reset_value = read_data(fin, str);  p_radius = read_data(fin, str);
-	n_reset_value = read_data(fin, str);  n_radius = read_data(fin, str);
-	t_reset_value = read_data(fin, str);  t_radius = read_data(fin, str);
-	k_reset_value = read_data(fin, str);  k_radius = read_data(fin, str);
-	c_reset_value = read_data(fin, str);  c_radius = read_data(fin, str);
-	s_reset_value = read_data(fin, str);  s_radius = read_data(fin, str);
-  ss_reset_value = read_data(fin, str); ss_radius = read_data(fin, str);
-  sv_reset_value = read_data(fin, str); sv_radius = read_data(fin, str);
-	q_reset_value = read_data(fin, str);  q_radius = read_data(fin, str);
-	x_reset_value = read_data(fin, str);  x_radius = read_data(fin, str);
-  kk_reset_value = read_data(fin, str); kk_radius = read_data(fin, str);
-	r_reset_value = read_data(fin, str);  r_radius = read_data(fin, str);
-	read_data(fin, reset_list);
-	read_data(fin, percentage_list);
-	read_data(fin, sort_order_sub);
 
 	have_set_omission  = false;
 	have_set_alignment = false;
 	have_set_inversion = false;
-	fin.close();
 	if(language == Chinese)
 		set_to_Chinese();
 	else  set_to_English();
-
-	if(!automatic)
-	{
-		read_data(fin, str_notes);
-		set_notes(notes, edit_initial);
-	}
 }
 
 void Interface::set_to_Chinese()
@@ -1150,6 +969,22 @@ void Interface::set_output_format(bool state)
 		cb_interlace -> setEnabled(true);
 }
 
+void Interface::set_export_format(int index)
+{
+	export_format = (ExportFormat)index;
+}
+
+void Interface::set_memory_budget()
+{
+	memory_budget = (edit_memory_budget -> text()).toInt();
+	QString str;
+	if(memory_budget <= 0)
+	{
+		edit_memory_budget -> setText(str.setNum(DEFAULT_MEMORY_BUDGET));
+		memory_budget = DEFAULT_MEMORY_BUDGET;
+	}
+}
+
 void Interface::set_loop_count()
 {
 	loop_count = (edit_loop_count -> text()).toInt();
@@ -1426,82 +1261,8 @@ void Interface::input_initial()
 
 void Interface::set_notes(vector<int>& notes, QLineEdit* edit)
 {
-	notes.clear();
-	QString str_notes = edit -> text();
-	char _note[50];
-	int note;
-	int pos1 = 0, pos2 = 0, len = str_notes.size();
-	bool no_octave = true;
-	if(len >= 45)
-	{
+	if(!parse_chord(edit -> text().toLatin1().data(), notes))
 		edit -> clear();
-		notes.clear();
-		return;
-	}
-	while(pos1 < len)
-	{
-		pos2 = 0;
-		while(pos1 < len && str_notes[pos1] == ' ')
-			++pos1;
-		if(pos1 == len)  break;
-		while(pos1 < len && str_notes[pos1] != ' ')
-		{
-			_note[pos2] = str_notes[pos1].toLatin1();
-			++pos1;  ++pos2;
-		}
-		_note[pos2] = '\0';
-		int _len = strlen(_note);
-		if(_note[0] >= '0' && _note[0] <= '9')
-		{
-			note = atoi(_note);
-			no_octave = false;
-		}
-		else
-		{
-			note = nametonum(_note);
-			if(_note[_len - 1] >= '0' && _note[_len - 1] <= '9')
-				no_octave = false;
-		}
-		if(note < 0)
-		{
-			edit -> clear();
-			notes.clear();
-			return;
-		}
-		notes.push_back(note);
-	}
-
-	if(no_octave)
-	{
-		t_size = notes.size();
-		for(int i = t_size - 1; i > 0; --i)
-		{
-			if(notes[i - 1] > notes[i])
-			{
-				int octave = (notes[i - 1] - notes[i]) / 12;
-				notes[i - 1] -= (octave + 1) * 12;
-			}
-			int octave_h = (127 - notes[i]) / 12;
-			int octave_l = floor(notes[0] / 12);
-			if(octave_h + octave_l < 0)
-			{
-				edit -> clear();
-				notes.clear();
-				return;
-			}
-			else
-			{
-				int octave = (octave_h - octave_l) / 2;
-				for(int i = 0; i < t_size; ++i)
-					notes[i] += octave * 12;
-			}
-		}
-	}
-	else
-	{
-		bubble_sort(notes);
-		remove_duplicate(notes);
-	}
 }
 
 void Interface::set_connect_pedal(int state)
@@ -1545,13 +1306,16 @@ void Interface::open_utilities()
 	 QDesktopServices::openUrl(QUrl( ((QString)"file:%1/utilities").arg(root_path) ));
 }
 
-void Interface::run()
+bool Interface::prepare_run()
 {
 	QStringList str1 = {"Warning", "警告"};
 	char path1[200], path2[200];
 	strcpy(path1, "../db/chord/");
 	strcat(path1, database_filename);
+	reset_metrics();
+	StageTimer database_timer(stage_stats[StageDatabase]);
 	dbentry(path1);
+	stage_stats[StageDatabase].out += chord_library.size();
 
 	if(align_mode == List)
 	{
@@ -1561,13 +1325,15 @@ void Interface::run()
 									  "Please import an alignment database (.db) file in 'Set alignment' window.",
 									  "提示：检测到您已选择自定义和弦排列，但未导入排列库(.db)文件。请于设置排列方式处导入排列库(.db)文件。"};
 			QMessageBox::warning(this, str1[language], str2[language], QMessageBox::Close);
-			return;
+			return false;
 		}
 		strcpy(path2, "../db/align/");
 		strcat(path2, align_db_filename);
 		read_alignment(path2);
 	}
+	database_timer.stop();
 
+	StageTimer initial_timer(stage_stats[StageInitial]);
 	if(automatic)  choose_initial();
 	else
 	{
@@ -1575,9 +1341,16 @@ void Interface::run()
 		catch(const char* msg)
 		{
 			QMessageBox::warning(this, str1[language], msg, QMessageBox::Close);
-			return;
+			return false;
 		}
 	}
+	return true;
+}
+
+void Interface::run()
+{
+	QStringList str1 = {"Warning", "警告"};
+	if(!prepare_run())  return;
 
 	vector<int> temp1(rm_priority);
 	rm_priority.assign(7, -1);
@@ -1596,20 +1369,19 @@ void Interface::run()
 	prgdialog -> setWindowFlag(Qt::WindowMinMaxButtonsHint, false);
 	prgdialog -> setWindowFlag(Qt::WindowCloseButtonHint, false);
 	prgdialog -> setWindowFlag(Qt::WindowContextHelpButtonHint, false);
-	prgdialog -> setWindowModality(Qt::WindowModal);
+	prgdialog -> setWindowModality(Qt::ApplicationModal);
 	prgdialog -> setAutoClose(false);
 	prgdialog -> setAutoReset(false);
+	prgdialog -> setMinimumDuration(0);
 
 	bool b = false;
-	try{ Main(); }
+	try{ run_job(prgdialog, [this]{ Main(); }); }
 	catch(const char* msg)
 	{
 		prgdialog -> close();
 		QMessageBox::warning(this, str1[language], msg, QMessageBox::Close);
 		rm_priority.assign(temp1.begin(), temp1.end());
 		notes.assign(temp2.begin(), temp2.end());
-		if(fout.is_open())  fout.close();
-		if(m_fout.is_open())  m_fout.close();
 		return;
 	}
 	catch(int num)
@@ -1617,8 +1389,6 @@ void Interface::run()
 		prgdialog -> close();
 		rm_priority.assign(temp1.begin(), temp1.end());
 		notes.assign(temp2.begin(), temp2.end());
-		if(fout.is_open())  fout.close();
-		if(m_fout.is_open())  m_fout.close();
 		b = true;
 	}
 	catch(...)
@@ -1630,8 +1400,6 @@ void Interface::run()
 		QMessageBox::critical(this, str12[language], str13[language], QMessageBox::Close);
 		rm_priority.assign(temp1.begin(), temp1.end());
 		notes.assign(temp2.begin(), temp2.end());
-		if(fout.is_open())  fout.close();
-		if(m_fout.is_open())  m_fout.close();
 		return;
 	}
 
@@ -1668,3 +1436,109 @@ void Interface::run()
 	rm_priority.assign(temp1.begin(), temp1.end());
 	notes.assign(temp2.begin(), temp2.end());
 }
+
+void Chord::show_progress(QProgressDialog* dialog)
+// Called on the GUI thread every 'PROGRESS_INTERVAL' milliseconds while a job runs.
+// This is the only place where the dialog is touched, so the job itself never waits for the GUI.
+{
+	if(dialog -> wasCanceled())  progress -> canceled = true;
+	const int value = progress -> value, maximum = progress -> maximum;
+	if(est_stage != progress -> stage)
+	{
+		est = RateEstimator();
+		est_stage = progress -> stage;
+	}
+	update_rate(est, value, progress -> items);
+
+	QString text;
+	{
+		lock_guard<mutex> guard(progress -> lock);
+		text = progress -> label;
+		if(progress -> timed && value < maximum)
+			text += est_time(maximum);
+		text += progress -> detail;
+	}
+	if(dialog -> maximum() != maximum)
+		dialog -> setMaximum(maximum);
+	dialog -> setLabelText(text);
+	dialog -> setValue(value);
+}
+
+void Interface::run_job(QProgressDialog* dialog, const function<void()>& job)
+// Runs 'job' on a worker thread, so that the windows keep responding while it runs.
+// Meanwhile the event loop shows 'progress' in 'dialog' (see 'show_progress'), which is modal
+// so that the settings can not be changed by the user. The worker takes over the thread-local
+// settings of the GUI thread and closes its files if the job stops early. An exception thrown
+// by 'job' is thrown again here after the worker has ended.
+// Without a dialog, the job is a short one and simply runs on the GUI thread.
+{
+	exception_ptr error;
+	auto run = [&]()
+	{
+		try{ job(); }
+		catch(...)
+		{
+			error = current_exception();
+			close_files();
+		}
+		wait_writer();
+	};
+
+	progress -> canceled = false;
+	if(dialog == nullptr)  run();
+	else
+	{
+		JobState state;
+		save_job_state(state);
+		QEventLoop loop;
+		QTimer timer;
+		connect(&timer, &QTimer::timeout, [&]{ show_progress(dialog); });
+		timer.start(PROGRESS_INTERVAL);
+		std::thread worker([&]()
+		{
+			load_job_state(state);
+			run();
+			QMetaObject::invokeMethod(&loop, "quit", Qt::QueuedConnection);
+		});
+		loop.exec();
+		worker.join();
+		timer.stop();
+	}
+	if(error)  rethrow_exception(error);
+}
+
+void Interface::estimate()
+// shows in 'label_estimate' what a run with the current settings would cost (see 'estimate_cost')
+{
+	vector<int> temp2(notes);
+	if(!prepare_run())  return;
+	vector<int> temp1(rm_priority);
+	rm_priority.assign(7, -1);
+	for(int i = 0; i < (int)temp1.size(); ++i)
+		rm_priority[temp1[i]] = i;
+
+	QApplication::setOverrideCursor(Qt::WaitCursor);
+	CostEstimate cost;
+	estimate_cost(cost);
+	QApplication::restoreOverrideCursor();
+	rm_priority.assign(temp1.begin(), temp1.end());
+	notes.assign(temp2.begin(), temp2.end());
+
+	QString str;
+	QStringList str1 = {"Estimate: %1 candidates", "预估：%1 个候选"};
+	QStringList str2 = {" per progression", "（每个进行）"};
+	QStringList str3 = {", about %1", "，约 %1"};
+	QStringList str4 = {"; about %1 results", "；约 %1 个结果"};
+	QStringList str5 = {"; peak memory about %1 MB", "；内存峰值约 %1 MB"};
+	QStringList str6 = {" (the rest is spilled to disk)", "（超出部分写入磁盘）"};
+	QStringList str7 = {" (from %1 samples)", "（基于 %1 个样本）"};
+	str = str1[language].arg(count_text(cost.candidates));
+	if(continual)  str += str2[language];
+	str += str3[language].arg(time_text(cost.seconds));
+	str += str4[language].arg(count_text(cost.results));
+	if(continual)  str += str2[language];
+	str += str5[language].arg(cost.memory / (1 << 20), 0, 'f', 1);
+	if(cost.spilled)  str += str6[language];
+	str += str7[language].arg(cost.samples);
+	label_estimate -> setText(str);
+}
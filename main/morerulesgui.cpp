@@ -714,181 +714,8 @@ void Interface::input_ex()
 
 void Interface::set_ex()
 {
-	exclusion_notes.clear();
-	exclusion_roots.clear();
-	exclusion_intervals.clear();
-	char str[5], ch;
-	QString text = exclusion;
-	int num, pos1 = 0, pos2 = 0, len = text.size();
-	if(len >= 100)
-	{
+	if(!parse_exclusion())
 		edit_custom_ex -> clear();
-		return;
-	}
-	while(pos1 < len)
-	{
-		ch = text[pos1].toLatin1();
-		if(ch == ' ')
-		{
-			++pos1;
-			continue;
-		}
-		else if(ch > '0' && ch < '9')
-		{
-			pos2 = 0;
-			while(pos1 < len && text[pos1] != ' ')
-			{
-				str[pos2] = text[pos1].toLatin1();
-				++pos1;  ++pos2;
-			}
-			str[pos2] = '\0';
-			num = ((QString)str).toInt();
-			exclusion_notes.push_back(num);
-		}
-		else if(ch == 'r')
-		{
-			++pos1;  pos2 = 0;
-			while(pos1 < len && text[pos1] != ' ')
-			{
-				str[pos2] = text[pos1].toLatin1();
-				++pos1;  ++pos2;
-			}
-			str[pos2] = '\0';
-			num = ((QString)str).toInt();
-			exclusion_roots.push_back(num);
-		}
-		else if(ch == '\\')
-		{
-			ch = text[++pos1].toLatin1();
-			if(ch == '\\')
-			{
-				++pos1;  pos2 = 0;
-				while(pos1 < len && text[pos1] != ' ' && text[pos1] != '(' && text[pos1] != '[')
-				{
-					str[pos2] = text[pos1].toLatin1();
-					++pos1;  ++pos2;
-				}
-				str[pos2] = '\0';
-				num = ((QString)str).toInt();
-				intervalData data = {0, 0, 10, 1, 200};
-				data.interval = num;
-				int temp1, temp2;
-				for(int k = 0; k < 2; ++k)
-				{
-					if(text[pos1] == '(')
-					{
-						++pos1;  pos2 = 0;
-						while(pos1 < len && text[pos1] != '-' && text[pos1] != ')')
-						{
-							str[pos2] = text[pos1].toLatin1();
-							++pos1;  ++pos2;
-						}
-						str[pos2] = '\0';
-						temp1 = ((QString)str).toInt();
-						if(text[pos1] == '-')
-						{
-							++pos1;  pos2 = 0;
-							while(pos1 < len && text[pos1] != ')')
-							{
-								str[pos2] = text[pos1].toLatin1();
-								++pos1;  ++pos2;
-							}
-							str[pos2] = '\0';
-							temp2 = ((QString)str).toInt();
-							data.num_min = temp1;
-							data.num_max = temp2;
-						}
-						else  data.num_min = temp1;
-						++pos1;
-					}
-					else if(text[pos1] == '[')
-					{
-						++pos1;  pos2 = 0;
-						while(pos1 < len && text[pos1] != '-' && text[pos1] != ']')
-						{
-							str[pos2] = text[pos1].toLatin1();
-							++pos1;  ++pos2;
-						}
-						str[pos2] = '\0';
-						temp1 = ((QString)str).toInt();
-						if(text[pos1] == '-')
-						{
-							++pos1;  pos2 = 0;
-							while(pos1 < len && text[pos1] != ']')
-							{
-								str[pos2] = text[pos1].toLatin1();
-								++pos1;  ++pos2;
-							}
-							str[pos2] = '\0';
-							temp2 = ((QString)str).toInt();
-							data.octave_min = temp1;
-							data.octave_max = temp2;
-						}
-						else  data.octave_max = temp1;
-						++pos1;
-					}
-				}
-				exclusion_intervals.push_back(data);
-			}
-			else
-			{
-				pos2 = 0;
-				while(pos1 < len && text[pos1] != ' ' && text[pos1] != '(')
-				{
-					str[pos2] = text[pos1].toLatin1();
-					++pos1;  ++pos2;
-				}
-				str[pos2] = '\0';
-				num = ((QString)str).toInt();
-				intervalData data = {0, 0, 0, 1, 200};
-				data.interval = num;
-				int temp1, temp2;
-				if(text[pos1] == '(')
-				{
-					++pos1;  pos2 = 0;
-					while(pos1 < len && text[pos1] != '-' && text[pos1] != ')')
-					{
-						str[pos2] = text[pos1].toLatin1();
-						++pos1;  ++pos2;
-					}
-					str[pos2] = '\0';
-					temp1 = ((QString)str).toInt();
-					if(text[pos1] == '-')
-					{
-						++pos1;  pos2 = 0;
-						while(pos1 < len && text[pos1] != ')')
-						{
-							str[pos2] = text[pos1].toLatin1();
-							++pos1;  ++pos2;
-						}
-						str[pos2] = '\0';
-						temp2 = ((QString)str).toInt();
-						data.num_min = temp1;
-						data.num_max = temp2;
-					}
-					else  data.num_min = temp1;
-				}
-				++pos1;
-				exclusion_intervals.push_back(data);
-			}
-		}
-		else
-		{
-			pos2 = 0;
-			str[0] = ch;
-			while(pos1 < len && text[pos1] != ' ')
-			{
-				str[pos2] = text[pos1].toLatin1();
-				++pos1;  ++pos2;
-			}
-			str[pos2] = '\0';
-			num = nametonum(str);
-			if(num > 0)
-				exclusion_notes.push_back(num);
-		}
-	}
-	bubble_sort(exclusion_notes);
-	bubble_sort(exclusion_roots);
 }
 
 void Interface::enable_custom_sim(bool state)
@@ -914,65 +741,8 @@ void Interface::input_sim()
 
 void Interface::set_sim()
 {
-	sim_min.clear();
-	sim_max.clear();
-	sim_period.clear();
-	char str[5], ch;
-	QString text = str_sim;
-	int num, pos1 = 0, pos2 = 0, len = text.size();
-	if(len >= 100)
-	{
+	if(!parse_sim())
 		edit_custom_sim -> clear();
-		return;
-	}
-	while(pos1 < len)
-	{
-		ch = text[pos1].toLatin1();
-		if(ch == ' ')
-		{
-			++pos1;
-			continue;
-		}
-		else if(ch > '0' && ch < '9')
-		{
-			pos2 = 0;
-			while(pos1 < len && text[pos1] != '-')
-			{
-				str[pos2] = text[pos1].toLatin1();
-				++pos1;  ++pos2;
-			}
-			str[pos2] = '\0';
-			num = ((QString)str).toInt();
-			sim_period.push_back(num);
-
-			++pos1;  pos2 = 0;
-			while(pos1 < len && text[pos1] != '-')
-			{
-				str[pos2] = text[pos1].toLatin1();
-				++pos1;  ++pos2;
-			}
-			str[pos2] = '\0';
-			num = ((QString)str).toInt();
-			sim_min.push_back(num);
-
-			++pos1;  pos2 = 0;
-			while(pos1 < len && text[pos1] != ' ')
-			{
-				str[pos2] = text[pos1].toLatin1();
-				++pos1;  ++pos2;
-			}
-			str[pos2] = '\0';
-			num = ((QString)str).toInt();
-			sim_max.push_back(num);
-		}
-		else
-		{
-			sim_min.clear();
-			sim_max.clear();
-			sim_period.clear();
-			return;
-		}
-	}
 }
 
 void Interface::closeMoreRules()
@@ -0,0 +1,675 @@
+// ChordNova v3.0 [Build: 2021.1.14]
+// (c) 2020 Wenge Chen, Ji-woon Sim.
+// preset.cpp
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include "chord.h"
+#include "functions.h"
+using namespace std;
+
+int read_data(istream& fin, char* data, const int& size)
+// Reads the closest string beginning from '=' (not included) to ';' (not included) and saves it to 'data',
+// which holds 'size' characters. Throws if the key or the value does not fit.
+// The data will also be converted to bool or int and the function returns the value.
+{
+	char key[100];
+	fin.getline(key, 100, '=');
+	if(fin.fail() && !fin.eof())
+		throw "ERROR - a key in the preset is too long.";
+	fin.get();
+	fin.getline(data, size, ';');
+	if(fin.fail() && !fin.eof())
+		throw "ERROR - a value in the preset is too long for its field.";
+	if(strcmp(data, "true") == 0)
+		return 1;
+	else if(strcmp(data, "false") == 0)
+		return 0;
+	return atoi(data);
+}
+
+void read_vec(istream& fin, char* str, vector<int>& v)
+// Numbers longer than 4 characters are cut, here and in 'parse_exclusion' and 'parse_sim',
+// so that they fit into the buffers they are read into.
+{
+	read_data(fin, str);
+	int pos1 = 1, pos2 = 0, len = strlen(str) - 1, num;
+	char temp[5];
+	v.clear();
+	while(pos1 < len)
+	{
+		pos2 = 0;
+		while(pos1 < len && str[pos1] == ' ')
+			++pos1;
+		if(pos1 == len)  break;
+		while(pos1 < len && str[pos1] != ' ')
+		{
+			if(pos2 < 4)  temp[pos2++] = str[pos1];
+			++pos1;
+		}
+		temp[pos2] = '\0';
+		num = atoi(temp);
+		v.push_back(num);
+	}
+}
+
+bool Chord::read_preset(const char* filename, char title[][100], bool& scale_set)
+// Returns false if the file cannot be opened or a value in it is too long for its field.
+{
+	ifstream fin(filename);
+	if(!fin.is_open())  return false;
+	try
+	{
+		read_preset(fin, title, scale_set);
+	}
+	catch(const char*)  { return false; }
+	fin.close();
+	return true;
+}
+
+void Chord::read_preset(istream& fin, char title[][100], bool& scale_set)
+// Assigns values to variables from a preset. 'title' receives the English and Chinese title of the preset,
+// and 'scale_set' whether the preset has set the overall scale.
+// The output path is left as it is in the preset ('DESKTOP' included).
+{
+	char str[200];
+
+	for(int i = 0; i < 2; ++i)
+	{
+		read_data(fin, str);
+		strncpy(title[i], str, 99);  // titles longer than 99 characters are cut
+		title[i][99] = '\0';
+	}
+	read_data(fin, str);
+	if(strcmp(str, "Chinese") == 0)
+		language = Chinese;
+	else  language = English;
+
+	read_data(fin, output_name, sizeof(output_name));
+	read_data(fin, output_path, sizeof(output_path));
+	read_data(fin, str);
+	continual = (strcmp(str, "continual") == 0);
+	read_data(fin, str);
+	if(strcmp(str, "Both") == 0)  output_mode = Both;
+	else if(strcmp(str, "TextOnly") == 0)  output_mode = TextOnly;
+	else if(strcmp(str, "MidiOnly") == 0)  output_mode = MidiOnly;
+
+	if(continual)
+		loop_count = read_data(fin, str);
+	lowest = read_data(fin, str);
+	highest = read_data(fin, str);
+	m_min = read_data(fin, str);
+	m_max = read_data(fin, str);
+	n_min = read_data(fin, str);
+	n_max = read_data(fin, str);
+	m_unchanged = read_data(fin, str);
+	nm_same = read_data(fin, str);
+
+	read_data(fin, database_filename, sizeof(database_filename));
+	read_data(fin, database[English], sizeof(database[English]));
+	read_data(fin, database[Chinese], sizeof(database[Chinese]));
+	database_size = read_data(fin, str);
+
+	read_data(fin, str);
+	automatic = (strcmp(str, "automatic") == 0);
+	if(!automatic)
+	{
+		// The initial chord is saved right after the input mode (see 'Interface::write_preset').
+		read_data(fin, str_notes, sizeof(str_notes));
+		parse_chord(str_notes, notes);
+	}
+	connect_pedal = read_data(fin, str);
+	interlace = read_data(fin, str);
+	read_data(fin, str);
+	if(strcmp(str, "RemoveDupType") == 0)   unique_mode = RemoveDupType;
+	else if(strcmp(str, "RemoveDup") == 0)  unique_mode = RemoveDup;
+	else if(strcmp(str, "Disabled") == 0)   unique_mode = Disabled;
+
+	scale_set = read_data(fin, str);
+	read_vec(fin, str, overall_scale);
+
+	for(int i = 3; i <= 7; ++i)
+		read_vec(fin, str, omission[i]);
+	read_vec(fin, str, bass_avail);
+
+	read_data(fin, str);
+	if(strcmp(str, "Interval") == 0)   align_mode = Interval;
+	else if(strcmp(str, "List") == 0)  align_mode = List;
+	else if(strcmp(str, "Unlimited") == 0)   align_mode = Unlimited;
+	switch(align_mode)
+	{
+		case Interval:
+		{
+			i_low = read_data(fin, str);
+			i_high = read_data(fin, str);
+			i_min = read_data(fin, str);
+			i_max = read_data(fin, str);
+			strcpy(align_db[Chinese], "未选择");
+			strcpy(align_db[English], "Not selected");
+			strcpy(align_db_filename, "N/A");
+			align_db_size = 0;
+			break;
+		}
+		case List:
+		{
+			read_data(fin, align_db_filename, sizeof(align_db_filename));
+			read_data(fin, align_db[English], sizeof(align_db[English]));
+			read_data(fin, align_db[Chinese], sizeof(align_db[Chinese]));
+			align_db_size = read_data(fin, str);
+			i_low = 3;    i_high = 11;
+			i_min = 1;    i_max = 8;
+			break;
+		}
+		case Unlimited:  break;
+	}
+
+	enable_pedal = read_data(fin, str);
+	in_bass = read_data(fin, str);
+	if(in_bass)
+	{
+		read_vec(fin, str, pedal_notes);
+		pedal_notes_set.clear();
+	}
+	else
+	{
+		read_vec(fin, str, pedal_notes_set);
+		pedal_notes.clear();
+	}
+	realign = read_data(fin, str);
+	period = read_data(fin, str);
+
+	read_data(fin, str);
+	if(strcmp(str, "Percentage") == 0)    vl_setting = Percentage;
+	else if(strcmp(str, "Number") == 0)   vl_setting = Number;
+	else if(strcmp(str, "Default") == 0)  vl_setting = Default;
+	enable_steady = read_data(fin, str);
+	enable_ascending = read_data(fin, str);
+	enable_descending = read_data(fin, str);
+	steady_min = read_data(fin, str);
+	steady_max = read_data(fin, str);
+	ascending_min = read_data(fin, str);
+	ascending_max = read_data(fin, str);
+	descending_min = read_data(fin, str);
+	descending_max = read_data(fin, str);
+	custom_vl_range = read_data(fin, str);
+	vl_min = read_data(fin, str);
+	vl_max = read_data(fin, str);
+	enable_rm = read_data(fin, str);
+	if(enable_rm)  read_vec(fin, str, rm_priority);
+	enable_ex = read_data(fin, str);
+	if(enable_ex)
+	{
+		read_data(fin, exclusion, sizeof(exclusion));
+		parse_exclusion();
+	}
+	enable_sim = read_data(fin, str);
+	if(enable_sim)
+	{
+		read_data(fin, str_sim, sizeof(str_sim));
+		parse_sim();
+	}
+
+	t_min = read_data(fin, str);  t_max = read_data(fin, str);
+	k_min = read_data(fin, str);  k_max = read_data(fin, str);
+	c_min = read_data(fin, str);  c_max = read_data(fin, str);
+	s_min = read_data(fin, str);  s_max = read_data(fin, str);
+  ss_min = read_data(fin, str); ss_max = read_data(fin, str);
+	h_min = read_data(fin, str);  h_max = read_data(fin, str);
+	g_min = read_data(fin, str);  g_max = read_data(fin, str);
+  sv_min = read_data(fin, str); sv_max = read_data(fin, str);
+	q_min = read_data(fin, str);  q_max = read_data(fin, str);
+	x_min = read_data(fin, str);  x_max = read_data(fin, str);
+  kk_min = read_data(fin, str); kk_max = read_data(fin, str);
+	r_min = read_data(fin, str);  r_max = read_data(fin, str);
+	read_data(fin, sort_order, sizeof(sort_order));
+
+	read_data(fin, str_ante_notes, sizeof(str_ante_notes));
+	read_data(fin, str_post_notes, sizeof(str_post_notes));
+	hide_octave = read_data(fin, str);
+	read_data(fin, str);
+	if(strcmp(str, "Postchord") == 0)  object = Postchord;
+	else if(strcmp(str, "Antechord") == 0)   object = Antechord;
+	else if(strcmp(str, "BothChords") == 0)  object = BothChords;
+	else if(strcmp(str, "Sequence") == 0)    object = Sequence;
+	test_all = read_data(fin, str);
+	sample_size = read_data(fin, str);
+	read_data(fin, str);
+	detailed_ref = (strcmp(str, "customized") == 0);
+	read_data(fin, output_name_sub, sizeof(output_name_sub));
+	read_data(fin, str);
+	if(strcmp(str, "Both") == 0)  output_mode_sub = Both;
+	else if(strcmp(str, "TextOnly") == 0)  output_mode_sub = TextOnly;
+	else if(strcmp(str, "MidiOnly") == 0)  output_mode_sub = MidiOnly;
+
+	p_reset_value = read_data(fin, str);  p_radius = read_data(fin, str);
+	n_reset_value = read_data(fin, str);  n_radius = read_data(fin, str);
+	t_reset_value = read_data(fin, str);  t_radius = read_data(fin, str);
+	k_reset_value = read_data(fin, str);  k_radius = read_data(fin, str);
+	c_reset_value = read_data(fin, str);  c_radius = read_data(fin, str);
+	s_reset_value = read_data(fin, str);  s_radius = read_data(fin, str);
+  ss_reset_value = read_data(fin, str); ss_radius = read_data(fin, str);
+  sv_reset_value = read_data(fin, str); sv_radius = read_data(fin, str);
+	q_reset_value = read_data(fin, str);  q_radius = read_data(fin, str);
+	x_reset_value = read_data(fin, str);  x_radius = read_data(fin, str);
+  kk_reset_value = read_data(fin, str); kk_radius = read_data(fin, str);
+	r_reset_value = read_data(fin, str);  r_radius = read_data(fin, str);
+	read_data(fin, reset_list, sizeof(reset_list));
+	read_data(fin, percentage_list, sizeof(percentage_list));
+	read_data(fin, sort_order_sub, sizeof(sort_order_sub));
+}
+
+bool Chord::parse_chord(const char* str, vector<int>& notes)
+// Reads the notes of a chord, written as numbers or note names.
+// If no octave is given, the chord is placed in the middle of the range.
+// Returns false (with 'notes' cleared) if the input is invalid.
+{
+	notes.clear();
+	char _note[50];
+	int note;
+	int pos1 = 0, pos2 = 0, len = strlen(str);
+	bool no_octave = true;
+	if(len >= 45)
+		return false;
+	while(pos1 < len)
+	{
+		pos2 = 0;
+		while(pos1 < len && str[pos1] == ' ')
+			++pos1;
+		if(pos1 == len)  break;
+		while(pos1 < len && str[pos1] != ' ')
+		{
+			_note[pos2] = str[pos1];
+			++pos1;  ++pos2;
+		}
+		_note[pos2] = '\0';
+		int _len = strlen(_note);
+		if(_note[0] >= '0' && _note[0] <= '9')
+		{
+			note = atoi(_note);
+			no_octave = false;
+		}
+		else
+		{
+			note = nametonum(_note);
+			if(_note[_len - 1] >= '0' && _note[_len - 1] <= '9')
+				no_octave = false;
+		}
+		if(note < 0)
+		{
+			notes.clear();
+			return false;
+		}
+		notes.push_back(note);
+	}
+
+	if(no_octave)
+	{
+		t_size = notes.size();
+		for(int i = t_size - 1; i > 0; --i)
+		{
+			if(notes[i - 1] > notes[i])
+			{
+				int octave = (notes[i - 1] - notes[i]) / 12;
+				notes[i - 1] -= (octave + 1) * 12;
+			}
+			int octave_h = (127 - notes[i]) / 12;
+			int octave_l = floor(notes[0] / 12);
+			if(octave_h + octave_l < 0)
+			{
+				notes.clear();
+				return false;
+			}
+			else
+			{
+				int octave = (octave_h - octave_l) / 2;
+				for(int i = 0; i < t_size; ++i)
+					notes[i] += octave * 12;
+			}
+		}
+	}
+	else
+	{
+		bubble_sort(notes);
+		remove_duplicate(notes);
+	}
+	return true;
+}
+
+bool Chord::parse_exclusion()
+// Reads the excluded notes, roots and intervals from 'exclusion'. Returns false if it is too long.
+{
+	exclusion_notes.clear();
+	exclusion_roots.clear();
+	exclusion_intervals.clear();
+	char str[5], ch;
+	const char* text = exclusion;
+	int num, pos1 = 0, pos2 = 0, len = strlen(text);
+	if(len >= 100)
+		return false;
+	while(pos1 < len)
+	{
+		ch = text[pos1];
+		if(ch == ' ')
+		{
+			++pos1;
+			continue;
+		}
+		else if(ch > '0' && ch < '9')
+		{
+			pos2 = 0;
+			while(pos1 < len && text[pos1] != ' ')
+			{
+				if(pos2 < 4)  str[pos2++] = text[pos1];
+				++pos1;
+			}
+			str[pos2] = '\0';
+			num = atoi(str);
+			exclusion_notes.push_back(num);
+		}
+		else if(ch == 'r')
+		{
+			++pos1;  pos2 = 0;
+			while(pos1 < len && text[pos1] != ' ')
+			{
+				if(pos2 < 4)  str[pos2++] = text[pos1];
+				++pos1;
+			}
+			str[pos2] = '\0';
+			num = atoi(str);
+			exclusion_roots.push_back(num);
+		}
+		else if(ch == '\\')
+		{
+			ch = text[++pos1];
+			if(ch == '\\')
+			{
+				++pos1;  pos2 = 0;
+				while(pos1 < len && text[pos1] != ' ' && text[pos1] != '(' && text[pos1] != '[')
+				{
+					if(pos2 < 4)  str[pos2++] = text[pos1];
+					++pos1;
+				}
+				str[pos2] = '\0';
+				num = atoi(str);
+				intervalData data = {0, 0, 10, 1, 200};
+				data.interval = num;
+				int temp1, temp2;
+				for(int k = 0; k < 2; ++k)
+				{
+					if(text[pos1] == '(')
+					{
+						++pos1;  pos2 = 0;
+						while(pos1 < len && text[pos1] != '-' && text[pos1] != ')')
+						{
+							if(pos2 < 4)  str[pos2++] = text[pos1];
+							++pos1;
+						}
+						str[pos2] = '\0';
+						temp1 = atoi(str);
+						if(text[pos1] == '-')
+						{
+							++pos1;  pos2 = 0;
+							while(pos1 < len && text[pos1] != ')')
+							{
+								if(pos2 < 4)  str[pos2++] = text[pos1];
+								++pos1;
+							}
+							str[pos2] = '\0';
+							temp2 = atoi(str);
+							data.num_min = temp1;
+							data.num_max = temp2;
+						}
+						else  data.num_min = temp1;
+						++pos1;
+					}
+					else if(text[pos1] == '[')
+					{
+						++pos1;  pos2 = 0;
+						while(pos1 < len && text[pos1] != '-' && text[pos1] != ']')
+						{
+							if(pos2 < 4)  str[pos2++] = text[pos1];
+							++pos1;
+						}
+						str[pos2] = '\0';
+						temp1 = atoi(str);
+						if(text[pos1] == '-')
+						{
+							++pos1;  pos2 = 0;
+							while(pos1 < len && text[pos1] != ']')
+							{
+								if(pos2 < 4)  str[pos2++] = text[pos1];
+								++pos1;
+							}
+							str[pos2] = '\0';
+							temp2 = atoi(str);
+							data.octave_min = temp1;
+							data.octave_max = temp2;
+						}
+						else  data.octave_max = temp1;
+						++pos1;
+					}
+				}
+				exclusion_intervals.push_back(data);
+			}
+			else
+			{
+				pos2 = 0;
+				while(pos1 < len && text[pos1] != ' ' && text[pos1] != '(')
+				{
+					if(pos2 < 4)  str[pos2++] = text[pos1];
+					++pos1;
+				}
+				str[pos2] = '\0';
+				num = atoi(str);
+				intervalData data = {0, 0, 0, 1, 200};
+				data.interval = num;
+				int temp1, temp2;
+				if(text[pos1] == '(')
+				{
+					++pos1;  pos2 = 0;
+					while(pos1 < len && text[pos1] != '-' && text[pos1] != ')')
+					{
+						if(pos2 < 4)  str[pos2++] = text[pos1];
+						++pos1;
+					}
+					str[pos2] = '\0';
+					temp1 = atoi(str);
+					if(text[pos1] == '-')
+					{
+						++pos1;  pos2 = 0;
+						while(pos1 < len && text[pos1] != ')')
+						{
+							if(pos2 < 4)  str[pos2++] = text[pos1];
+							++pos1;
+						}
+						str[pos2] = '\0';
+						temp2 = atoi(str);
+						data.num_min = temp1;
+						data.num_max = temp2;
+					}
+					else  data.num_min = temp1;
+				}
+				++pos1;
+				exclusion_intervals.push_back(data);
+			}
+		}
+		else
+		{
+			pos2 = 0;
+			str[0] = ch;
+			while(pos1 < len && text[pos1] != ' ')
+			{
+				if(pos2 < 4)  str[pos2++] = text[pos1];
+				++pos1;
+			}
+			str[pos2] = '\0';
+			num = nametonum(str);
+			if(num > 0)
+				exclusion_notes.push_back(num);
+		}
+	}
+	bubble_sort(exclusion_notes);
+	bubble_sort(exclusion_roots);
+	return true;
+}
+
+bool Chord::parse_sim()
+// Reads the similarity rules ("period-min-max") from 'str_sim'. Returns false if it is too long;
+// the rules are cleared if they are invalid.
+{
+	sim_min.clear();
+	sim_max.clear();
+	sim_period.clear();
+	char str[5], ch;
+	const char* text = str_sim;
+	int num, pos1 = 0, pos2 = 0, len = strlen(text);
+	if(len >= 100)
+		return false;
+	while(pos1 < len)
+	{
+		ch = text[pos1];
+		if(ch == ' ')
+		{
+			++pos1;
+			continue;
+		}
+		else if(ch > '0' && ch < '9')
+		{
+			pos2 = 0;
+			while(pos1 < len && text[pos1] != '-')
+			{
+				if(pos2 < 4)  str[pos2++] = text[pos1];
+				++pos1;
+			}
+			str[pos2] = '\0';
+			num = atoi(str);
+			sim_period.push_back(num);
+
+			++pos1;  pos2 = 0;
+			while(pos1 < len && text[pos1] != '-')
+			{
+				if(pos2 < 4)  str[pos2++] = text[pos1];
+				++pos1;
+			}
+			str[pos2] = '\0';
+			num = atoi(str);
+			sim_min.push_back(num);
+
+			++pos1;  pos2 = 0;
+			while(pos1 < len && text[pos1] != ' ')
+			{
+				if(pos2 < 4)  str[pos2++] = text[pos1];
+				++pos1;
+			}
+			str[pos2] = '\0';
+			num = atoi(str);
+			sim_max.push_back(num);
+		}
+		else
+		{
+			sim_min.clear();
+			sim_max.clear();
+			sim_period.clear();
+			return true;
+		}
+	}
+	return true;
+}
+
+bool Chord::parse_sequence(const char* str)
+// Reads a progression for sequence substitution into 'seq_notes'. The chords are separated by '/';
+// only pitch classes matter in substitution, so octaves may be omitted.
+// Returns false (with 'seq_notes' cleared) if a note is not valid.
+{
+	seq_notes.clear();
+	vector<int> chord;
+	char _note[50];
+	int pos1 = 0, pos2, len = strlen(str);
+	while(pos1 <= len)
+	{
+		if(pos1 == len || str[pos1] == '/')
+		{
+			if(!chord.empty())
+				seq_notes.push_back(chord);
+			chord.clear();
+			++pos1;
+			continue;
+		}
+		if(str[pos1] == ' ')
+		{
+			++pos1;
+			continue;
+		}
+		pos2 = 0;
+		while(pos1 < len && str[pos1] != ' ' && str[pos1] != '/')
+		{
+			if(pos2 < 49)  _note[pos2++] = str[pos1];
+			++pos1;
+		}
+		_note[pos2] = '\0';
+		int note = (_note[0] >= '0' && _note[0] <= '9') ? atoi(_note) : nametonum(_note);
+		if(note < 0)
+		{
+			seq_notes.clear();
+			return false;
+		}
+		chord.push_back(note);
+	}
+	return true;
+}
+
+bool override_preset(string& text, const string& key, const string& value)
+// Replaces a value in the text of a preset, so that it can be read with other settings.
+// A key is the text before '='; the keys after the first one on a line are preceded by
+// the part of the first key up to ':' (e.g. "range of notes: max"). If a key occurs more than once,
+// "key#n" stands for its n-th occurrence. Returns false if the key is not found.
+// Only values can be changed: settings that add or remove lines (e.g. the output mode) are kept.
+{
+	string name = key;
+	int occurrence = 1, found = 0;
+	size_t sharp = key.rfind('#');
+	if(sharp != string::npos && sharp + 1 < key.size() &&
+		key.find_first_not_of("0123456789", sharp + 1) == string::npos)
+	{
+		name = key.substr(0, sharp);
+		occurrence = atoi(key.c_str() + sharp + 1);
+	}
+	size_t line_begin = 0;
+	while(line_begin < text.size())
+	{
+		size_t line_end = text.find('\n', line_begin);
+		if(line_end == string::npos)  line_end = text.size();
+		string prefix;
+		size_t pos = line_begin;
+		bool first = true;
+		while(text.compare(line_begin, 2, "//") != 0)
+		{
+			size_t eq = text.find('=', pos), semi = text.find(';', pos);
+			if(eq >= line_end || semi >= line_end || semi < eq)  break;
+			size_t begin = text.find_first_not_of(" \t", pos), end = eq;
+			while(end > begin && (text[end - 1] == ' ' || text[end - 1] == '\t'))
+				--end;
+			string item = text.substr(begin, end - begin);
+			if(first)
+			{
+				size_t colon = item.find(':');
+				if(colon != string::npos)  prefix = item.substr(0, colon + 1) + " ";
+				first = false;
+			}
+			else  item = prefix + item;
+			if(item == name && ++found == occurrence)
+			{
+				// 'read_data' skips the character after '='.
+				text.replace(eq + 1, semi - eq - 1, " " + value);
+				return true;
+			}
+			pos = semi + 1;
+		}
+		line_begin = line_end + 1;
+	}
+	return false;
+}
@@ -230,6 +230,7 @@ void Interface::write_preset()
 		case Postchord:  fout << "substitute object = Postchord;\n";   break;
 		case Antechord:  fout << "substitute object = Antechord;\n";   break;
 		case BothChords: fout << "substitute object = BothChords;\n";  break;
+		case Sequence:   fout << "substitute object = Sequence;\n";    break;
 	}
 	fout << "test all = " << boolalpha << test_all << ";\n"
 		  << "sample size = " << sample_size << ";\n";
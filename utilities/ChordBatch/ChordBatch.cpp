@@ -0,0 +1,75 @@
+// ChordNova-utility-ChordBatch v3.0 [Build: 2021.1.14]
+// Runs the generation jobs (presets and initial chords) of a batch manifest on several threads
+// (substitution jobs only in a build with Qt),
+// and writes the status and time of every job to a summary file. See 'read_manifest' for the manifest.
+// (c) 2021 Wenge Chen, Ji-woon Sim.
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "../../main/chord.h"
+#include "../../main/chord.cpp"
+#include "../../main/chorddata.h"
+#include "../../main/chorddata.cpp"
+#include "../../main/functions.h"
+#include "../../main/functions.cpp"
+#include "../../main/preset.cpp"
+#include "../../main/batch.h"
+#include "../../main/batch.cpp"
+
+using namespace std;
+
+int main(int argc, char* argv[])
+{
+	cout << "[[  ChordNova v3.0 [Build: 2021.1.14]  ]]\n"
+		  << "[[  (c) 2021 Wenge Chen, Ji-woon Sim.  ]]\n\n"
+		  << " > Utility - Chord batch:\n";
+
+	char input[100] = "\0";
+	if(argc > 1)
+	{
+		if(strlen(argv[1]) >= sizeof(input))
+		{
+			cout << " > ERROR - the name of the batch manifest is too long.\n\n";
+			return 1;
+		}
+		strcpy(input, argv[1]);
+	}
+	else
+	{
+		cout << " > Please input the name of the batch manifest (the default extension is '.txt'): ";
+		inputFilename(input, ".txt", true);
+	}
+
+	BatchSettings settings;
+	vector<BatchJob> jobs;
+	try{ read_manifest(input, settings, jobs); }
+	catch(const char* msg)
+	{
+		cout << "\n > " << msg << "\n\n";
+		return 1;
+	}
+	cout << "\n > Running " << jobs.size() << " job(s)...\n";
+	double begin_time = now_seconds();
+	run_batch(settings, jobs);
+	double seconds = now_seconds() - begin_time;
+	write_summary(settings, jobs, seconds);
+
+	int failed = 0;
+	for(int i = 0; i < (int)jobs.size(); ++i)
+	{
+		cout << "   #" << i + 1 << " " << jobs[i].output_name << ": "
+			  << fixed << setprecision(3) << jobs[i].seconds << " s";
+		if(!jobs[i].done)
+		{
+			cout << " - " << jobs[i].message;
+			++failed;
+		}
+		cout << '\n';
+	}
+	cout << "\n > " << jobs.size() - failed << " job(s) done, " << failed << " failed in "
+		  << fixed << setprecision(3) << seconds << " s.\n\n";
+	return failed == 0 ? 0 : 1;
+}
@@ -16,7 +16,8 @@ int main()
 		  << "[[  (c) 2021 Wenge Chen, Ji-woon Sim.  ]]\n\n"
 		  << " > Utility - Chord sect:\n";
 	
-	cout << " > Please input the name of the chord data file (the default extension is '.txt'): ";
+	cout << " > Please input the name of the chord data file, or of an exported result file (.cnr)\n"
+		  << "   (the default extension is '.txt'): ";
 	char input[100] = "\0";
 	inputFilename(input, ".txt", true);
 	
@@ -27,19 +28,15 @@ int main()
 	char output[100] = "\0";
 	inputFilename(output, ".txt", false);
 	
-	ifstream fin(input, ios::in);
+	ChordReader reader;
+	open_chords(input, reader);
 	fout.open(output, ios::trunc);
 	vector<int> notes[2], result;
-	int count = 0, note;
-
-	do{
-		notes[count % 2].clear();
-		do{
-			fin >> note;
-			notes[count % 2].push_back(note);
-		}  while(!fin.eof() && fin.get() != '\n');
-		if(notes[count % 2].size() == 0)  break;
+	int count = 0;
 
+	while(read_chord(reader))
+	{
+		notes[count % 2] = reader.notes;
 		++count;
 		if(count == 1)  continue;
 		if(ch == 'Y' || ch == 'y')
@@ -49,11 +46,11 @@ int main()
 
 		for(int i = 0; i < result.size(); ++i)
 			fout << result[i] << ' ';
-		fout << endl;
-	}  while(!fin.eof());
+		fout << '\n';
+	}
 
 	cout << "\n > Output finished. Now you can close the program.\n\n";
-	fin.close();
+	close_chords(reader);
 	fout.close();
 	system("pause"); 
 	return 0;
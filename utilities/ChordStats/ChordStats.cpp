@@ -24,7 +24,8 @@ int main()
 		  << "[[  (c) 2021 Wenge Chen, Ji-woon Sim.  ]]\n\n"
 		  << " > Utility - Chord stats:\n";
 	
-	cout << " > Please input the name of the chord data file (the default extension is '.txt'): ";
+	cout << " > Please input the name of the chord data file, or of an exported result file (.cnr)\n"
+		  << "   (the default extension is '.txt'): ";
 	char input[100] = "\0";
 	inputFilename(input, ".txt", true);
 	
@@ -55,18 +56,15 @@ int main()
 	for(int i = 0; i < 2 * vl_max + 1; ++i)
 		movement[i].amount = i - vl_max;
 
-	ifstream fin(input, ios::in);
+	ChordReader reader;
+	open_chords(input, reader);
 	vector<int> notes;
-	int note, count = 0, cardinal_change = 0;
+	int count = 0, cardinal_change = 0;
 	vector<Chord> rec;
 
-	do{
-		notes.clear();
-		do{
-			fin >> note;
-			notes.push_back(note);
-		}  while(fin && !fin.eof() && fin.get() != '\n');
-		if(!fin || notes.size() == 0)  break;
+	while(read_chord(reader))
+	{
+		notes = reader.notes;
 
 		if(count == 0)
 		{
@@ -108,18 +106,20 @@ int main()
 
 		if(rec.rbegin() -> get_s_size() != (rec.rbegin() + 1) -> get_s_size())
 			++cardinal_change;
-	}  while(!fin.eof());
-	fin.close();
+	}
+	close_chords(reader);
 
 	if(detail)
 	{
 		rec[0].printInitial(language);
+		tflush();
 		for(int i = 1; i < rec.size(); ++i)
 		{
 			if(language == English)
 				fout << "Progression #" << i << ":\n";
 			else  fout << "ҽ #" << i << ":\n";
 			rec[i - 1].print( static_cast<ChordData&>(rec[i]), language );
+			tflush();
 		}
 
 		if(language == Chinese)
@@ -16,7 +16,8 @@ int main()
 		  << "[[  (c) 2021 Wenge Chen, Ji-woon Sim.  ]]\n\n"
 		  << " > Utility - Chord trans:\n";
 	
-	cout << " > Please input the name of the chord data file (the default extension is '.txt'): ";
+	cout << " > Please input the name of the chord data file, or of an exported result file (.cnr)\n"
+		  << "   (the default extension is '.txt'): ";
 	char input[100] = "\0";
 	inputFilename(input, ".txt", true);
 	
@@ -37,28 +38,15 @@ int main()
 	char output[100] = "\0";
 	inputFilename(output, ".txt", false);
 	
-	ifstream fin(input, ios::in);
+	ChordReader reader;
+	open_chords(input, reader);
 	fout.open(output, ios::trunc);
 	vector<int> notes, result;
-	int note;
 
-	do{
-		notes.clear();
+	while(read_chord(reader))
+	{
+		notes = reader.notes;
 		result.clear();
-		while(true)
-		{
-			fin >> note;
-			notes.push_back(note);
-			if( fin.eof() )  break;
-			if(fin.peek() == '\n')
-			{
-				while(!fin.eof() && fin.peek() == '\n')
-					fin.get();
-				break;
-			}
-		}
-		if(notes.size() == 0)  break;
-
 		for(int i = 0; i < notes.size(); ++i)
 			notes[i] += trans;
 		if(axis == 0)
@@ -76,11 +64,11 @@ int main()
 			if(i != 0)  fout << ' ';
 			fout << result[i];
 		}
-		fout << endl;
-	}  while(!fin.eof());
+		fout << '\n';
+	}
 
 	cout << "\n > Output finished. Now you can close the program.\n\n";
-	fin.close();
+	close_chords(reader);
 	fout.close();
 	system("pause"); 
 	return 0;
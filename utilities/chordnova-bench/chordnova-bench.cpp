@@ -0,0 +1,385 @@
+// ChordNova-utility-chordnova-bench v3.0 [Build: 2021.1.14]
+// Measures the kernels the generation spends its time in, each over a fixed corpus of chords drawn
+// with a fixed seed, so that runs before and after a change of the engine can be compared.
+// For every kernel the time and the heap allocations (of this thread) per operation are printed.
+// With '--csv' the same is printed as CSV, which can be given to a later run as '--baseline'.
+// (c) 2021 Wenge Chen, Ji-woon Sim.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "../../main/chord.h"
+#include "../../main/chord.cpp"
+#include "../../main/chorddata.h"
+#include "../../main/chorddata.cpp"
+#include "../../main/functions.h"
+#include "../../main/functions.cpp"
+#include "../../main/preset.cpp"
+
+using namespace std;
+
+const int CORPUS_SIZE = 1024;   // chords of every corpus
+const int LOWEST_NOTE = 36, HIGHEST_NOTE = 96;
+const int DB_SIZE = 300;        // chord types of the database read by 'dbentry'
+const int ROUNDS = 5;           // see 'measure'
+
+const char usage[] =
+	"Usage: chordnova-bench [options]\n"
+	"  --time <seconds>     time spent on each kernel (default: 0.5)\n"
+	"  --seed <number>      seed of the corpora (default: 1)\n"
+	"  --filter <text>      run only the kernels whose name contains this text\n"
+	"  --csv                print CSV instead of a table\n"
+	"  --baseline <file>    compare with the CSV of an earlier run\n"
+	"  --temp-path <path>   folder for the files of 'dbentry' and MIDI writing (default: ./)\n";
+
+// The global 'operator new' is replaced here (and not in the engine) to count the allocations of
+// each thread in 'allocation_count' (see functions.cpp).
+void* operator new(size_t size)
+{
+	++allocation_count;
+	void* p = malloc(size == 0 ? 1 : size);
+	if(p == nullptr)  throw bad_alloc();
+	return p;
+}
+void* operator new[](size_t size)  { return operator new(size); }
+void* operator new(size_t size, const nothrow_t&) noexcept
+{
+	++allocation_count;
+	return malloc(size == 0 ? 1 : size);
+}
+void* operator new[](size_t size, const nothrow_t& tag) noexcept  { return operator new(size, tag); }
+void operator delete(void* p) noexcept  { free(p); }
+void operator delete[](void* p) noexcept  { free(p); }
+void operator delete(void* p, const nothrow_t&) noexcept  { free(p); }
+void operator delete[](void* p, const nothrow_t&) noexcept  { free(p); }
+
+class BenchChord: public Chord
+// gives the benchmarks access to the kernels of 'Chord'
+{
+public:
+	vector<int> span_chroma;  // 'single_chroma' as set by 'set_span', restored before 'set_chroma_old'
+
+	BenchChord(const vector<int>& _notes): Chord(_notes)
+	{
+		set_span(*this, true);
+		span_chroma = single_chroma;
+	}
+	void run_set_param1()  { set_param1(); }
+	void run_set_span()  { set_span(*this, true); }
+	void run_set_chroma_old()
+	{
+		single_chroma = span_chroma;
+		prev_chroma_old = 0.0;
+		set_chroma_old();
+	}
+	void run_set_chroma(BenchChord& chord)  { set_chroma(chord); }
+	void run_find_vec(BenchChord& chord)  { _find_vec(chord); }
+	bool run_valid_alignment()  { return valid_alignment(*this); }
+	bool run_valid_exclusion()  { return valid_exclusion(*this); }
+	void set_interval_alignment(const int& low, const int& high, const int& min, const int& max)
+	{
+		align_mode = Interval;
+		i_low = low;  i_high = high;  i_min = min;  i_max = max;
+	}
+	void set_list_alignment()  { align_mode = List; }
+	void set_exclusion(const char* text)
+	{
+		strcpy(exclusion, text);
+		parse_exclusion();
+	}
+	vector<int>& notes_()  { return notes; }
+	vector<int>& note_set_()  { return note_set; }
+	vector<int>& alignment_()  { return alignment; }
+};
+
+struct Benchmark
+{
+	string name;
+	function<long long()> run;  // runs the kernel over its corpus once; returns the number of operations
+};
+
+struct Measure
+{
+	double ns = 0;      // per operation
+	double allocs = 0;  // per operation
+	long long ops = 0;
+};
+
+void random_notes(RandomEngine& engine, const int& size, vector<int>& notes)
+// 'size' different notes between 'LOWEST_NOTE' and 'HIGHEST_NOTE', sorted
+{
+	notes.clear();
+	while((int)notes.size() < size)
+	{
+		notes.push_back(rand(engine, LOWEST_NOTE, HIGHEST_NOTE));
+		bubble_sort(notes);
+		remove_duplicate(notes);
+	}
+}
+
+void write_database(RandomEngine& engine, const string& filename)
+// a chord database of 'DB_SIZE' random chord types from 3 to 7 notes
+{
+	ofstream file(filename, ios::trunc);
+	file << "/ benchmark database\n";
+	vector<int> notes;
+	for(int i = 0; i < DB_SIZE; ++i)
+	{
+		notes.clear();
+		int size = rand(engine, 3, 7);
+		while((int)notes.size() < size)
+		{
+			notes.push_back(rand(engine, 0, 11));
+			bubble_sort(notes);
+			remove_duplicate(notes);
+		}
+		for(int j = 0; j < size; ++j)
+			file << notes[j] << (j == size - 1 ? "\n" : " ");
+	}
+}
+
+Measure measure(const Benchmark& bench, const double& min_time)
+// Runs 'bench' once to warm up, then in 'ROUNDS' rounds of 'min_time' / 'ROUNDS' seconds.
+// The time of the fastest round is kept, which is the least disturbed by other programs.
+{
+	Measure result;
+	bench.run();
+	const long long begin_count = allocation_count;
+	for(int i = 0; i < ROUNDS; ++i)
+	{
+		long long ops = 0;
+		const double begin = now_seconds();
+		double elapsed;
+		do{ ops += bench.run(); }
+		while((elapsed = now_seconds() - begin) < min_time / ROUNDS);
+		const double ns = elapsed * 1E9 / ops;
+		if(i == 0 || ns < result.ns)  result.ns = ns;
+		result.ops += ops;
+	}
+	result.allocs = (double)(allocation_count - begin_count) / result.ops;
+	return result;
+}
+
+bool read_baseline(const char* filename, map<string, Measure>& baseline)
+// reads the CSV printed by '--csv'
+{
+	ifstream file(filename);
+	if(!file.is_open())  return false;
+	string line;
+	getline(file, line);  // header
+	while(getline(file, line))
+	{
+		int pos1 = line.find(','), pos2 = line.find(',', pos1 + 1), pos3 = line.find(',', pos2 + 1);
+		if(pos1 == (int)string::npos || pos2 == (int)string::npos || pos3 == (int)string::npos)
+			continue;
+		Measure& item = baseline[line.substr(0, pos1)];
+		item.ns = atof(line.substr(pos1 + 1, pos2 - pos1 - 1).c_str());
+		item.allocs = atof(line.substr(pos2 + 1, pos3 - pos2 - 1).c_str());
+		item.ops = atoll(line.substr(pos3 + 1).c_str());
+	}
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	double min_time = 0.5;
+	unsigned long long seed = 1;
+	string filter, temp_path = "./";
+	const char* baseline_name = nullptr;
+	bool csv = false;
+	for(int i = 1; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		const bool has_value = (i + 1 < argc);
+		if(strcmp(arg, "--time") == 0 && has_value)  min_time = atof(argv[++i]);
+		else if(strcmp(arg, "--seed") == 0 && has_value)  seed = strtoull(argv[++i], nullptr, 10);
+		else if(strcmp(arg, "--filter") == 0 && has_value)  filter = argv[++i];
+		else if(strcmp(arg, "--csv") == 0)  csv = true;
+		else if(strcmp(arg, "--baseline") == 0 && has_value)  baseline_name = argv[++i];
+		else if(strcmp(arg, "--temp-path") == 0 && has_value)  temp_path = argv[++i];
+		else
+		{
+			cerr << usage;
+			return 2;
+		}
+	}
+	if(temp_path.back() != '/' && temp_path.back() != '\\')
+		temp_path += '/';
+	map<string, Measure> baseline;
+	if(baseline_name != nullptr && !read_baseline(baseline_name, baseline))
+	{
+		cerr << "ERROR - failed to read the baseline '" << baseline_name << "'.\n";
+		return 1;
+	}
+
+	// the corpora
+	set_expansion_indexes();
+	RandomEngine engine;
+	seed_random(engine, seed);
+	vector<int> notes;
+	vector<BenchChord> corpus;
+	for(int i = 0; i < CORPUS_SIZE; ++i)
+	{
+		random_notes(engine, rand(engine, 3, 8), notes);
+		corpus.push_back(BenchChord(notes));
+	}
+	vector<BenchChord> by_size[9];  // chords of 3 to 8 parts, for '_find_vec'
+	for(int size = 3; size <= 8; ++size)
+		for(int i = 0; i < CORPUS_SIZE / 4; ++i)
+		{
+			random_notes(engine, size, notes);
+			by_size[size].push_back(BenchChord(notes));
+		}
+	for(int i = 0; i < CORPUS_SIZE; i += 2)
+		alignment_keys.insert(notes_to_key(corpus[i].alignment_()));
+	omission[4] = {5};
+	omission[5] = {3, 5};
+	omission[6] = {3, 5, 7};
+	omission[7] = {3, 5};
+	const string db_name = temp_path + "chordnova-bench.db";
+	const string midi_name = temp_path + "chordnova-bench.mid";
+	char cdb_name[300];
+	set_compiled_db_name(cdb_name, db_name.c_str());
+	write_database(engine, db_name);
+
+	// the kernels
+	vector<Benchmark> benches;
+	benches.push_back({"set_param1", [&]()
+	{
+		for(auto& chord: corpus)  chord.run_set_param1();
+		return (long long)corpus.size();
+	}});
+	benches.push_back({"find_root", [&]()
+	{
+		int sum = 0;
+		for(auto& chord: corpus)  sum += find_root(chord.notes_());
+		if(sum < 0)  cerr << sum;  // keeps the calls
+		return (long long)corpus.size();
+	}});
+	benches.push_back({"normal_form", [&]()
+	{
+		int sum = 0;
+		for(auto& chord: corpus)  sum += normal_form(chord.note_set_()).size();
+		if(sum < 0)  cerr << sum;
+		return (long long)corpus.size();
+	}});
+	benches.push_back({"set_span", [&]()
+	{
+		for(auto& chord: corpus)  chord.run_set_span();
+		return (long long)corpus.size();
+	}});
+	benches.push_back({"set_chroma_old", [&]()
+	{
+		for(auto& chord: corpus)  chord.run_set_chroma_old();
+		return (long long)corpus.size();
+	}});
+	benches.push_back({"set_chroma", [&]()
+	{
+		for(int i = 1; i < (int)corpus.size(); ++i)  corpus[i - 1].run_set_chroma(corpus[i]);
+		return (long long)corpus.size() - 1;
+	}});
+	const int find_vec_sizes[][2] = {{3, 3}, {4, 4}, {5, 5}, {6, 6}, {7, 7}, {8, 8}, {3, 6}, {6, 3}, {4, 8}, {8, 4}};
+	for(auto& sizes: find_vec_sizes)
+	{
+		vector<BenchChord>& from = by_size[sizes[0]];
+		vector<BenchChord>& to = by_size[sizes[1]];
+		benches.push_back({"_find_vec " + to_string(sizes[0]) + "->" + to_string(sizes[1]), [&from, &to]()
+		{
+			for(int i = 0; i < (int)from.size(); ++i)  from[i].run_find_vec(to[(i + 1) % to.size()]);
+			return (long long)from.size();
+		}});
+	}
+	benches.push_back({"valid_alignment (interval)", [&]()
+	{
+		int count = 0;
+		for(auto& chord: corpus)  count += chord.run_valid_alignment();
+		if(count < 0)  cerr << count;
+		return (long long)corpus.size();
+	}});
+	benches.push_back({"valid_alignment (list)", [&]()
+	{
+		int count = 0;
+		for(auto& chord: corpus)  count += chord.run_valid_alignment();
+		if(count < 0)  cerr << count;
+		return (long long)corpus.size();
+	}});
+	benches.push_back({"valid_exclusion", [&]()
+	{
+		int count = 0;
+		for(auto& chord: corpus)  count += chord.run_valid_exclusion();
+		if(count < 0)  cerr << count;
+		return (long long)corpus.size();
+	}});
+	benches.push_back({"dbentry (text)", [&]()
+	{
+		remove(cdb_name);  // The text is read again, and compiled again.
+		dbentry(db_name.c_str());
+		return 1LL;
+	}});
+	benches.push_back({"dbentry (compiled)", [&]()
+	{
+		dbentry(db_name.c_str());
+		return 1LL;
+	}});
+	benches.push_back({"chord_to_midi", [&]()
+	{
+		midi_head();
+		for(auto& chord: corpus)  chord_to_midi(chord.notes_());
+		return (long long)corpus.size();
+	}});
+	benches.push_back({"midi file (write)", [&]()
+	{
+		midi_head();
+		for(auto& chord: corpus)  chord_to_midi(chord.notes_());
+		m_fout.open(midi_name, ios::trunc | ios::binary);
+		midi_flush();
+		wait_writer();
+		return 1LL;
+	}});
+
+	if(!csv)
+		cout << "[[  ChordNova v3.0 [Build: 2021.1.14]  ]]\n"
+			  << "[[  (c) 2021 Wenge Chen, Ji-woon Sim.  ]]\n\n"
+			  << " > Utility - Benchmark (seed " << seed << ", " << min_time << " s per kernel):\n\n"
+			  << left << setw(30) << "   kernel" << right << setw(14) << "ns/op" << setw(12) << "allocs/op"
+			  << (baseline.empty() ? "" : "      change") << "\n";
+	else  cout << "kernel,ns_per_op,allocs_per_op,ops\n";
+	for(auto& bench: benches)
+	{
+		if(!filter.empty() && bench.name.find(filter) == string::npos)  continue;
+		// Settings shared by all chords are set for the kernel that reads them.
+		if(bench.name == "valid_alignment (interval)")
+			for(auto& chord: corpus)  chord.set_interval_alignment(7, 11, 3, 9);
+		else if(bench.name == "valid_alignment (list)")
+			for(auto& chord: corpus)  chord.set_list_alignment();
+		else if(bench.name == "valid_exclusion")
+			for(auto& chord: corpus)  chord.set_exclusion("\\1 \\13 \\25 \\37 74 72 r6");
+		Measure result = measure(bench, min_time);
+		if(csv)
+		{
+			cout << bench.name << "," << fixed << setprecision(2) << result.ns << ","
+				  << result.allocs << "," << result.ops << "\n";
+			continue;
+		}
+		cout << "   " << left << setw(27) << bench.name << right << fixed << setprecision(1)
+			  << setw(14) << result.ns << setprecision(2) << setw(12) << result.allocs;
+		auto item = baseline.find(bench.name);
+		if(item != baseline.end() && item -> second.ns > 0)
+			cout << setprecision(1) << setw(11) << showpos << (result.ns / item -> second.ns - 1.0) * 100.0
+				  << noshowpos << "%";
+		cout << "\n";
+	}
+	remove(db_name.c_str());
+	remove(cdb_name);
+	remove(midi_name.c_str());
+	return 0;
+}
@@ -0,0 +1,17 @@
+QT       -= gui core
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = chordnova-bench
+
+# The benchmark needs no Qt, and builds the same way as the other utilities:
+#   g++ -std=c++11 -O2 -pthread -o chordnova-bench chordnova-bench.cpp
+# Build it with the same optimisation as the program being measured.
+
+SOURCES += \
+    chordnova-bench.cpp
+
+qnx: target.path = /tmp/$${TARGET}/bin
+else: unix:!android: target.path = /opt/$${TARGET}/bin
+!isEmpty(target.path): INSTALLS += target
@@ -0,0 +1,115 @@
+// ChordNova-utility-chordnova-cli v3.0 [Build: 2021.1.14]
+// Runs the generation or substitution of a preset without the GUI, e.g. on build servers.
+// Settings of the preset and the initial chord can be replaced on the command line.
+// A large run can be split into shards running as separate processes (e.g. on different computers):
+// each shard writes a partial file, and a last run with '--merge' gives the output of the whole run.
+// The outcome and timing are written to the standard output as a single line of JSON; the time and counts
+// of each stage of a generation end the text report (see 'Chord::print_metrics').
+// Chord analysis and substitution need a build with Qt (see 'chordnova-cli.pro'); generation does not.
+// (c) 2021 Wenge Chen, Ji-woon Sim.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../../main/chord.h"
+#include "../../main/chord.cpp"
+#include "../../main/chorddata.h"
+#include "../../main/chorddata.cpp"
+#include "../../main/functions.h"
+#include "../../main/functions.cpp"
+#include "../../main/preset.cpp"
+#ifdef QT_CORE_LIB
+	#include "../../main/analyser.cpp"
+#endif
+#include "../../main/batch.h"
+#include "../../main/batch.cpp"
+
+using namespace std;
+
+const char usage[] =
+	"Usage: chordnova-cli <preset> [options]\n"
+	"       chordnova-cli --analyse \"<antechord> / <postchord>\"\n"
+	"  --substitute             run chord substitution instead of generation\n"
+	"  --initial <chord>        initial chord, e.g. \"C3 G3 E4 B4\"\n"
+	"  --sequence <chords>      progression for sequence substitution, e.g. \"C E G / A C E\"\n"
+	"  --set <key>=<value>      replace a setting of the preset, e.g. --set \"range of notes: max=84\"\n"
+	"                           (the n-th occurrence of a key is \"<key>#n\"); may be repeated\n"
+	"  --seed <number>          random seed (default: 1)\n"
+	"  --shard <i>/<n>          run only part i of n (generation in single mode, or substitution of\n"
+	"                           both chords), writing '<output name>.<i>-of-<n>.part'\n"
+	"  --merge <n>              merge the partial files of n shards (all in the output path)\n"
+	"  --metrics                also write the time and counts of each stage to '<output name>.metrics.json'\n"
+	"  --memory-budget <MB>     results kept in memory in single mode before they are spilled to disk\n"
+	"                           (default: 1024)\n"
+	"  --output-path <path>     folder of the output files (default: ./)\n"
+	"  --output-name <name>     name of the output files (default: the one of the preset)\n"
+	"  --database-path <path>   folder of chord databases (default: ../db/chord/)\n"
+	"  --alignment-path <path>  folder of alignment databases (default: ../db/align/)\n";
+
+int main(int argc, char* argv[])
+{
+	BatchSettings settings;
+	BatchJob job;
+	settings.output_path = "./";
+	job.seed = 1;
+	for(int i = 1; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		const bool has_value = (i + 1 < argc);
+		if(strcmp(arg, "--substitute") == 0)  job.substitution = true;
+		else if(strcmp(arg, "--initial") == 0 && has_value)  job.initial = argv[++i];
+		else if(strcmp(arg, "--sequence") == 0 && has_value)  job.sequence = argv[++i];
+		else if(strcmp(arg, "--analyse") == 0 && has_value)  job.analysis = argv[++i];
+		else if(strcmp(arg, "--seed") == 0 && has_value)  job.seed = strtoull(argv[++i], nullptr, 10);
+		else if(strcmp(arg, "--shard") == 0 && has_value && sscanf(argv[i + 1], "%d/%d", &job.shard, &job.shards) == 2
+				  && job.shard >= 1 && job.shard <= job.shards)
+		{
+			job.merge = false;
+			++i;
+		}
+		else if(strcmp(arg, "--merge") == 0 && has_value && atoi(argv[i + 1]) > 0)
+		{
+			job.shards = atoi(argv[++i]);
+			job.merge = true;
+		}
+		else if(strcmp(arg, "--metrics") == 0)  job.metrics = true;
+		else if(strcmp(arg, "--memory-budget") == 0 && has_value && read_memory_budget(argv[i + 1], job.memory_budget))
+			++i;
+		else if(strcmp(arg, "--output-path") == 0 && has_value)  settings.output_path = argv[++i];
+		else if(strcmp(arg, "--output-name") == 0 && has_value)  job.output_name = argv[++i];
+		else if(strcmp(arg, "--database-path") == 0 && has_value)  settings.database_path = argv[++i];
+		else if(strcmp(arg, "--alignment-path") == 0 && has_value)  settings.align_path = argv[++i];
+		else if(strcmp(arg, "--set") == 0 && has_value && strchr(argv[i + 1], '=') != nullptr)
+		{
+			string item = argv[++i];
+			int eq = item.find('=');
+			job.overrides.push_back(make_pair(item.substr(0, eq), item.substr(eq + 1)));
+		}
+		else if(arg[0] != '-' && job.preset.empty())  job.preset = arg;
+		else
+		{
+			cerr << usage;
+			return 2;
+		}
+	}
+	if(job.preset.empty() == job.analysis.empty())
+	{
+		cerr << usage;
+		return 2;
+	}
+	if(!job.sequence.empty())  job.substitution = true;
+	if(settings.output_path.back() != '/' && settings.output_path.back() != '\\')
+		settings.output_path += '/';
+
+	clock_t begin_cpu = clock();
+	run_single(settings, job);
+	double cpu_seconds = (double)(clock() - begin_cpu) / CLOCKS_PER_SEC;
+
+	cout << job_json(settings, job, cpu_seconds) << endl;
+	return job.done ? 0 : 1;
+}
@@ -0,0 +1,18 @@
+QT       -= gui
+QT       += core
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = chordnova-cli
+
+# Without Qt, the same source builds with only generation, like the other utilities:
+#   g++ -std=c++11 -O2 -pthread -o chordnova-cli chordnova-cli.cpp
+DEFINES += QT_DEPRECATED_WARNINGS
+
+SOURCES += \
+    chordnova-cli.cpp
+
+qnx: target.path = /tmp/$${TARGET}/bin
+else: unix:!android: target.path = /opt/$${TARGET}/bin
+!isEmpty(target.path): INSTALLS += target
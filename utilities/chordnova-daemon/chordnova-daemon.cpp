@@ -0,0 +1,297 @@
+// ChordNova-utility-chordnova-daemon v3.0 [Build: 2021.1.14]
+// Answers requests from other programs (e.g. composition tools) on a local port or a Unix socket.
+// The chord databases, alignment databases and tables stay loaded between requests, so that a request
+// only costs its own generation, substitution or analysis.
+// A request is one line in the form of a job of a batch manifest (see 'read_manifest'), e.g.
+//   preset = my.preset; initial chord = C3 G3 E4 B4; seed = 3
+//   preset = my.preset; substitute = true; set = antechord = C4 E4 G4; set = postchord = D4 F4 A4 C5
+//   analyse = C4 E4 G4 / D4 F4 A4 C5
+// and is answered with one line of JSON, as printed by chordnova-cli ("ping" is answered with
+// {"status": "ok"}). Requests on different connections run at the same time.
+// Any local program may send requests, so a request can only name a preset in the preset folder
+// ('--presets'), write to the output folder and set values that fit into the fields of the engine
+// and lie in the ranges the main program allows; see 'check_request'.
+// Chord analysis and substitution need a build with Qt (see 'chordnova-daemon.pro'); generation does not.
+// (c) 2021 Wenge Chen, Ji-woon Sim.
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if __WIN32
+	#include <winsock2.h>
+	typedef int socklen_t;
+#else
+	#include <csignal>
+	#include <arpa/inet.h>
+	#include <netinet/in.h>
+	#include <sys/socket.h>
+	#include <sys/un.h>
+	#include <unistd.h>
+	typedef int SOCKET;
+	const SOCKET INVALID_SOCKET = -1;
+	#define closesocket close
+#endif
+
+#include "../../main/chord.h"
+#include "../../main/chord.cpp"
+#include "../../main/chorddata.h"
+#include "../../main/chorddata.cpp"
+#include "../../main/functions.h"
+#include "../../main/functions.cpp"
+#include "../../main/preset.cpp"
+#ifdef QT_CORE_LIB
+	#include "../../main/analyser.cpp"
+#endif
+#include "../../main/batch.h"
+#include "../../main/batch.cpp"
+
+using namespace std;
+
+const int DEFAULT_PORT = 7313;
+const int MAX_REQUEST_SIZE = 1 << 16;  // longer lines are refused
+const int MAX_NAME_SIZE = 99;          // of presets and output names, as 'Chord::output_name'
+const int DEFAULT_CONNECTIONS = 64;
+
+const char usage[] =
+	"Usage: chordnova-daemon [options]\n"
+	"  --port <number>          listen on this port of 127.0.0.1 (default: 7313)\n"
+	"  --socket <path>          listen on a Unix socket instead\n"
+	"  --threads <number>       requests running at the same time (default: the number of cores)\n"
+	"  --connections <number>   connections open at the same time; more are refused (default: 64)\n"
+	"  --presets <path>         folder of the presets requests may use (default: ../attachments/presets/)\n"
+	"  --preload <preset>       load the databases of a preset before the first request; may be repeated\n"
+	"  --output-path <path>     folder of the output files (default: ./)\n"
+	"  --database-path <path>   folder of chord databases (default: ../db/chord/)\n"
+	"  --alignment-path <path>  folder of alignment databases (default: ../db/align/)\n";
+
+BatchSettings settings;
+string preset_path = "../attachments/presets/";
+atomic<int> request_count{0};  // numbers the output files of requests without an output name
+mutex slot_lock;
+condition_variable slot_free;
+int running = 0;               // requests running now; at most 'settings.threads'
+int max_connections = DEFAULT_CONNECTIONS;
+atomic<int> connections{0};    // connections open now; each has a thread
+
+bool send_line(SOCKET client, string line)
+{
+	line += '\n';
+	int sent = 0;
+	while(sent < (int)line.size())
+	{
+		int count = send(client, line.data() + sent, line.size() - sent, 0);
+		if(count <= 0)  return false;
+		sent += count;
+	}
+	return true;
+}
+
+bool safe_name(const string& name, const bool& allow_folders)
+// A name from a request stays inside its folder: it is not absolute and has no '..' (nor '/' or '\\'
+// unless 'allow_folders').
+{
+	if(name.empty() || name.size() > MAX_NAME_SIZE || name.find("..") != string::npos || name.find(':') != string::npos)
+		return false;
+	if(allow_folders)  return name[0] != '/' && name[0] != '\\';
+	return name.find_first_of("/\\") == string::npos;
+}
+
+string check_request(BatchJob& job)
+// Returns why the request may not run, or an empty string. The preset is looked up in 'preset_path'.
+// The output path and name of the preset cannot be replaced, and the other settings only by values
+// that do not name other files. The job is then read as it would run (see 'check_job'), so that values
+// longer than their fields or out of range, and chords to analyse that are not valid, are refused here.
+{
+	if(job.analysis.empty())
+	{
+		if(!safe_name(job.preset, true))
+			return "ERROR - the preset must be a file in the preset folder of the server.";
+		job.preset = preset_path + job.preset;
+		if(!job.output_name.empty() && !safe_name(job.output_name, false))
+			return "ERROR - the output name must be a file name of at most 99 characters, without a folder.";
+		if(job.memory_budget > DEFAULT_MEMORY_BUDGET)
+			return "ERROR - the memory budget of a request is at most 1024 MB.";
+		for(int i = 0; i < (int)job.overrides.size(); ++i)
+		{
+			const string& key = job.overrides[i].first;
+			const string& value = job.overrides[i].second;
+			if(key.compare(0, 6, "output") == 0)
+				return "ERROR - the output path and name of the preset cannot be changed.";
+			if(value.find_first_of("/\\=") != string::npos || value.find("..") != string::npos)
+				return "ERROR - a value set by the request is not valid.";
+		}
+	}
+	return check_job(job);
+}
+
+string answer(const string& request)
+{
+	if(request == "ping")
+		return "{\"status\": \"ok\"}";
+	BatchSettings scratch;  // Requests cannot change the settings of the server.
+	BatchJob job;
+	bool is_job, has_seed;
+	if(!read_line(request, scratch, job, is_job, has_seed) || !is_job)
+		return "{\"status\": \"failed\", \"message\": \"ERROR - the request is not valid.\"}";
+	if(!has_seed)  job.seed = 1;
+	if(!job.sequence.empty())  job.substitution = true;
+	const string refused = check_request(job);
+	if(!refused.empty())
+		return "{\"status\": \"failed\", \"message\": " + json_string(refused) + "}";
+
+	{
+		unique_lock<mutex> lock(slot_lock);
+		slot_free.wait(lock, []{ return running < settings.threads; });
+		++running;
+	}
+	run_single(settings, job, ++request_count);
+	{
+		lock_guard<mutex> lock(slot_lock);
+		--running;
+	}
+	slot_free.notify_one();
+	return job_json(settings, job);
+}
+
+void serve(SOCKET client)
+// Answers the requests of a connection in order until it is closed.
+{
+	string buffer;
+	char chunk[4096];
+	int count;
+	while((count = recv(client, chunk, sizeof(chunk), 0)) > 0)
+	{
+		buffer.append(chunk, count);
+		size_t end;
+		while((end = buffer.find('\n')) != string::npos)
+		{
+			string request = buffer.substr(0, end);
+			buffer.erase(0, end + 1);
+			while(!request.empty() && (request.back() == '\r' || request.back() == ' '))
+				request.pop_back();
+			if(request.empty())  continue;
+			if(!send_line(client, answer(request)))
+			{
+				closesocket(client);
+				--connections;
+				return;
+			}
+		}
+		if((int)buffer.size() > MAX_REQUEST_SIZE)  break;
+	}
+	closesocket(client);
+	--connections;
+}
+
+int main(int argc, char* argv[])
+{
+	int port = DEFAULT_PORT;
+	string socket_path;
+	vector<string> presets;
+	settings.output_path = "./";
+	for(int i = 1; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		const bool has_value = (i + 1 < argc);
+		if(strcmp(arg, "--port") == 0 && has_value)  port = atoi(argv[++i]);
+		else if(strcmp(arg, "--socket") == 0 && has_value)  socket_path = argv[++i];
+		else if(strcmp(arg, "--threads") == 0 && has_value)  settings.threads = atoi(argv[++i]);
+		else if(strcmp(arg, "--connections") == 0 && has_value)  max_connections = atoi(argv[++i]);
+		else if(strcmp(arg, "--presets") == 0 && has_value)  preset_path = argv[++i];
+		else if(strcmp(arg, "--preload") == 0 && has_value)  presets.push_back(argv[++i]);
+		else if(strcmp(arg, "--output-path") == 0 && has_value)  settings.output_path = argv[++i];
+		else if(strcmp(arg, "--database-path") == 0 && has_value)  settings.database_path = argv[++i];
+		else if(strcmp(arg, "--alignment-path") == 0 && has_value)  settings.align_path = argv[++i];
+		else
+		{
+			cerr << usage;
+			return 2;
+		}
+	}
+	if(settings.output_path.back() != '/' && settings.output_path.back() != '\\')
+		settings.output_path += '/';
+	if(preset_path.back() != '/' && preset_path.back() != '\\')
+		preset_path += '/';
+	if(settings.threads <= 0)  settings.threads = thread::hardware_concurrency();
+	if(settings.threads <= 0)  settings.threads = 1;
+	if(max_connections <= 0)  max_connections = DEFAULT_CONNECTIONS;
+
+	cout << "[[  ChordNova v3.0 [Build: 2021.1.14]  ]]\n"
+		  << "[[  (c) 2021 Wenge Chen, Ji-woon Sim.  ]]\n\n"
+		  << " > Utility - Daemon:\n";
+	try{ warm_up(settings, presets); }
+	catch(const char* msg)
+	{
+		cout << "\n > " << msg << "\n\n";
+		return 1;
+	}
+
+#if __WIN32
+	WSADATA wsa_data;
+	WSAStartup(MAKEWORD(2, 2), &wsa_data);
+#else
+	signal(SIGPIPE, SIG_IGN);  // A client closing its connection early must not stop the server.
+#endif
+	SOCKET server = INVALID_SOCKET;
+	bool listening = false;
+	if(socket_path.empty())
+	{
+		server = socket(AF_INET, SOCK_STREAM, 0);
+		sockaddr_in address;
+		memset(&address, 0, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);  // only programs on this computer
+		address.sin_port = htons(port);
+		int reuse = 1;
+		setsockopt(server, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+		listening = server != INVALID_SOCKET && bind(server, (sockaddr*)&address, sizeof(address)) == 0
+						&& listen(server, SOMAXCONN) == 0;
+		if(listening)  cout << "\n > Listening on 127.0.0.1:" << port << " with " << settings.threads << " thread(s).\n";
+	}
+	else
+	{
+#if __WIN32
+		cerr << "Unix sockets are not supported on Windows; please use '--port'.\n";
+		return 2;
+#else
+		server = socket(AF_UNIX, SOCK_STREAM, 0);
+		sockaddr_un address;
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+		unlink(socket_path.c_str());
+		listening = server != INVALID_SOCKET && bind(server, (sockaddr*)&address, sizeof(address)) == 0
+						&& listen(server, SOMAXCONN) == 0;
+		if(listening)  cout << "\n > Listening on " << socket_path << " with " << settings.threads << " thread(s).\n";
+#endif
+	}
+	if(!listening)
+	{
+		cout << "\n > ERROR - failed to listen for requests. Is the port or socket already in use?\n\n";
+		return 1;
+	}
+	cout << flush;
+
+	while(true)
+	{
+		SOCKET client = accept(server, nullptr, nullptr);
+		if(client == INVALID_SOCKET)  continue;
+		if(connections >= max_connections)
+		{
+			send_line(client, "{\"status\": \"failed\", \"message\": \"ERROR - the server has too many connections.\"}");
+			closesocket(client);
+			continue;
+		}
+		++connections;
+		thread(serve, client).detach();
+	}
+	return 0;
+}
@@ -0,0 +1,19 @@
+QT       -= gui
+QT       += core
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = chordnova-daemon
+
+# Without Qt, the same source builds with only generation, like the other utilities:
+#   g++ -std=c++11 -O2 -pthread -o chordnova-daemon chordnova-daemon.cpp
+DEFINES += QT_DEPRECATED_WARNINGS
+win32: LIBS += -lws2_32
+
+SOURCES += \
+    chordnova-daemon.cpp
+
+qnx: target.path = /tmp/$${TARGET}/bin
+else: unix:!android: target.path = /opt/$${TARGET}/bin
+!isEmpty(target.path): INSTALLS += target
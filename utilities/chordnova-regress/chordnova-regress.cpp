@@ -0,0 +1,472 @@
+// ChordNova-utility-chordnova-regress v3.0 [Build: 2021.1.14]
+// Runs the generation of every preset with a fixed seed (and the initial chord of the preset, or a fixed one)
+// and compares the outcome with a baseline, to catch both changes of the output and losses of speed or memory.
+// For every preset the wall-clock time, the candidates tested per second, the peak memory and a hash of
+// the output files are recorded; '--update' writes them as the new baseline.
+// Each preset runs in a separate process (this program, with '--run'), so that its peak memory is its own.
+// The exit code is 1 if the output of any preset differs from the baseline, or it became slower or larger.
+// (c) 2021 Wenge Chen, Ji-woon Sim.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if __WIN32
+	#include <io.h>
+	#include <windows.h>
+	#include <psapi.h>
+	#define popen _popen
+	#define pclose _pclose
+#else
+	#include <dirent.h>
+	#include <sys/resource.h>
+	#include <sys/stat.h>
+#endif
+
+#include "../../main/chord.h"
+#include "../../main/chord.cpp"
+#include "../../main/chorddata.h"
+#include "../../main/chorddata.cpp"
+#include "../../main/functions.h"
+#include "../../main/functions.cpp"
+#include "../../main/preset.cpp"
+#include "../../main/batch.h"
+#include "../../main/batch.cpp"
+
+using namespace std;
+
+const double MIN_SLOWDOWN = 0.05; // seconds; smaller changes of time are never reported
+
+const char usage[] =
+	"Usage: chordnova-regress [options] [preset ...]\n"
+	"  --presets <path>         folder searched for presets if none is given (default: ../attachments/presets/)\n"
+	"                           presets are named in the baseline by their path relative to it\n"
+	"  --baseline <file>        baseline to compare with (default: regress-baseline.tsv in the output path)\n"
+	"  --update                 write the results as the new baseline instead of comparing\n"
+	"  --tolerance <percent>    allowed increase of time and memory (default: 20)\n"
+	"  --repeat <number>        runs of every preset; the fastest one counts (default: 1)\n"
+	"  --seed <number>          random seed (default: 1)\n"
+	"  --initial <chord>        initial chord of every preset (default: the one of the preset)\n"
+	"  --set <key>=<value>      replace a setting of every preset (see chordnova-cli); may be repeated\n"
+	"  --output-path <path>     folder of the output files (default: ./)\n"
+	"  --database-path <path>   folder of chord databases (default: ../db/chord/)\n"
+	"  --alignment-path <path>  folder of alignment databases (default: ../db/align/)\n";
+
+struct Outcome
+// a run of a preset, as written to the baseline
+{
+	string preset;       // name of the preset file, without the folder and extension
+	bool   done = false;
+	long long results = 0;
+	long long candidates = 0;
+	string hash;         // of the output files; see 'hash_output'
+	double seconds = 0.0;
+	long long memory = 0;  // peak memory in KB
+	string message;
+};
+
+long long peak_memory()
+// the peak memory (resident set) of this process in KB
+{
+#if __WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return counters.PeakWorkingSetSize / 1024;
+	return 0;
+#else
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	#ifdef __APPLE__
+		return usage.ru_maxrss / 1024;
+	#else
+		return usage.ru_maxrss;
+	#endif
+#endif
+}
+
+void hash_data(unsigned long long& hash, const char* data, const long long& size)
+// FNV-1a
+{
+	for(long long i = 0; i < size; ++i)
+	{
+		hash ^= (unsigned char)data[i];
+		hash *= 0x100000001B3ULL;
+	}
+}
+
+string hash_output(const string& name)
+// A hash of the text and MIDI output of 'name' (the output path and name, without extension).
+// The time taken by the generation (see 'Chord::print_end') and the metrics after it (see
+// 'Chord::print_metrics') end the text and are left out.
+{
+	unsigned long long hash = 0xCBF29CE484222325ULL;
+	MappedFile file;
+	if(map_file((name + ".txt").c_str(), file))
+	{
+		const string head = string("\n\n") + METRICS_HEAD;
+		const char* last = search(file.data, file.data + file.size, head.begin(), head.end());
+		while(last > file.data && *(last - 1) != '\n')  --last;
+		hash_data(hash, file.data, last - file.data);
+		unmap_file(file);
+	}
+	if(map_file((name + ".mid").c_str(), file))
+	{
+		hash_data(hash, file.data, file.size);
+		unmap_file(file);
+	}
+	char str[20];
+	sprintf(str, "%016llx", hash);
+	return str;
+}
+
+string preset_name(const string& path, const string& folder)
+// The name of a preset in the baseline: its path relative to 'folder' (or as given, if it is not in 'folder'),
+// without extension, so that presets of the same name in different subfolders are kept apart.
+// "../attachments/presets/standard-presets/02-the-spiral.preset" -> "standard-presets/02-the-spiral"
+{
+	string name = (path.compare(0, folder.size(), folder) == 0) ? path.substr(folder.size()) : path;
+	replace(name.begin(), name.end(), '\\', '/');
+	size_t begin = name.rfind('/');
+	begin = (begin == string::npos) ? 0 : begin + 1;
+	size_t end = name.rfind('.');
+	if(end != string::npos && end > begin)  name.erase(end);
+	return name;
+}
+
+string output_name(const string& name)
+// the name of the output files of a preset: "standard-presets/02-the-spiral" -> "standard-presets-02-the-spiral"
+{
+	string result = name;
+	for(char& ch: result)
+		if(ch == '/' || ch == ':')  ch = '-';
+	return result;
+}
+
+void list_presets(const string& folder, vector<string>& presets)
+// adds all presets in 'folder' and its subfolders
+{
+#if __WIN32
+	_finddata_t data;
+	intptr_t handle = _findfirst((folder + "*").c_str(), &data);
+	if(handle == -1)  return;
+	do{
+		string name = data.name;
+		if(name == "." || name == "..")  continue;
+		if(data.attrib & _A_SUBDIR)  list_presets(folder + name + "/", presets);
+		else if(name.size() > 7 && name.substr(name.size() - 7) == ".preset")
+			presets.push_back(folder + name);
+	}  while(_findnext(handle, &data) == 0);
+	_findclose(handle);
+#else
+	DIR* dir = opendir(folder.c_str());
+	if(dir == nullptr)  return;
+	while(dirent* entry = readdir(dir))
+	{
+		string name = entry -> d_name;
+		if(name == "." || name == "..")  continue;
+		struct stat info;
+		if(stat((folder + name).c_str(), &info) != 0)  continue;
+		if(S_ISDIR(info.st_mode))  list_presets(folder + name + "/", presets);
+		else if(name.size() > 7 && name.substr(name.size() - 7) == ".preset")
+			presets.push_back(folder + name);
+	}
+	closedir(dir);
+#endif
+}
+
+string quote(const string& arg)
+// Quotes an argument of the command run by 'popen', so that it reaches the child unchanged.
+{
+#if __WIN32
+	// quotes and the backslashes before them are escaped as the C runtime splits the command line
+	string result = "\"";
+	int slashes = 0;
+	for(char ch: arg)
+	{
+		if(ch == '\\')  ++slashes;
+		else
+		{
+			if(ch == '"')  result.append(slashes + 1, '\\');
+			slashes = 0;
+		}
+		result += ch;
+	}
+	result.append(slashes, '\\');
+	return result + "\"";
+#else
+	// nothing is special inside single quotes; a single quote itself is written as '\''
+	string result = "'";
+	for(char ch: arg)
+	{
+		if(ch == '\'')  result += "'\\''";
+		else  result += ch;
+	}
+	return result + "'";
+#endif
+}
+
+int run_child(const BatchSettings& settings, BatchJob& job, const string& folder)
+// Runs a preset in this process ('--run') and prints the outcome as a line of the baseline.
+{
+	const string name = settings.output_path + job.output_name;
+	remove((name + ".txt").c_str());  // A run failing early must not leave the output of an earlier one.
+	remove((name + ".mid").c_str());
+	run_single(settings, job);
+	Outcome outcome;
+	outcome.preset = preset_name(job.preset, folder);
+	outcome.done = job.done;
+	outcome.results = job.results;
+	outcome.candidates = job.candidates;
+	outcome.hash = hash_output(name);
+	outcome.seconds = job.seconds;
+	outcome.memory = peak_memory();
+	outcome.message = job.message;
+	cout << outcome.preset << '\t' << (outcome.done ? "done" : "failed") << '\t' << outcome.results << '\t'
+		  << outcome.candidates << '\t' << outcome.hash << '\t' << fixed << setprecision(3) << outcome.seconds << '\t'
+		  << outcome.memory << '\t' << outcome.message << endl;
+	return 0;
+}
+
+bool read_outcome(const string& line, Outcome& outcome)
+// reads a line written by 'run_child' or 'write_baseline'
+{
+	vector<string> fields;
+	stringstream text(line);
+	string field;
+	while(getline(text, field, '\t'))
+		fields.push_back(field);
+	if(fields.size() < 7)  return false;
+	outcome.preset = fields[0];
+	outcome.done = (fields[1] == "done");
+	outcome.results = atoll(fields[2].c_str());
+	outcome.candidates = atoll(fields[3].c_str());
+	outcome.hash = fields[4];
+	outcome.seconds = atof(fields[5].c_str());
+	outcome.memory = atoll(fields[6].c_str());
+	outcome.message = (fields.size() > 7) ? fields[7] : "";
+	return true;
+}
+
+bool read_baseline(const string& filename, map<string, Outcome>& baseline)
+{
+	ifstream file(filename);
+	if(!file.is_open())  return false;
+	string line;
+	getline(file, line);  // header
+	Outcome outcome;
+	while(getline(file, line))
+	{
+		if(!line.empty() && line.back() == '\r')  line.pop_back();
+		if(read_outcome(line, outcome))
+			baseline[outcome.preset] = outcome;
+	}
+	return true;
+}
+
+bool write_baseline(const string& filename, const vector<Outcome>& outcomes)
+// The baseline is written to a temporary file first, so that a failed write leaves the old one intact.
+{
+	const string temp_name = filename + ".tmp";
+	ofstream file(temp_name, ios::trunc);
+	if(!file.is_open())  return false;
+	file << "preset\tstatus\tresults\tcandidates\thash\tseconds\tmemory (KB)\tmessage\n";
+	for(const Outcome& outcome: outcomes)
+		file << outcome.preset << '\t' << (outcome.done ? "done" : "failed") << '\t' << outcome.results << '\t'
+			  << outcome.candidates << '\t' << outcome.hash << '\t' << fixed << setprecision(3) << outcome.seconds << '\t'
+			  << outcome.memory << '\t' << outcome.message << '\n';
+	file.close();
+	if(file.fail() || !replace_file(temp_name.c_str(), filename.c_str()))
+	{
+		remove(temp_name.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool check_outcome(const Outcome& outcome, const Outcome& base, const double& tolerance, string& result)
+// Returns false if the output changed, or the run became slower or larger; 'result' tells what changed.
+// A different number of candidates alone (e.g. from pruning the search) is only reported.
+{
+	if(outcome.done != base.done || outcome.results != base.results || outcome.hash != base.hash
+		|| outcome.message != base.message)
+	{
+		result = "OUTPUT CHANGED";
+		return false;
+	}
+	bool same = true;
+	if(outcome.candidates != base.candidates)
+		result = "candidates: " + to_string(base.candidates) + " -> " + to_string(outcome.candidates);
+	if(outcome.seconds > base.seconds * (1.0 + tolerance / 100.0) && outcome.seconds - base.seconds > MIN_SLOWDOWN)
+	{
+		char str[50];
+		sprintf(str, "SLOWER (%+.0f%%)", (outcome.seconds / base.seconds - 1.0) * 100.0);
+		result += (result.empty() ? "" : ", ") + string(str);
+		same = false;
+	}
+	if(outcome.memory > base.memory * (1.0 + tolerance / 100.0))
+	{
+		char str[50];
+		sprintf(str, "MORE MEMORY (%+.0f%%)", ((double)outcome.memory / base.memory - 1.0) * 100.0);
+		result += (result.empty() ? "" : ", ") + string(str);
+		same = false;
+	}
+	return same;
+}
+
+int main(int argc, char* argv[])
+{
+	BatchSettings settings;
+	BatchJob job;
+	settings.output_path = "./";
+	job.seed = 1;
+	string folder = "../attachments/presets/", baseline_name, child;
+	bool update = false;
+	double tolerance = 20.0;
+	int repeat = 1;
+	vector<string> presets;
+	string options;  // passed on to every child
+	for(int i = 1; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		const bool has_value = (i + 1 < argc);
+		if(strcmp(arg, "--run") == 0 && has_value)  child = argv[++i];
+		else if(strcmp(arg, "--presets") == 0 && has_value)  folder = argv[++i];
+		else if(strcmp(arg, "--baseline") == 0 && has_value)  baseline_name = argv[++i];
+		else if(strcmp(arg, "--update") == 0)  update = true;
+		else if(strcmp(arg, "--tolerance") == 0 && has_value)  tolerance = atof(argv[++i]);
+		else if(strcmp(arg, "--repeat") == 0 && has_value)  repeat = max(atoi(argv[++i]), 1);
+		else if(strcmp(arg, "--seed") == 0 && has_value)  job.seed = strtoull(argv[++i], nullptr, 10);
+		else if(strcmp(arg, "--initial") == 0 && has_value)  job.initial = argv[++i];
+		else if(strcmp(arg, "--output-path") == 0 && has_value)  settings.output_path = argv[++i];
+		else if(strcmp(arg, "--database-path") == 0 && has_value)  settings.database_path = argv[++i];
+		else if(strcmp(arg, "--alignment-path") == 0 && has_value)  settings.align_path = argv[++i];
+		else if(strcmp(arg, "--set") == 0 && has_value && strchr(argv[i + 1], '=') != nullptr)
+		{
+			string item = argv[++i];
+			int eq = item.find('=');
+			job.overrides.push_back(make_pair(item.substr(0, eq), item.substr(eq + 1)));
+			options += " --set " + quote(item);
+		}
+		else if(arg[0] != '-')  presets.push_back(arg);
+		else
+		{
+			cerr << usage;
+			return 2;
+		}
+	}
+	if(settings.output_path.back() != '/' && settings.output_path.back() != '\\')
+		settings.output_path += '/';
+	if(folder.back() != '/' && folder.back() != '\\')
+		folder += '/';
+
+	if(!child.empty())
+	{
+		job.preset = child;
+		job.output_name = output_name(preset_name(child, folder));
+		return run_child(settings, job, folder);
+	}
+
+	if(baseline_name.empty())  baseline_name = settings.output_path + "regress-baseline.tsv";
+	if(presets.empty())
+	{
+		list_presets(folder, presets);
+		sort(presets.begin(), presets.end());
+	}
+	if(presets.empty())
+	{
+		cerr << "ERROR - no presets found in '" << folder << "'.\n";
+		return 2;
+	}
+	map<string, Outcome> baseline;
+	if(!update && !read_baseline(baseline_name, baseline))
+	{
+		cerr << "ERROR - failed to read the baseline '" << baseline_name << "'. Please run with '--update' first.\n";
+		return 2;
+	}
+	options += " --seed " + to_string(job.seed) + " --output-path " + quote(settings.output_path)
+				+ " --database-path " + quote(settings.database_path) + " --alignment-path " + quote(settings.align_path)
+				+ " --presets " + quote(folder);
+	if(!job.initial.empty())  options += " --initial " + quote(job.initial);
+
+	cout << "[[  ChordNova v3.0 [Build: 2021.1.14]  ]]\n"
+		  << "[[  (c) 2021 Wenge Chen, Ji-woon Sim.  ]]\n\n"
+		  << " > Utility - Regression test (seed " << job.seed << "):\n\n"
+		  << "   " << left << setw(44) << "preset" << right << setw(10) << "seconds" << setw(14) << "candidates/s"
+		  << setw(12) << "memory (MB)" << "   hash" << "\n";
+	vector<Outcome> outcomes;
+	int changed = 0;
+	for(const string& preset: presets)
+	{
+		Outcome outcome;
+		bool found = false;
+		for(int k = 0; k < repeat; ++k)
+		{
+			string command = quote(argv[0]) + " --run " + quote(preset) + options;
+#if __WIN32
+			command = "\"" + command + "\"";  // 'cmd /c' removes the outer quotes
+#endif
+			FILE* pipe = popen(command.c_str(), "r");
+			if(pipe == nullptr)  break;
+			string line;
+			char buffer[4096];
+			while(fgets(buffer, sizeof(buffer), pipe) != nullptr)
+				line += buffer;
+			pclose(pipe);
+			while(!line.empty() && (line.back() == '\n' || line.back() == '\r'))  line.pop_back();
+			Outcome run;
+			if(!read_outcome(line, run))  continue;
+			if(!found || run.seconds < outcome.seconds)
+			{
+				const long long memory = found ? min(outcome.memory, run.memory) : run.memory;
+				outcome = run;
+				outcome.memory = memory;
+			}
+			else  outcome.memory = min(outcome.memory, run.memory);
+			found = true;
+		}
+		if(!found)
+		{
+			outcome.preset = preset_name(preset, folder);
+			outcome.message = "ERROR - the run of the preset crashed or could not be started.";
+		}
+		outcomes.push_back(outcome);
+
+		char rate[30];
+		sprintf(rate, "%.3g", outcome.seconds > 0 ? outcome.candidates / outcome.seconds : 0.0);
+		cout << "   " << left << setw(44) << outcome.preset.substr(0, 43) << right << fixed << setprecision(3)
+			  << setw(10) << outcome.seconds << setw(14) << rate << setprecision(1) << setw(12) << outcome.memory / 1024.0
+			  << "   " << outcome.hash;
+		if(!outcome.done)  cout << "  (" << outcome.message << ")";
+		if(!update)
+		{
+			auto base = baseline.find(outcome.preset);
+			string change;
+			if(base == baseline.end())  change = "not in the baseline";
+			else if(!check_outcome(outcome, base -> second, tolerance, change))  ++changed;
+			if(!change.empty())  cout << "\n      -> " << change;
+		}
+		cout << endl;
+	}
+
+	if(update)
+	{
+		if(!write_baseline(baseline_name, outcomes))
+		{
+			cerr << "ERROR - failed to write the baseline '" << baseline_name << "'.\n";
+			return 2;
+		}
+		cout << "\n > The baseline is written to '" << baseline_name << "'.\n";
+		return 0;
+	}
+	if(changed == 0)  cout << "\n > All presets match the baseline.\n";
+	else  cout << "\n > " << changed << " preset(s) differ from the baseline.\n";
+	return (changed == 0) ? 0 : 1;
+}
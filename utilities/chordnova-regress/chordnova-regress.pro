@@ -0,0 +1,17 @@
+QT       -= gui core
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = chordnova-regress
+
+# The harness needs no Qt, and builds the same way as the other utilities:
+#   g++ -std=c++11 -O2 -pthread -o chordnova-regress chordnova-regress.cpp
+win32: LIBS += -lpsapi
+
+SOURCES += \
+    chordnova-regress.cpp
+
+qnx: target.path = /tmp/$${TARGET}/bin
+else: unix:!android: target.path = /opt/$${TARGET}/bin
+!isEmpty(target.path): INSTALLS += target
@@ -0,0 +1,69 @@
+// ChordNova-utility-dbcompile v3.0 [Build: 2021.1.14]
+// Compiles a chord database (.db) into the binary form (.cdb) loaded by ChordNova,
+// which stores the chord library as a bitmap for each omission setting.
+// (c) 2021 Wenge Chen, Ji-woon Sim.
+
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include "../../main/functions.h"
+#include "../../main/functions.cpp"
+
+using namespace std;
+
+int main()
+{
+	cout << "[[  ChordNova v3.0 [Build: 2021.1.14]  ]]\n"
+		  << "[[  (c) 2021 Wenge Chen, Ji-woon Sim.  ]]\n\n"
+		  << " > Utility - Compile Chord Database:\n";
+
+	cout << " > Please input the name of the database (.db) file: ";
+	char str1[100] = "\0", str2[100], str3[300];
+	inputFilename(str1, ".db", true);
+	ignore_path_ext(str2, str1);
+
+	char ch;
+	cout << "\n > Use the default omission settings (Y / N)? ";
+	inputY_N(ch);
+	if(ch == 'Y' || ch == 'y')
+	{
+		omission[4] = {5};
+		omission[5] = {3, 5};
+		omission[6] = {3, 5, 7};
+		omission[7] = {3, 5};
+	}
+	else
+	{
+		for(int i = 3; i <= 7; ++i)
+		{
+			bool valid;
+			do{
+				cout << " > Notes that can be omitted in " << i << "-note chords (1, 3, 5, 7, 9, 11, 13 with space; 0 for none): ";
+				inputVec(omission[i], 0, 13);
+				if(!omission[i].empty() && omission[i][0] == 0)
+					omission[i].erase(omission[i].begin());
+				valid = true;
+				for(int j = 0; j < (int)omission[i].size(); ++j)
+					if(omission[i][j] % 2 == 0)  valid = false;
+				if(!valid)  cout << " > Invalid input. Please try again.\n";
+			}  while(!valid);
+		}
+	}
+
+	dbentry(str1);
+	// This compiles the database as a side effect.
+	set_compiled_db_name(str3, str1);
+	ifstream fin(str3, ios::binary);
+	if(fin.is_open())
+	{
+		fin.close();
+		cout << "\n > " << chord_library.size() << " chords (including transpositions) compiled into "
+			  << str2 << ".cdb in the same folder.\n"
+			  << " > Each omission setting is compiled separately; run again to add another one.\n";
+	}
+	else  cout << "\n > Failed to write the compiled database. Please check whether the folder is writable.\n";
+
+	cout << "\n > Output finished. Now you can close the program.\n\n";
+	system("pause");
+	return 0;
+}
@@ -43,10 +43,8 @@ void to_text()
 
 void to_midi()
 {
-	int chord_count = organized.size(), note_count = 0;
-	for(int i = 0; i < chord_count; ++i)
-		note_count += organized[i].size();
-	midi_head(chord_count, note_count);
+	int chord_count = organized.size();
+	midi_head();
 	
 	for(int i = 0; i < chord_count; ++i)
 	{
@@ -55,9 +53,7 @@ void to_midi()
 		chord_to_midi(organized[i]);
 	}
 
-	char str3[5] = "\x00\xFF\x2F\x00";
-	m_fout.write(str3, 4);
-	m_fout.close();
+	midi_flush();
 }
 
 int main()
@@ -73,33 +69,15 @@ int main()
 	strncpy(path, str1, strlen(str1) - strlen(str2) - 3);
 	path[strlen(str1) - strlen(str2) - 3] = '\0';
 	
-	ifstream fin(str1, ios::in);
+	ChordReader reader;
+	open_chords(str1, reader);
 	char begin[10][100], ch;
 	int count = 0;
-	while(true)
-	{
-		ch = fin.peek();
-		if(ch == '/' || ch == 't')
-		{
-			fin.getline(begin[count], 100, '\n');
-			++count;
-		}
-		else  break;
-	}
-
-	int note;
-	vector<int> set;
-	do{
-		set.clear();
-		do{
-			fin >> note;
-			set.push_back(note);
-		}  while(!fin.eof() && fin.get() != '\n');
-		int size = set.size();
-		if(size == 0)  break;
-		rec.push_back(set);
-	}  while(!fin.eof());
-	fin.close();
+	while(count < 10 && read_header(reader, begin[count], 100))
+		++count;
+	while(read_chord(reader))
+		rec.push_back(reader.notes);
+	close_chords(reader);
 	
 	cout << "\n > Overwrite " << str2 << ".db? (Y / N) ";
 	inputY_N(ch);
@@ -1,7 +1,9 @@
 // ChordNova-utility-outputconv v3.0 [Build: 2021.1.14]
 // Converts the output file of main program (SmartChordGen) to a form that can be read by programs in utilities.
+// Both the text report (.txt) and exported binary results (.cnr) are accepted.
 // (c) 2021 Wenge Chen, Ji-woon Sim.
 
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <vector>
@@ -10,54 +12,60 @@
 #include "../../main/functions.cpp"
 using namespace std;
 
+void write_notes(const vector<int>& notes)
+{
+	for(int i = 0; i < (int)notes.size(); ++i)
+	{
+		if(i != 0)  fout << ' ';
+		fout << notes[i];
+	}
+	fout << '\n';
+}
+
 int main()
 {
 	cout << "[[  ChordNova v3.0 [Build: 2021.1.14]  ]]\n"
 		  << "[[  (c) 2021 Wenge Chen, Ji-woon Sim.  ]]\n\n"
 		  << " > Utility - Output Conversion:\n";
 	
-	cout << " > Please input the name of the chord data file you would like to convert (the default extension is '.txt): ";
+	cout << " > Please input the name of the chord data file you would like to convert,\n"
+		  << "   either a report or exported results (.cnr) (the default extension is '.txt'): ";
 	char input[100] = "\0";
 	inputFilename(input, ".txt", true);
-	ifstream fin(input, ios::in);
 	
 	cout << "\n > Please assign a name for the output file (the default extension is '.txt'): ";
 	char output[100] = "\0";
 	inputFilename(output, ".txt", false);
 	fout.open(output, ios::trunc);
 
-	char str[100] = "0";
-	int note, count = 0;
-	fin.getline(str, 100, '[');
-	do{
-		fin >> note;
-		if(count != 0)  fout << ' ';
-		fout << note;
-		++count;
-	}  while(fin.get() != ']');
-	fout << endl;
-
-	while(true)
+	ChordReader reader;
+	open_chords(input, reader);
+	if(reader.is_results)
+		while(read_chord(reader))
+			write_notes(reader.notes);
+	else
 	{
-		do{
-			fin.getline(str, 100, '\n');
-		}  while(fin && !fin.eof() && fin.peek() != '-');
-		if(!fin || fin.eof())  break;
-		fin >> str;
-		fin.get();  fin.get();
-		count = 0;
-		do{
-			fin >> note;
-			if(count != 0)  fout << ' ';
-			fout << note;
-			++count;
-		}  while(fin.get() != ']');
-		fout << endl;
+		// The initial chord is on the first line with '[', each result on a line beginning with "->".
+		const char *begin, *end, *left, *right;
+		vector<int> notes;
+		bool initial = true;
+		while(read_line(reader, begin, end))
+		{
+			if(!initial && (begin == end || *begin != '-'))  continue;
+			left = (const char*)memchr(begin, '[', end - begin);
+			if(left == nullptr)  continue;
+			right = (const char*)memchr(left, ']', end - left);
+			if(right == nullptr)  right = end;
+			notes.clear();
+			parse_notes(left + 1, right, notes);
+			write_notes(notes);
+			initial = false;
+		}
 	}
+	close_chords(reader);
 
 	cout << "\n > Output finished. Now you can close the program.\n\n";
 	fout.close();
 	system("pause"); 
 	return 0;
 }
-
@@ -64,10 +64,8 @@ void to_text()
 
 void to_midi()
 {
-	int chord_count = organized.size(), note_count = 0;
-	for(int i = 0; i < chord_count; ++i)
-		note_count += organized[i].size();
-	midi_head(chord_count, note_count);
+	int chord_count = organized.size();
+	midi_head();
 	
 	for(int i = 0; i < chord_count; ++i)
 	{
@@ -76,8 +74,7 @@ void to_midi()
 		chord_to_midi(organized[i]);
 	}
 	
-	m_fout.write("\x00\xFF\x2F\x00", 4);
-	m_fout.close();
+	midi_flush();
 }
 
 vector<int> get_vec(vector<int>& note_set)